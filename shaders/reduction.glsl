@@ -0,0 +1,46 @@
+// Workgroup wide reductions through shared memory. Include after defining
+// REDUCTION_SIZE as the number of invocations in the workgroup, a power of
+// two. Every invocation has to make the same calls, in uniform control flow.
+
+shared float reduction_scratch[REDUCTION_SIZE];
+
+// Sum of `value` over the workgroup, returned to every invocation
+float workgroup_sum(float value) {
+  uint index = gl_LocalInvocationIndex;
+
+  reduction_scratch[index] = value;
+  barrier();
+
+  for (uint stride = REDUCTION_SIZE / 2u; stride > 0u; stride >>= 1) {
+    if (index < stride)
+      reduction_scratch[index] += reduction_scratch[index + stride];
+
+    barrier();
+  }
+
+  float sum = reduction_scratch[0];
+  barrier();
+
+  return sum;
+}
+
+// Inclusive prefix sum of `value` in invocation order
+float workgroup_prefix_sum(float value) {
+  uint index = gl_LocalInvocationIndex;
+
+  reduction_scratch[index] = value;
+  barrier();
+
+  for (uint offset = 1u; offset < REDUCTION_SIZE; offset <<= 1) {
+    float other = index >= offset ? reduction_scratch[index - offset] : 0.0;
+    barrier();
+
+    reduction_scratch[index] += other;
+    barrier();
+  }
+
+  float sum = reduction_scratch[index];
+  barrier();
+
+  return sum;
+}
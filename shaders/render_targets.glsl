@@ -0,0 +1,91 @@
+// The accumulation and normal textures, in the formats picked at startup.
+// ACCUMULATION_FORMAT and NORMAL_FORMAT are defined by the host when the
+// shader is built, see render_targets.c. Include after gpu_layout.h.
+
+#if ACCUMULATION_FORMAT == ACCUMULATION_RGBA32F
+layout (rgba32f, binding = 0) uniform image2D render_texture;
+#elif ACCUMULATION_FORMAT == ACCUMULATION_RGBA16F
+layout (rgba16f, binding = 0) uniform image2D render_texture;
+#else
+layout (r11f_g11f_b10f, binding = 0) uniform image2D render_texture;
+#endif
+
+#if NORMAL_FORMAT == NORMALS_OCT16
+layout (rg16_snorm, binding = 1) uniform image2D normal_texture;
+#else
+layout (rgba32f, binding = 1) uniform image2D normal_texture;
+#endif
+
+// Mean radiance of the accumulated frames, black before the first one
+vec3 load_accumulated_mean(ivec2 pixel_position) {
+  vec4 accumulated = imageLoad(render_texture, pixel_position);
+
+#if ACCUMULATION_FORMAT == ACCUMULATION_RGBA32F
+  return accumulated.a > 0.0 ? accumulated.rgb / accumulated.a : vec3(0.0);
+#else
+  return accumulated.rgb;
+#endif
+}
+
+#if ACCUMULATION_FORMAT != ACCUMULATION_RGBA32F
+// Rounds to one of the two closest values the format can hold, picking each
+// with a probability proportional to how close it is. The mean is then
+// unbiased however small an update is next to the precision of the format.
+// `u` is uniform in [0, 1). Both formats have the exponent range of half
+// floats and no sign.
+float stochastic_round(float x, int mantissa_bits, float u) {
+  x = clamp(x, 0.0, 65000.0);
+
+  if (x == 0.0)
+    return 0.0;
+
+  int exponent;
+  frexp(x, exponent);
+
+  float ulp   = exp2(float(max(exponent - 1, -14) - mantissa_bits));
+  float below = floor(x / ulp) * ulp;
+
+  return below + (u < (x - below) / ulp ? ulp : 0.0);
+}
+
+void store_accumulated_mean(ivec2 pixel_position, vec3 mean, vec3 u) {
+#if ACCUMULATION_FORMAT == ACCUMULATION_RGBA16F
+  ivec3 mantissa_bits = ivec3(10, 10, 10);
+#else
+  ivec3 mantissa_bits = ivec3(6, 6, 5);
+#endif
+
+  vec3 rounded = vec3(
+    stochastic_round(mean.r, mantissa_bits.r, u.r),
+    stochastic_round(mean.g, mantissa_bits.g, u.g),
+    stochastic_round(mean.b, mantissa_bits.b, u.b)
+  );
+
+  imageStore(render_texture, pixel_position, vec4(rounded, 1.0));
+}
+#endif
+
+vec2 octahedral_encode(vec3 n) {
+  n /= abs(n.x) + abs(n.y) + abs(n.z);
+
+  vec2 folded = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+
+  return n.z >= 0.0 ? n.xy : folded;
+}
+
+void store_normal(ivec2 pixel_position, vec3 normal) {
+#if NORMAL_FORMAT == NORMALS_OCT16
+  imageStore(normal_texture, pixel_position, vec4(octahedral_encode(normal), 0.0, 0.0));
+#else
+  imageStore(normal_texture, pixel_position, vec4(normal * 0.5 + 0.5, 1.0));
+#endif
+}
+
+// Pixels whose first ray hits nothing keep this
+void clear_normal(ivec2 pixel_position) {
+#if NORMAL_FORMAT == NORMALS_OCT16
+  imageStore(normal_texture, pixel_position, vec4(0.0));
+#else
+  imageStore(normal_texture, pixel_position, vec4(0.0, 0.0, 0.0, 1.0));
+#endif
+}
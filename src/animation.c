@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <glad/glad.h>
+
+#include <GLFW/glfw3.h>
+
+#include "animation.h"
+#include "compute.h"
+#include "gpu_buffer.h"
+#include "manager.h"
+#include "scene.h"
+
+#define REFIT_WORKGROUP_SIZE 64
+
+static compute_t *refit_shader;
+static compute_t *sah_shader;
+
+static bool gpu_refit_pending[max_meshes];
+static bool reported_stale_wide_bvh;
+
+// The SAH cost computed on the GPU is read back once its fence signals, which
+// is usually a frame or two later. Only one readback is in flight at a time.
+static GLsync stats_fence;
+static bool   stats_in_flight[max_meshes];
+
+void init_animation() {
+    refit_shader = build_compute_shader("shaders/bvh_refit.comp");
+    sah_shader   = build_compute_shader("shaders/bvh_sah.comp");
+
+    float zeros[max_meshes] = {0};
+
+    manager->bvh_stats_buffer = make_gpu_buffer("bvh stats", GL_SHADER_STORAGE_BUFFER, SSBO_BINDING_BVH_STATS,
+                                                sizeof(float), GPU_BUFFER_DYNAMIC);
+    gpu_buffer_upload(manager->bvh_stats_buffer, zeros, max_meshes);
+}
+
+static void poll_gpu_stats() {
+    if (stats_fence == NULL)
+        return;
+
+    GLenum status = glClientWaitSync(stats_fence, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        return;
+
+    glDeleteSync(stats_fence);
+    stats_fence = NULL;
+
+    float sah_cost[max_meshes];
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, manager->bvh_stats_buffer->id);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(float) * n_meshes, sah_cost);
+
+    for (int i = 0; i < n_meshes; i++) {
+        if (stats_in_flight[i])
+            scene_meshes[i].sah_cost = sah_cost[i];
+
+        stats_in_flight[i] = false;
+    }
+}
+
+static void rebuild_mesh(int mesh_id) {
+    scene_rebuild_mesh(mesh_id);
+
+    // Anything computed for the old tree is meaningless now
+    gpu_refit_pending[mesh_id] = false;
+    stats_in_flight[mesh_id]   = false;
+
+    manager->n_bvh_rebuilds++;
+}
+
+// Moves the scene and brings the bottom level BVHs up to date, either by
+// rebuilding them or by refitting. Refitted trees are rebuilt once their SAH
+// cost grows past `bvh_rebuild_threshold` times the cost they had when built.
+void update_animation(float time) {
+    double start = glfwGetTime();
+
+    scene_animate(time);
+    poll_gpu_stats();
+
+    for (int i = 0; i < n_meshes; i++) {
+        mesh_t *mesh = &scene_meshes[i];
+
+        if (!mesh->primitives_dirty)
+            continue;
+
+        switch (manager->bvh_update_mode) {
+            case BVH_UPDATE_REBUILD: rebuild_mesh(i); continue;
+            case BVH_UPDATE_REFIT_CPU: scene_refit_mesh(i); break;
+            case BVH_UPDATE_REFIT_GPU: gpu_refit_pending[i] = true; break;
+        }
+
+        if (mesh->sah_cost > mesh->bvh->build_cost * manager->bvh_rebuild_threshold)
+            rebuild_mesh(i);
+    }
+
+    manager->bvh_update_time = glfwGetTime() - start;
+}
+
+// The 4-wide nodes can only be traversed while they match the binary ones
+bool wide_bvh_up_to_date() {
+    for (int i = 0; i < n_meshes; i++) {
+        if (scene_meshes[i].wide_nodes_stale)
+            return false;
+    }
+
+    return true;
+}
+
+// Must run after flush_scene_buffers, since the kernel reads the primitives
+// from the GPU buffers
+void dispatch_gpu_refit() {
+    bool refitted[max_meshes] = {false};
+    bool any_refitted         = false;
+
+    compute_use(refit_shader);
+
+    for (int i = 0; i < n_meshes; i++) {
+        if (!gpu_refit_pending[i])
+            continue;
+
+        mesh_t *mesh = &scene_meshes[i];
+        bvh_t  *bvh  = mesh->bvh;
+
+        compute_set_int(refit_shader, "primitive_type", mesh->primitive_type);
+
+        for (int level = bvh->n_levels - 1; level >= 0; level--) {
+            int first = bvh->level_offsets[level];
+            int count = bvh->level_offsets[level + 1] - first;
+
+            compute_set_int(refit_shader, "first", mesh->first_node + first);
+            compute_set_int(refit_shader, "count", count);
+
+            glDispatchCompute((count + REFIT_WORKGROUP_SIZE - 1) / REFIT_WORKGROUP_SIZE, 1, 1);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        }
+
+        if (manager->wide_bvh && !reported_stale_wide_bvh) {
+            printf("the wide BVH is not refitted on the GPU, tracing the binary BVH until the meshes are rebuilt\n");
+            reported_stale_wide_bvh = true;
+        }
+
+        gpu_refit_pending[i]   = false;
+        mesh->wide_nodes_stale = true;
+        refitted[i]            = true;
+        any_refitted           = true;
+    }
+
+    if (!any_refitted || stats_fence != NULL)
+        return;
+
+    compute_use(sah_shader);
+
+    for (int i = 0; i < n_meshes; i++) {
+        if (!refitted[i])
+            continue;
+
+        compute_set_int(sah_shader, "first_node", scene_meshes[i].first_node);
+        compute_set_int(sah_shader, "n_nodes", scene_meshes[i].bvh->n_nodes);
+        compute_set_int(sah_shader, "mesh_id", i);
+
+        glDispatchCompute(1, 1, 1);
+        stats_in_flight[i] = true;
+    }
+
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    stats_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
@@ -16,20 +16,20 @@
  *
  */
 
-#ifndef SRC_FPS_H_
-#define SRC_FPS_H_
+#ifndef SRC_ANIMATION_H_
+#define SRC_ANIMATION_H_
 
-#define FPS_BUFFER_SIZE 512
+#include <stdbool.h>
 
-void   init_fps();
-void   add_fps_sample(float fps);
-float  get_max_fps();
-float  get_max_fps_with_sample_limit(unsigned int last_n_samples);
-float  get_average_fps();
-float  get_average_fps_with_sample_limit(unsigned int last_n_samples);
-float *get_fps_buffer();
-float *get_fps_buffer_with_sample_limit(unsigned int last_n_samples);
-float *get_fps_index_buffer();
-int    get_fps_sample_count();
+typedef enum {
+    BVH_UPDATE_REBUILD   = 0, // Full SAH build every frame
+    BVH_UPDATE_REFIT_CPU = 1,
+    BVH_UPDATE_REFIT_GPU = 2,
+} bvh_update_mode_t;
 
-#endif // SRC_FPS_H_
+void init_animation();
+void update_animation(float time);
+void dispatch_gpu_refit();
+bool wide_bvh_up_to_date();
+
+#endif // SRC_ANIMATION_H_
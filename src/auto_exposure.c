@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// Automatic exposure, entirely on the GPU. A luminance histogram of the
+// accumulation is reduced to an average, and the exposure adapts towards the
+// one that maps it to middle grey. The result stays in a storage buffer that
+// the tone mapping LUT is baked from, so the CPU never waits on it.
+
+#include <glad/glad.h>
+
+#include "auto_exposure.h"
+#include "compute.h"
+#include "gpu_buffer.h"
+#include "gpu_layout.h"
+#include "manager.h"
+#include "render_targets.h"
+
+#define HISTOGRAM_WORKGROUP_SIZE 16
+
+static compute_t *histogram_shader;
+static compute_t *adapt_shader;
+
+static gpu_buffer_t *histogram_buffer;
+static gpu_buffer_t *exposure_buffer;
+
+void init_auto_exposure() {
+    histogram_shader = build_compute_shader_with_header("shaders/luminance_histogram.comp",
+                                                        render_targets_shader_header());
+    adapt_shader     = build_compute_shader("shaders/exposure_adapt.comp");
+
+    uint32_t zeros[AUTO_EXPOSURE_BINS] = {0};
+
+    histogram_buffer = make_gpu_buffer("luminance histogram", GL_SHADER_STORAGE_BUFFER, SSBO_BINDING_HISTOGRAM,
+                                       sizeof(uint32_t), GPU_BUFFER_DYNAMIC);
+    gpu_buffer_upload(histogram_buffer, zeros, AUTO_EXPOSURE_BINS);
+
+    exposure_buffer = make_gpu_buffer("exposure", GL_SHADER_STORAGE_BUFFER, SSBO_BINDING_EXPOSURE,
+                                      sizeof(gpu_exposure_t), GPU_BUFFER_DYNAMIC);
+    auto_exposure_reset();
+}
+
+// The next update adapts all the way at once
+void auto_exposure_reset() {
+    gpu_exposure_t exposure = {.exposure = 1.0f};
+
+    gpu_buffer_upload(exposure_buffer, &exposure, 1);
+}
+
+// Render thread, after the accumulation changed and before the LUT is baked
+void auto_exposure_update(float delta_time) {
+    compute_use(histogram_shader);
+    glDispatchCompute((manager->render_width + HISTOGRAM_WORKGROUP_SIZE - 1) / HISTOGRAM_WORKGROUP_SIZE,
+                      (manager->render_height + HISTOGRAM_WORKGROUP_SIZE - 1) / HISTOGRAM_WORKGROUP_SIZE, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    compute_use(adapt_shader);
+    compute_set_float(adapt_shader, "delta_time", delta_time);
+    compute_set_float(adapt_shader, "low_percentile", AUTO_EXPOSURE_LOW_PERCENTILE);
+    compute_set_float(adapt_shader, "high_percentile", AUTO_EXPOSURE_HIGH_PERCENTILE);
+    compute_set_float(adapt_shader, "key_value", AUTO_EXPOSURE_KEY_VALUE);
+    compute_set_float(adapt_shader, "adaptation_speed", AUTO_EXPOSURE_SPEED);
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef SRC_AUTO_EXPOSURE_H_
+#define SRC_AUTO_EXPOSURE_H_
+
+// Pixels darker than the low percentile or brighter than the high one don't
+// count towards the average luminance
+#define AUTO_EXPOSURE_LOW_PERCENTILE  0.5f
+#define AUTO_EXPOSURE_HIGH_PERCENTILE 0.95f
+#define AUTO_EXPOSURE_KEY_VALUE       0.18f // Middle grey
+#define AUTO_EXPOSURE_SPEED           1.5f  // Per second, in log space
+
+void init_auto_exposure();
+void auto_exposure_reset();
+void auto_exposure_update(float delta_time);
+
+#endif // SRC_AUTO_EXPOSURE_H_
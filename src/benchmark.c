@@ -0,0 +1,288 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glad/glad.h>
+
+#include <GLFW/glfw3.h>
+
+#include "benchmark.h"
+#include "frame_stats.h"
+#include "gpu_buffer.h"
+#include "gpu_layout.h"
+#include "manager.h"
+
+typedef struct {
+    double   frame_time; // Wall clock, between the end of two frames
+    uint64_t gpu_time;   // Nanoseconds
+    uint64_t rays;
+    uint64_t paths;
+    bool     persistent_threads; // Traced by the persistent threads kernel
+} frame_sample_t;
+
+static bool     running;
+static uint32_t queries[BENCHMARK_FRAMES_IN_FLIGHT];
+static bool     query_pending[BENCHMARK_FRAMES_IN_FLIGHT];
+static bool     counter_pending[BENCHMARK_FRAMES_IN_FLIGHT]; // The frame in the slot counted its rays
+static double   frame_times[BENCHMARK_FRAMES_IN_FLIGHT];
+static bool     frame_kernels[BENCHMARK_FRAMES_IN_FLIGHT];
+static uint64_t frame_index;
+static double   last_frame_end;
+static uint64_t uncommitted_rays; // Read back, but not yet added to frame_stats
+static uint64_t uncommitted_paths;
+
+static frame_sample_t *samples;
+static size_t          n_samples;
+static size_t          samples_capacity;
+
+void init_benchmark() {
+    uint32_t zeros[BENCHMARK_FRAMES_IN_FLIGHT * RAY_COUNTER_STRIDE] = {0};
+
+    // The raytracer always declares the counter, so the buffer exists even when no benchmark is running
+    manager->ray_counter_buffer = make_gpu_buffer("ray counter", GL_SHADER_STORAGE_BUFFER, SSBO_BINDING_RAY_COUNTER,
+                                                  sizeof(uint32_t), GPU_BUFFER_DYNAMIC);
+    gpu_buffer_upload(manager->ray_counter_buffer, zeros, BENCHMARK_FRAMES_IN_FLIGHT * RAY_COUNTER_STRIDE);
+}
+
+void start_benchmark() {
+    glGenQueries(BENCHMARK_FRAMES_IN_FLIGHT, queries);
+
+    samples_capacity = 1024;
+    samples          = malloc(sizeof(frame_sample_t) * samples_capacity);
+    n_samples        = 0;
+    frame_index      = 0;
+    last_frame_end   = glfwGetTime();
+    running          = true;
+}
+
+bool benchmark_running() { return running; }
+
+int benchmark_ray_counter_slot() { return frame_index % BENCHMARK_FRAMES_IN_FLIGHT; }
+
+// Blocks until the GPU is done with the frame in `slot`, which by the time the
+// slot is reused is usually long done
+static void collect(int slot) {
+    uint32_t counters[RAY_COUNTER_STRIDE] = {0};
+
+    if (counter_pending[slot]) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, manager->ray_counter_buffer->id);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, slot * sizeof(counters), sizeof(counters), counters);
+        counter_pending[slot] = false;
+    }
+
+    uint64_t rays  = counters[RAY_COUNTER_RAYS] | (uint64_t)counters[RAY_COUNTER_RAYS + 1] << 32;
+    uint64_t paths = counters[RAY_COUNTER_PATHS] | (uint64_t)counters[RAY_COUNTER_PATHS + 1] << 32;
+
+    uncommitted_rays += rays;
+    uncommitted_paths += paths;
+
+    if (!query_pending[slot])
+        return;
+
+    frame_sample_t sample;
+
+    glGetQueryObjectui64v(queries[slot], GL_QUERY_RESULT, &sample.gpu_time);
+
+    sample.rays               = rays;
+    sample.paths              = paths;
+    sample.frame_time         = frame_times[slot];
+    sample.persistent_threads = frame_kernels[slot];
+    query_pending[slot]       = false;
+
+    if (n_samples == samples_capacity) {
+        samples_capacity *= 2;
+        samples = realloc(samples, sizeof(frame_sample_t) * samples_capacity);
+    }
+
+    samples[n_samples++] = sample;
+}
+
+// Rays are counted for every benchmark frame, and for the others whenever
+// Russian roulette can end paths early, since the average path length is
+// then worth watching. Must hold the render state lock.
+bool benchmark_counts_rays() { return running || manager->roulette_depth < manager->n_bounces; }
+
+// Hands the rays read back so far over to frame_stats, which the main thread
+// reads and resets. Render thread, with the render state lock held.
+void benchmark_commit_ray_counts() {
+    frame_stats_add_rays(uncommitted_rays, uncommitted_paths);
+
+    uncommitted_rays  = 0;
+    uncommitted_paths = 0;
+}
+
+// The counter ring goes around on every traced frame, the timer queries only
+// while a benchmark is running
+void benchmark_begin_frame() {
+    int      slot                      = benchmark_ray_counter_slot();
+    uint32_t zeros[RAY_COUNTER_STRIDE] = {0};
+
+    if (query_pending[slot] || counter_pending[slot])
+        collect(slot);
+
+    gpu_buffer_update(manager->ray_counter_buffer, slot * RAY_COUNTER_STRIDE, RAY_COUNTER_STRIDE, zeros);
+
+    if (running)
+        glBeginQuery(GL_TIME_ELAPSED, queries[slot]);
+}
+
+void benchmark_end_frame(bool persistent_threads, bool counted_rays) {
+    int slot = benchmark_ray_counter_slot();
+
+    if (counted_rays) {
+        // Makes the ray counter visible to glGetBufferSubData
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        counter_pending[slot] = true;
+    }
+
+    if (running) {
+        double now = glfwGetTime();
+
+        glEndQuery(GL_TIME_ELAPSED);
+
+        frame_times[slot]   = now - last_frame_end;
+        frame_kernels[slot] = persistent_threads;
+        query_pending[slot] = true;
+        last_frame_end      = now;
+    }
+
+    frame_index++;
+}
+
+// Collects the frames still in flight, oldest first
+void benchmark_finish() {
+    if (!running)
+        return;
+
+    for (int i = 0; i < BENCHMARK_FRAMES_IN_FLIGHT; i++) {
+        int slot = (frame_index + i) % BENCHMARK_FRAMES_IN_FLIGHT;
+
+        if (query_pending[slot] || counter_pending[slot])
+            collect(slot);
+    }
+
+    // The render thread is stopped by now, so nothing else touches frame_stats
+    benchmark_commit_ray_counts();
+
+    glDeleteQueries(BENCHMARK_FRAMES_IN_FLIGHT, queries);
+    running = false;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+// Nearest rank
+static double percentile(const double *sorted, size_t count, double p) {
+    size_t rank = (size_t)ceil(p / 100.0 * count);
+
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void print_distribution(const char *name, double *values, size_t count) {
+    double total = 0;
+
+    for (size_t i = 0; i < count; i++)
+        total += values[i];
+
+    qsort(values, count, sizeof(double), compare_doubles);
+
+    printf("  %-10s mean %8.3f ms  p50 %8.3f ms  p95 %8.3f ms  p99 %8.3f ms  max %8.3f ms\n", name,
+           total / count * 1e3, percentile(values, count, 50) * 1e3, percentile(values, count, 95) * 1e3,
+           percentile(values, count, 99) * 1e3, values[count - 1] * 1e3);
+}
+
+static const char *kernel_name(bool persistent_threads) { return persistent_threads ? "persistent" : "tiles"; }
+
+// Summary of the frames traced by one of the kernels
+static void report_kernel(bool persistent_threads) {
+    double *wall_times  = malloc(sizeof(double) * n_samples);
+    double *gpu_times   = malloc(sizeof(double) * n_samples);
+    size_t  count       = 0;
+    double  total_gpu   = 0;
+    double  total_wall  = 0;
+    double  total_rays  = 0;
+    double  total_paths = 0;
+
+    for (size_t i = 0; i < n_samples; i++) {
+        if (samples[i].persistent_threads != persistent_threads)
+            continue;
+
+        wall_times[count] = samples[i].frame_time;
+        gpu_times[count]  = samples[i].gpu_time * 1e-9;
+        total_gpu += gpu_times[count];
+        total_wall += wall_times[count];
+        total_rays += samples[i].rays;
+        total_paths += samples[i].paths;
+        count++;
+    }
+
+    if (count > 0) {
+        printf("benchmark: %zu frames in %.3f s with the %s kernel\n", count, total_wall,
+               kernel_name(persistent_threads));
+        print_distribution("frame", wall_times, count);
+        print_distribution("gpu", gpu_times, count);
+        printf("  rays       %.0f total, %.2f Mrays/s of GPU time, %.2f Mrays/s of wall time\n", total_rays,
+               total_rays / total_gpu * 1e-6, total_rays / total_wall * 1e-6);
+
+        // Rays traced by the CPU tiles are not counted, and neither are their paths
+        if (total_paths > 0)
+            printf("  paths      %.0f total, %.2f rays per path on average\n", total_paths, total_rays / total_paths);
+    }
+
+    free(wall_times);
+    free(gpu_times);
+}
+
+void benchmark_report(const char *csv_path) {
+    if (n_samples == 0) {
+        printf("benchmark: no frames were rendered\n");
+        return;
+    }
+
+    if (csv_path) {
+        FILE *file = fopen(csv_path, "w");
+
+        if (file) {
+            fprintf(file, "frame,frame_time_ms,gpu_time_ms,rays,paths,kernel\n");
+            for (size_t i = 0; i < n_samples; i++) {
+                fprintf(file, "%zu,%.6f,%.6f,%" PRIu64 ",%" PRIu64 ",%s\n", i, samples[i].frame_time * 1e3,
+                        samples[i].gpu_time * 1e-6, samples[i].rays, samples[i].paths,
+                        kernel_name(samples[i].persistent_threads));
+            }
+
+            fclose(file);
+            printf("per frame timings written to %s\n", csv_path);
+        } else {
+            printf("failed to open %s for writing\n", csv_path);
+        }
+    }
+
+    // Either or both, see --compare-kernels
+    report_kernel(false);
+    report_kernel(true);
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef SRC_BENCHMARK_H_
+#define SRC_BENCHMARK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// GPU timer queries and ray counters are kept in a ring, so that reading the
+// results of a frame never waits on the frames that are still being rendered
+#define BENCHMARK_FRAMES_IN_FLIGHT 4
+
+void init_benchmark();
+void start_benchmark();
+void benchmark_begin_frame();
+void benchmark_end_frame(bool persistent_threads, bool counted_rays);
+void benchmark_finish();
+void benchmark_report(const char *csv_path);
+int  benchmark_ray_counter_slot();
+bool benchmark_running();
+bool benchmark_counts_rays();
+void benchmark_commit_ray_counts();
+
+#endif // SRC_BENCHMARK_H_
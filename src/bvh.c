@@ -0,0 +1,573 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bvh.h"
+
+#define BVH_BINS 16
+
+typedef struct {
+    aabb_t   bounds;
+    uint32_t count;
+} bin_t;
+
+typedef struct {
+    const aabb_t *bounds;
+    vec3         *centroids;
+    uint32_t      max_leaf_size;
+} build_context_t;
+
+void aabb_empty(aabb_t *aabb) {
+    aabb->min[0] = aabb->min[1] = aabb->min[2] = FLT_MAX;
+    aabb->max[0] = aabb->max[1] = aabb->max[2] = -FLT_MAX;
+}
+
+void aabb_grow(aabb_t *aabb, vec3 point) {
+    glm_vec3_minv(aabb->min, point, aabb->min);
+    glm_vec3_maxv(aabb->max, point, aabb->max);
+}
+
+void aabb_merge(aabb_t *aabb, const aabb_t *other) {
+    glm_vec3_minv(aabb->min, (float *)other->min, aabb->min);
+    glm_vec3_maxv(aabb->max, (float *)other->max, aabb->max);
+}
+
+// Bounds of the eight transformed corners
+void aabb_transform(const aabb_t *aabb, mat4 transform, aabb_t *dest) {
+    aabb_t result;
+    aabb_empty(&result);
+
+    for (int i = 0; i < 8; i++) {
+        vec3 corner = {
+            (i & 1) ? aabb->max[0] : aabb->min[0],
+            (i & 2) ? aabb->max[1] : aabb->min[1],
+            (i & 4) ? aabb->max[2] : aabb->min[2],
+        };
+
+        glm_mat4_mulv3(transform, corner, 1.0f, corner);
+        aabb_grow(&result, corner);
+    }
+
+    *dest = result;
+}
+
+float aabb_surface_area(const aabb_t *aabb) {
+    vec3 extent;
+    glm_vec3_sub((float *)aabb->max, (float *)aabb->min, extent);
+
+    if (extent[0] < 0 || extent[1] < 0 || extent[2] < 0)
+        return 0.0f;
+
+    return 2.0f * (extent[0] * extent[1] + extent[1] * extent[2] + extent[2] * extent[0]);
+}
+
+static void node_bounds(const gpu_bvh_node_t *node, aabb_t *aabb) {
+    glm_vec3_copy((float *)node->aabb_min, aabb->min);
+    glm_vec3_copy((float *)node->aabb_max, aabb->max);
+}
+
+static void update_node_bounds(bvh_t *bvh, build_context_t *context, uint32_t node_index) {
+    gpu_bvh_node_t *node = &bvh->nodes[node_index];
+    aabb_t          bounds;
+
+    aabb_empty(&bounds);
+
+    for (uint32_t i = 0; i < (uint32_t)node->count; i++)
+        aabb_merge(&bounds, &context->bounds[bvh->indices[node->left_first + i]]);
+
+    glm_vec3_copy(bounds.min, node->aabb_min);
+    glm_vec3_copy(bounds.max, node->aabb_max);
+}
+
+// Binned SAH. Returns the cost of the best split, or FLT_MAX if the centroids
+// can't be separated along any axis.
+static float find_best_split(bvh_t *bvh, build_context_t *context, gpu_bvh_node_t *node, int *best_axis,
+                             float *best_position) {
+    float best_cost = FLT_MAX;
+
+    aabb_t centroid_bounds;
+    aabb_empty(&centroid_bounds);
+
+    for (int i = 0; i < node->count; i++)
+        aabb_grow(&centroid_bounds, context->centroids[bvh->indices[node->left_first + i]]);
+
+    for (int axis = 0; axis < 3; axis++) {
+        float bounds_min = centroid_bounds.min[axis];
+        float bounds_max = centroid_bounds.max[axis];
+
+        if (bounds_min == bounds_max)
+            continue;
+
+        bin_t bins[BVH_BINS];
+        for (int i = 0; i < BVH_BINS; i++) {
+            aabb_empty(&bins[i].bounds);
+            bins[i].count = 0;
+        }
+
+        float scale = BVH_BINS / (bounds_max - bounds_min);
+
+        for (int i = 0; i < node->count; i++) {
+            uint32_t primitive = bvh->indices[node->left_first + i];
+            int      bin       = (int)((context->centroids[primitive][axis] - bounds_min) * scale);
+            bin                = bin < BVH_BINS - 1 ? bin : BVH_BINS - 1;
+
+            bins[bin].count++;
+            aabb_merge(&bins[bin].bounds, &context->bounds[primitive]);
+        }
+
+        // Sweep from both sides to get the area and count of every split plane
+        float    left_area[BVH_BINS - 1];
+        float    right_area[BVH_BINS - 1];
+        uint32_t left_count[BVH_BINS - 1];
+        uint32_t right_count[BVH_BINS - 1];
+
+        aabb_t   left_box, right_box;
+        uint32_t left_sum = 0, right_sum = 0;
+
+        aabb_empty(&left_box);
+        aabb_empty(&right_box);
+
+        for (int i = 0; i < BVH_BINS - 1; i++) {
+            left_sum += bins[i].count;
+            aabb_merge(&left_box, &bins[i].bounds);
+            left_count[i] = left_sum;
+            left_area[i]  = aabb_surface_area(&left_box);
+
+            right_sum += bins[BVH_BINS - 1 - i].count;
+            aabb_merge(&right_box, &bins[BVH_BINS - 1 - i].bounds);
+            right_count[BVH_BINS - 2 - i] = right_sum;
+            right_area[BVH_BINS - 2 - i]  = aabb_surface_area(&right_box);
+        }
+
+        for (int i = 0; i < BVH_BINS - 1; i++) {
+            if (left_count[i] == 0 || right_count[i] == 0)
+                continue;
+
+            float cost = left_count[i] * left_area[i] + right_count[i] * right_area[i];
+
+            if (cost < best_cost) {
+                best_cost      = cost;
+                *best_axis     = axis;
+                *best_position = bounds_min + (i + 1) / scale;
+            }
+        }
+    }
+
+    return best_cost;
+}
+
+// Levels below a node of `count` primitives in a balanced tree, with one primitive per leaf
+static uint32_t balanced_levels(uint32_t count) {
+    uint32_t levels = 0;
+
+    while ((1u << levels) < count)
+        levels++;
+
+    return levels;
+}
+
+static void subdivide(bvh_t *bvh, build_context_t *context, uint32_t node_index, uint32_t depth) {
+    gpu_bvh_node_t *node = &bvh->nodes[node_index];
+
+    if (node->count <= 1)
+        return;
+
+    // Once the primitives only just fit in the levels left before
+    // BVH_MAX_DEPTH as a balanced tree, the SAH is ignored and the range is
+    // split in half, so that the traversal stacks never overflow
+    bool balanced = depth + balanced_levels(node->count) >= BVH_MAX_DEPTH;
+
+    int   axis     = 0;
+    float position = 0;
+    float cost     = find_best_split(bvh, context, node, &axis, &position);
+
+    aabb_t bounds;
+    node_bounds(node, &bounds);
+    float area      = aabb_surface_area(&bounds);
+    float leaf_cost = node->count * area;
+
+    if (node->count <= (int)context->max_leaf_size && cost + BVH_TRAVERSAL_COST * area >= leaf_cost)
+        return;
+
+    uint32_t first = node->left_first;
+    uint32_t count = node->count;
+    uint32_t split = first;
+
+    if (cost < FLT_MAX && !balanced) {
+        uint32_t last = first + count - 1;
+
+        while (split <= last) {
+            if (context->centroids[bvh->indices[split]][axis] < position) {
+                split++;
+            } else {
+                uint32_t tmp        = bvh->indices[split];
+                bvh->indices[split] = bvh->indices[last];
+                bvh->indices[last]  = tmp;
+
+                if (last == 0)
+                    break;
+
+                last--;
+            }
+        }
+    }
+
+    // Coincident centroids (or a degenerate partition, or no levels to spare), split the range in half
+    if (split == first || split == first + count)
+        split = first + count / 2;
+
+    uint32_t left_index  = bvh->n_nodes++;
+    uint32_t right_index = bvh->n_nodes++;
+
+    bvh->nodes[left_index].left_first  = first;
+    bvh->nodes[left_index].count       = split - first;
+    bvh->nodes[right_index].left_first = split;
+    bvh->nodes[right_index].count      = first + count - split;
+
+    node->left_first = left_index;
+    node->count      = 0;
+
+    update_node_bounds(bvh, context, left_index);
+    update_node_bounds(bvh, context, right_index);
+
+    subdivide(bvh, context, left_index, depth + 1);
+    subdivide(bvh, context, right_index, depth + 1);
+}
+
+// Breadth first order, so that every level of the tree is a contiguous range
+// that can be refitted in parallel once the level below it is done
+static void compute_levels(bvh_t *bvh) {
+    uint32_t *depth = malloc(sizeof(uint32_t) * bvh->n_nodes);
+    uint32_t  head  = 0;
+    uint32_t  tail  = 0;
+
+    bvh->level_order[tail++] = 0;
+    depth[0]                 = 0;
+    bvh->n_levels            = 0;
+
+    while (head < tail) {
+        uint32_t        node_index = bvh->level_order[head];
+        gpu_bvh_node_t *node       = &bvh->nodes[node_index];
+
+        if (depth[node_index] == bvh->n_levels)
+            bvh->level_offsets[bvh->n_levels++] = head;
+
+        if (node->count == 0) {
+            for (int i = 0; i < 2; i++) {
+                bvh->level_order[tail++]    = node->left_first + i;
+                depth[node->left_first + i] = depth[node_index] + 1;
+            }
+        }
+
+        head++;
+    }
+
+    bvh->level_offsets[bvh->n_levels] = bvh->n_nodes;
+
+    free(depth);
+}
+
+bvh_t *build_bvh(const aabb_t *bounds, uint32_t n_primitives, uint32_t max_leaf_size) {
+    assert(max_leaf_size > 0);
+
+    bvh_t *bvh = malloc(sizeof(bvh_t));
+
+    // A binary tree with one primitive per leaf has at most 2n - 1 nodes
+    uint32_t max_nodes = n_primitives > 0 ? 2 * n_primitives - 1 : 1;
+
+    bvh->nodes        = calloc(max_nodes, sizeof(gpu_bvh_node_t));
+    bvh->indices      = malloc(sizeof(uint32_t) * (n_primitives > 0 ? n_primitives : 1));
+    bvh->n_primitives = n_primitives;
+    bvh->n_nodes      = 1;
+
+    for (uint32_t i = 0; i < n_primitives; i++)
+        bvh->indices[i] = i;
+
+    build_context_t context;
+    context.bounds        = bounds;
+    context.max_leaf_size = max_leaf_size;
+    context.centroids     = malloc(sizeof(vec3) * (n_primitives > 0 ? n_primitives : 1));
+
+    for (uint32_t i = 0; i < n_primitives; i++) {
+        glm_vec3_add((float *)bounds[i].min, (float *)bounds[i].max, context.centroids[i]);
+        glm_vec3_scale(context.centroids[i], 0.5f, context.centroids[i]);
+    }
+
+    bvh->nodes[0].left_first = 0;
+    bvh->nodes[0].count      = n_primitives;
+
+    update_node_bounds(bvh, &context, 0);
+    subdivide(bvh, &context, 0, 0);
+
+    free(context.centroids);
+
+    bvh->level_order   = malloc(sizeof(uint32_t) * bvh->n_nodes);
+    bvh->level_offsets = malloc(sizeof(uint32_t) * (bvh->n_nodes + 1));
+    compute_levels(bvh);
+
+    // Holds as long as the primitives fit in a balanced tree of that depth
+    assert(bvh->n_levels <= BVH_MAX_DEPTH + 1);
+
+    bvh->build_cost = bvh_sah_cost(bvh);
+
+    return bvh;
+}
+
+// Recomputes the bounds of every node from the primitives, keeping the tree
+// topology. Children are always stored after their parent, so walking the
+// nodes backwards visits both children before the node itself. `bounds` is
+// indexed by leaf slot, ie the primitives are expected to be in the order of
+// `indices` already.
+float bvh_refit(bvh_t *bvh, const aabb_t *bounds) {
+    for (uint32_t i = bvh->n_nodes; i-- > 0;) {
+        gpu_bvh_node_t *node = &bvh->nodes[i];
+        aabb_t          node_aabb;
+
+        aabb_empty(&node_aabb);
+
+        if (node->count > 0) {
+            for (int j = 0; j < node->count; j++)
+                aabb_merge(&node_aabb, &bounds[node->left_first + j]);
+        } else {
+            for (int j = 0; j < 2; j++) {
+                aabb_t child;
+                node_bounds(&bvh->nodes[node->left_first + j], &child);
+                aabb_merge(&node_aabb, &child);
+            }
+        }
+
+        glm_vec3_copy(node_aabb.min, node->aabb_min);
+        glm_vec3_copy(node_aabb.max, node->aabb_max);
+    }
+
+    return bvh_sah_cost(bvh);
+}
+
+// Expected cost of tracing a random ray that hits the root, with the usual
+// surface area heuristic. Refitting keeps the topology but not the quality, so
+// comparing this to `build_cost` tells how much the tree has degraded.
+float bvh_sah_cost(const bvh_t *bvh) {
+    aabb_t root;
+    node_bounds(&bvh->nodes[0], &root);
+
+    float root_area = aabb_surface_area(&root);
+    float cost      = 0.0f;
+
+    if (root_area <= 0.0f)
+        return 0.0f;
+
+    for (uint32_t i = 0; i < bvh->n_nodes; i++) {
+        const gpu_bvh_node_t *node = &bvh->nodes[i];
+        aabb_t                aabb;
+
+        node_bounds(node, &aabb);
+
+        if (node->count > 0)
+            cost += node->count * aabb_surface_area(&aabb);
+        else
+            cost += BVH_TRAVERSAL_COST * aabb_surface_area(&aabb);
+    }
+
+    return cost / root_area;
+}
+
+// Smallest power of two exponent that maps [0, 255] over the whole extent
+static int quantization_exponent(float min, float max) {
+    if (max <= min)
+        return -126;
+
+    int exponent = (int)ceilf(log2f((max - min) / 255.0f));
+
+    while (min + ldexpf(255.0f, exponent) < max)
+        exponent++;
+
+    return exponent < -126 ? -126 : exponent;
+}
+
+// Conservative, the decoded child box always contains the real one
+static void quantize_child(gpu_bvh4_node_t *node, int slot, const aabb_t *child, vec3 scale) {
+    for (int axis = 0; axis < 3; axis++) {
+        float origin = node->origin[axis];
+        int   lo     = (int)floorf((child->min[axis] - origin) / scale[axis]);
+        int   hi     = (int)ceilf((child->max[axis] - origin) / scale[axis]);
+
+        lo = lo < 0 ? 0 : (lo > 255 ? 255 : lo);
+        hi = hi < 0 ? 0 : (hi > 255 ? 255 : hi);
+
+        while (lo > 0 && origin + lo * scale[axis] > child->min[axis])
+            lo--;
+        while (hi < 255 && origin + hi * scale[axis] < child->max[axis])
+            hi++;
+
+        node->bounds_min[axis] |= (int)((uint32_t)lo << (8 * slot));
+        node->bounds_max[axis] |= (int)((uint32_t)hi << (8 * slot));
+    }
+}
+
+// Subtrees with this many primitives or less become a single leaf child. Their
+// primitives are contiguous, so this only costs a few more primitive tests and
+// avoids wide nodes with mostly empty slots near the bottom of the tree.
+#define BVH4_MAX_LEAF_SIZE 3
+
+typedef struct {
+    const bvh_t     *bvh;
+    gpu_bvh4_node_t *nodes;
+    uint32_t         n_nodes;
+
+    // Primitive range covered by each binary node
+    uint32_t *first;
+    uint32_t *count;
+
+    int node_offset;
+    int primitive_offset;
+} collapse_context_t;
+
+static bool collapses_to_leaf(collapse_context_t *context, uint32_t binary_index) {
+    return context->bvh->nodes[binary_index].count > 0 || context->count[binary_index] <= BVH4_MAX_LEAF_SIZE;
+}
+
+static uint32_t collapse_node(collapse_context_t *context, uint32_t binary_index) {
+    const bvh_t *bvh        = context->bvh;
+    uint32_t     wide_index = context->n_nodes++;
+    uint32_t     children[BVH4_WIDTH];
+    int          n_children = 0;
+
+    if (collapses_to_leaf(context, binary_index)) {
+        children[n_children++] = binary_index;
+    } else {
+        children[n_children++] = bvh->nodes[binary_index].left_first;
+        children[n_children++] = bvh->nodes[binary_index].left_first + 1;
+    }
+
+    // Open the internal child with the largest surface area, until the node
+    // is full or only leaves are left
+    while (n_children < BVH4_WIDTH) {
+        int   best      = -1;
+        float best_area = -1.0f;
+
+        for (int i = 0; i < n_children; i++) {
+            aabb_t bounds;
+
+            if (collapses_to_leaf(context, children[i]))
+                continue;
+
+            node_bounds(&bvh->nodes[children[i]], &bounds);
+
+            if (aabb_surface_area(&bounds) > best_area) {
+                best      = i;
+                best_area = aabb_surface_area(&bounds);
+            }
+        }
+
+        if (best == -1)
+            break;
+
+        uint32_t first         = bvh->nodes[children[best]].left_first;
+        children[best]         = first;
+        children[n_children++] = first + 1;
+    }
+
+    gpu_bvh4_node_t node;
+    aabb_t          parent;
+    vec3            scale;
+
+    memset(&node, 0, sizeof(gpu_bvh4_node_t));
+    node_bounds(&bvh->nodes[binary_index], &parent);
+    glm_vec3_copy(parent.min, node.origin);
+
+    for (int axis = 0; axis < 3; axis++) {
+        int exponent = quantization_exponent(parent.min[axis], parent.max[axis]);
+        scale[axis]  = ldexpf(1.0f, exponent);
+        node.exponents |= (exponent + 127) << (8 * axis);
+    }
+
+    for (int i = 0; i < BVH4_WIDTH; i++) {
+        if (i >= n_children) {
+            node.child[i] = -1;
+            continue;
+        }
+
+        aabb_t bounds;
+        node_bounds(&bvh->nodes[children[i]], &bounds);
+        quantize_child(&node, i, &bounds, scale);
+
+        if (collapses_to_leaf(context, children[i])) {
+            node.child[i] = context->first[children[i]] + context->primitive_offset;
+            node.counts |= (int)(context->count[children[i]] << (8 * i));
+        } else {
+            node.child[i] = collapse_node(context, children[i]) + context->node_offset;
+        }
+    }
+
+    context->nodes[wide_index] = node;
+
+    return wide_index;
+}
+
+// Collapses the binary BVH into 4-wide nodes with quantized child bounds. The
+// nodes array needs room for one node per primitive. Child node indices are
+// shifted by `node_offset` and primitive indices by `primitive_offset`, so the
+// result can be placed anywhere in a larger array. Returns the node count.
+uint32_t bvh_collapse4(const bvh_t *bvh, gpu_bvh4_node_t *nodes, int node_offset, int primitive_offset) {
+    collapse_context_t context;
+
+    context.bvh              = bvh;
+    context.nodes            = nodes;
+    context.n_nodes          = 0;
+    context.first            = malloc(sizeof(uint32_t) * bvh->n_nodes);
+    context.count            = malloc(sizeof(uint32_t) * bvh->n_nodes);
+    context.node_offset      = node_offset;
+    context.primitive_offset = primitive_offset;
+
+    // Children come after their parent, and the left child covers the start
+    // of the range of its parent
+    for (uint32_t i = bvh->n_nodes; i-- > 0;) {
+        const gpu_bvh_node_t *node = &bvh->nodes[i];
+
+        if (node->count > 0) {
+            context.first[i] = node->left_first;
+            context.count[i] = node->count;
+        } else {
+            context.first[i] = context.first[node->left_first];
+            context.count[i] = context.count[node->left_first] + context.count[node->left_first + 1];
+        }
+    }
+
+    collapse_node(&context, 0);
+
+    free(context.first);
+    free(context.count);
+
+    return context.n_nodes;
+}
+
+void destroy_bvh(bvh_t *bvh) {
+    assert(bvh);
+
+    free(bvh->nodes);
+    free(bvh->indices);
+    free(bvh->level_order);
+    free(bvh->level_offsets);
+    free(bvh);
+}
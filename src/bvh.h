@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef SRC_BVH_H_
+#define SRC_BVH_H_
+
+#include <stdint.h>
+
+#include <cglm/cglm.h>
+
+#include "gpu_layout.h"
+
+#define BVH4_WIDTH 4
+
+typedef struct {
+    vec3 min;
+    vec3 max;
+} aabb_t;
+
+typedef struct {
+    gpu_bvh_node_t *nodes;
+    uint32_t        n_nodes;
+
+    // Leaves reference ranges of this array, which holds the original index of
+    // each primitive. Callers are expected to reorder their primitives with it.
+    uint32_t *indices;
+    uint32_t  n_primitives;
+
+    // Node indices sorted by depth. Level `i` is the range
+    // [level_offsets[i], level_offsets[i + 1]) of `level_order`.
+    uint32_t *level_order;
+    uint32_t *level_offsets;
+    uint32_t  n_levels;
+
+    float build_cost;
+} bvh_t;
+
+bvh_t *build_bvh(const aabb_t *bounds, uint32_t n_primitives, uint32_t max_leaf_size);
+void   destroy_bvh(bvh_t *bvh);
+float  bvh_refit(bvh_t *bvh, const aabb_t *bounds);
+float  bvh_sah_cost(const bvh_t *bvh);
+
+uint32_t bvh_collapse4(const bvh_t *bvh, gpu_bvh4_node_t *nodes, int node_offset, int primitive_offset);
+
+void  aabb_empty(aabb_t *aabb);
+void  aabb_grow(aabb_t *aabb, vec3 point);
+void  aabb_merge(aabb_t *aabb, const aabb_t *other);
+void  aabb_transform(const aabb_t *aabb, mat4 transform, aabb_t *dest);
+float aabb_surface_area(const aabb_t *aabb);
+
+#endif // SRC_BVH_H_
@@ -28,6 +28,7 @@
 
 #include "camera.h"
 #include "manager.h"
+#include "options.h"
 #include "rendering.h"
 #include "settings.h"
 #include "utils.h"
@@ -54,6 +55,10 @@ Camera *make_camera() {
     camera->yaw   = 90;
     camera->zoom  = 45;
 
+    camera->orthographic   = false;
+    camera->aperture       = 0.0f;
+    camera->focus_distance = 10.0f;
+
     update_camera_target(camera, 0, 0);
     update_camera_projection_matrix(camera);
     update_camera_position_matrix(camera);
@@ -145,8 +150,19 @@ void update_camera_position(Camera *camera, Direction direction) {
     update_camera_position_matrix(manager->camera);
 }
 
+// Of the image, not of the window. Tiled renders only hold a tile of it at a time.
+static float aspect_ratio() {
+    if (options.tiled_path)
+        return (float)options.render_width / (float)options.render_height;
+
+    return (float)manager->render_width / (float)manager->render_height;
+}
+
 void update_camera_projection_matrix(Camera *camera) {
-    glm_perspective(deg2rad(camera->zoom), aspect_ratio, near_plane, far_plane, camera->projection);
+    glm_perspective(deg2rad(camera->zoom), aspect_ratio(), near_plane, far_plane, camera->projection);
+
+    update_camera_basis(camera);
+    reset_accumulation();
 }
 
 void update_camera_position_matrix(Camera *camera) {
@@ -164,5 +180,45 @@ void update_camera_position_matrix(Camera *camera) {
     glm_vec3_add(camera->camera_pos, camera->camera_front, camera->camera_target);
     glm_lookat(camera->camera_pos, camera->camera_target, camera->camera_up, camera->view);
 
-    clear_texture(manager->render_texture);
+    update_camera_basis(camera);
+    reset_accumulation();
+}
+
+// Everything the shader needs to turn a point on the image into a ray, so that
+// generating a primary ray is just a couple of multiply-adds. Must be called
+// whenever the position, orientation, fov or lens change.
+void update_camera_basis(Camera *camera) {
+    float viewport_height = 2.0f * tanf(deg2rad(camera->zoom) / 2.0f) * camera->focus_distance;
+    float viewport_width  = viewport_height * aspect_ratio();
+    float lens_radius     = camera->aperture / 2.0f;
+
+    vec3 right, up, tmp;
+
+    glm_vec3_crossn(camera->camera_front, camera->camera_up, right);
+    glm_vec3_cross(right, camera->camera_front, up);
+
+    glm_vec3_scale(right, viewport_width, camera->horizontal);
+    glm_vec3_scale(up, viewport_height, camera->vertical);
+    glm_vec3_scale(right, lens_radius, camera->lens_u);
+    glm_vec3_scale(up, lens_radius, camera->lens_v);
+    glm_vec3_scale(camera->camera_front, camera->focus_distance, camera->forward);
+
+    glm_vec3_add(camera->camera_pos, camera->forward, camera->lower_left);
+    glm_vec3_scale(camera->horizontal, 0.5f, tmp);
+    glm_vec3_sub(camera->lower_left, tmp, camera->lower_left);
+    glm_vec3_scale(camera->vertical, 0.5f, tmp);
+    glm_vec3_sub(camera->lower_left, tmp, camera->lower_left);
+}
+
+void camera_fill_frame_params(Camera *camera, gpu_frame_params_t *params) {
+    glm_vec3_copy(camera->camera_pos, params->camera_origin);
+    glm_vec3_copy(camera->lower_left, params->camera_lower_left);
+    glm_vec3_copy(camera->horizontal, params->camera_horizontal);
+    glm_vec3_copy(camera->vertical, params->camera_vertical);
+    glm_vec3_copy(camera->forward, params->camera_forward);
+    glm_vec3_copy(camera->lens_u, params->camera_lens_u);
+    glm_vec3_copy(camera->lens_v, params->camera_lens_v);
+
+    params->orthographic = camera->orthographic;
+    params->thin_lens    = camera->aperture > 0.0f;
 }
@@ -23,6 +23,7 @@
 
 #include <cglm/cglm.h>
 
+#include "gpu_layout.h"
 #include "shader_c.h"
 #include "utils.h"
 
@@ -41,6 +42,22 @@ typedef struct {
     float zoom;
 
     bool orthographic;
+
+    /////////////////
+    // Thin lens
+    //
+    float aperture; // Lens diameter, 0 for a pinhole camera
+    float focus_distance;
+
+    /////////////////
+    // Ray generation basis, see update_camera_basis
+    //
+    vec3 lower_left; // Corner of the viewport on the focus plane
+    vec3 horizontal;
+    vec3 vertical;
+    vec3 lens_u; // Camera right and up, scaled by the lens radius
+    vec3 lens_v;
+    vec3 forward; // Scaled by the focus distance
 } Camera;
 
 Camera *make_camera();
@@ -52,5 +69,7 @@ void    update_camera_position(Camera *camera, Direction direction);
 
 void update_camera_projection_matrix(Camera *camera);
 void update_camera_position_matrix(Camera *camera);
+void update_camera_basis(Camera *camera);
+void camera_fill_frame_params(Camera *camera, gpu_frame_params_t *params);
 
 #endif // SRC_CAMERA_H_
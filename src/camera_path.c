@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "camera_path.h"
+
+// Plain text, one keyframe per line: x y z yaw pitch zoom. Lines starting
+// with a # are comments.
+
+camera_path_t *make_camera_path() {
+    camera_path_t *camera_path = malloc(sizeof(camera_path_t));
+
+    camera_path->count     = 0;
+    camera_path->capacity  = 256;
+    camera_path->keyframes = malloc(sizeof(camera_keyframe_t) * camera_path->capacity);
+
+    return camera_path;
+}
+
+void destroy_camera_path(camera_path_t *camera_path) {
+    assert(camera_path);
+
+    free(camera_path->keyframes);
+    free(camera_path);
+}
+
+static void add_keyframe(camera_path_t *camera_path, camera_keyframe_t *keyframe) {
+    if (camera_path->count == camera_path->capacity) {
+        camera_path->capacity *= 2;
+        camera_path->keyframes = realloc(camera_path->keyframes, sizeof(camera_keyframe_t) * camera_path->capacity);
+    }
+
+    camera_path->keyframes[camera_path->count++] = *keyframe;
+}
+
+camera_path_t *load_camera_path(const char *path) {
+    FILE *file = fopen(path, "r");
+
+    if (file == NULL) {
+        printf("failed to open camera path %s\n", path);
+        exit(1);
+    }
+
+    camera_path_t *camera_path = make_camera_path();
+    char           line[256];
+    int            line_number = 0;
+
+    while (fgets(line, sizeof(line), file)) {
+        camera_keyframe_t keyframe;
+
+        line_number++;
+
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+
+        if (sscanf(line, "%f %f %f %f %f %f", &keyframe.position[0], &keyframe.position[1], &keyframe.position[2],
+                   &keyframe.yaw, &keyframe.pitch, &keyframe.zoom) != 6) {
+            printf("%s:%d: malformed keyframe\n", path, line_number);
+            exit(1);
+        }
+
+        add_keyframe(camera_path, &keyframe);
+    }
+
+    fclose(file);
+
+    if (camera_path->count == 0) {
+        printf("camera path %s has no keyframes\n", path);
+        exit(1);
+    }
+
+    printf("loaded %zu keyframes from %s\n", camera_path->count, path);
+
+    return camera_path;
+}
+
+void save_camera_path(camera_path_t *camera_path, const char *path) {
+    FILE *file = fopen(path, "w");
+
+    if (file == NULL) {
+        printf("failed to open %s for writing\n", path);
+        return;
+    }
+
+    fprintf(file, "# x y z yaw pitch zoom\n");
+
+    for (size_t i = 0; i < camera_path->count; i++) {
+        camera_keyframe_t *keyframe = &camera_path->keyframes[i];
+        fprintf(file, "%.9g %.9g %.9g %.9g %.9g %.9g\n", keyframe->position[0], keyframe->position[1],
+                keyframe->position[2], keyframe->yaw, keyframe->pitch, keyframe->zoom);
+    }
+
+    fclose(file);
+
+    printf("saved %zu keyframes to %s\n", camera_path->count, path);
+}
+
+void camera_path_record(camera_path_t *camera_path, Camera *camera) {
+    camera_keyframe_t keyframe;
+
+    glm_vec3_copy(camera->camera_pos, keyframe.position);
+    keyframe.yaw   = camera->yaw;
+    keyframe.pitch = camera->pitch;
+    keyframe.zoom  = camera->zoom;
+
+    add_keyframe(camera_path, &keyframe);
+}
+
+void camera_path_apply(camera_path_t *camera_path, size_t index, Camera *camera) {
+    assert(index < camera_path->count);
+
+    camera_keyframe_t *keyframe = &camera_path->keyframes[index];
+
+    glm_vec3_copy(keyframe->position, camera->camera_pos);
+    camera->yaw   = keyframe->yaw;
+    camera->pitch = keyframe->pitch;
+    camera->zoom  = keyframe->zoom;
+
+    update_camera_target(camera, 0, 0);
+    update_camera_projection_matrix(camera);
+}
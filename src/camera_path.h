@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef SRC_CAMERA_PATH_H_
+#define SRC_CAMERA_PATH_H_
+
+#include <stddef.h>
+
+#include <cglm/cglm.h>
+
+#include "camera.h"
+
+// Playback advances one keyframe per frame, and the simulation time advances
+// by this much, regardless of how long the frame took to render
+#define CAMERA_PATH_TIMESTEP (1.0f / 60.0f)
+
+typedef struct {
+    vec3  position;
+    float yaw;
+    float pitch;
+    float zoom;
+} camera_keyframe_t;
+
+typedef struct {
+    camera_keyframe_t *keyframes;
+    size_t             count;
+    size_t             capacity;
+} camera_path_t;
+
+camera_path_t *make_camera_path();
+camera_path_t *load_camera_path(const char *path);
+void           destroy_camera_path(camera_path_t *camera_path);
+void           camera_path_record(camera_path_t *camera_path, Camera *camera);
+void           camera_path_apply(camera_path_t *camera_path, size_t index, Camera *camera);
+void           save_camera_path(camera_path_t *camera_path, const char *path);
+
+#endif // SRC_CAMERA_PATH_H_
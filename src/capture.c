@@ -0,0 +1,565 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// Screenshots and image sequences. The render thread only ever queues GPU
+// commands here: the image is copied into a persistently mapped pixel pack
+// buffer, and once its fence has signalled the slot is handed to an encoder
+// thread that reads the mapping directly and writes the file.
+//
+// PNG is read from the display image, so it looks like the screen without the
+// GUI. EXR and PFM are the raw mean
+// radiance of the accumulation. The encoders are small and self contained:
+// PNG is written with stored deflate blocks, and EXR without compression.
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <glad/glad.h>
+
+#include "capture.h"
+#include "display.h"
+#include "gpu_buffer.h"
+#include "manager.h"
+#include "options.h"
+#include "render_targets.h"
+#include "render_thread.h"
+
+typedef enum {
+    SLOT_FREE,
+    SLOT_READBACK, // Waiting on the GPU, owned by the render thread
+    SLOT_ENCODING, // Queued for or being written by the encoder thread
+} slot_state_t;
+
+typedef struct {
+    gpu_buffer_t    *buffer;
+    GLsync           fence;
+    slot_state_t     state;
+    capture_format_t format;
+    uint32_t         width; // Render resolution when it was captured
+    uint32_t         height;
+    char             path[1024];
+} capture_slot_t;
+
+static capture_slot_t slots[CAPTURE_SLOTS];
+
+// Slots ready to encode, oldest first
+static int encode_queue[CAPTURE_SLOTS];
+static int encode_head;
+static int encode_count;
+
+static pthread_t       encoder;
+static pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  encoder_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  slot_freed   = PTHREAD_COND_INITIALIZER;
+static bool            quit;
+static uint32_t        n_written;
+
+// What the current frame captures, decided by capture_update
+static bool             pending;
+static capture_format_t pending_format;
+static char             pending_path[1024];
+static uint32_t         sequence_frame;
+static uint32_t         screenshot_count;
+
+static size_t image_size() { return (size_t)manager->render_width * manager->render_height * 4 * sizeof(float); }
+
+const char *capture_format_extension(capture_format_t format) {
+    switch (format) {
+        case CAPTURE_PNG: return "png";
+        case CAPTURE_EXR: return "exr";
+        case CAPTURE_PFM: return "pfm";
+    }
+
+    return "";
+}
+
+bool capture_format_from_path(const char *path, capture_format_t *format) {
+    const char *extension = strrchr(path, '.');
+
+    if (extension == NULL)
+        return false;
+
+    for (capture_format_t f = CAPTURE_PNG; f <= CAPTURE_PFM; f++) {
+        if (strcmp(extension + 1, capture_format_extension(f)) == 0) {
+            *format = f;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Encoders. Pixels come in OpenGL order, bottom row first.
+
+typedef struct {
+    FILE    *file;
+    uint32_t crc;
+    uint32_t adler_a;
+    uint32_t adler_b;
+} png_writer_t;
+
+static uint32_t crc_table[256];
+
+static void init_crc_table() {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+
+        crc_table[n] = c;
+    }
+}
+
+static void png_write(png_writer_t *writer, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+
+    for (size_t i = 0; i < size; i++)
+        writer->crc = crc_table[(writer->crc ^ bytes[i]) & 0xff] ^ (writer->crc >> 8);
+
+    fwrite(data, size, 1, writer->file);
+}
+
+static void png_write_u32(png_writer_t *writer, uint32_t value) {
+    uint8_t bytes[4] = {value >> 24, value >> 16, value >> 8, value};
+    png_write(writer, bytes, 4);
+}
+
+static void png_begin_chunk(png_writer_t *writer, const char *type, uint32_t size) {
+    uint8_t bytes[4] = {size >> 24, size >> 16, size >> 8, size};
+    fwrite(bytes, 4, 1, writer->file);
+
+    writer->crc = 0xffffffffu;
+    png_write(writer, type, 4);
+}
+
+static void png_end_chunk(png_writer_t *writer) {
+    uint32_t crc      = writer->crc ^ 0xffffffffu;
+    uint8_t  bytes[4] = {crc >> 24, crc >> 16, crc >> 8, crc};
+    fwrite(bytes, 4, 1, writer->file);
+}
+
+// Uncompressed data inside the zlib stream also goes through the adler32 checksum
+static void png_write_data(png_writer_t *writer, const uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        writer->adler_a = (writer->adler_a + data[i]) % 65521;
+        writer->adler_b = (writer->adler_b + writer->adler_a) % 65521;
+    }
+
+    png_write(writer, data, size);
+}
+
+static bool write_png(FILE *file, const uint8_t *pixels, uint32_t width, uint32_t height) {
+    const size_t row_size  = 1 + width * 3; // Filter type, then rgb
+    const size_t data_size = row_size * height;
+    const size_t n_blocks  = (data_size + 65534) / 65535;
+
+    png_writer_t writer = {.file = file, .adler_a = 1, .adler_b = 0};
+    uint8_t     *row    = malloc(row_size);
+
+    fwrite("\x89PNG\r\n\x1a\n", 8, 1, file);
+
+    png_begin_chunk(&writer, "IHDR", 13);
+    png_write_u32(&writer, width);
+    png_write_u32(&writer, height);
+    png_write(&writer, "\x08\x02\x00\x00\x00", 5); // 8 bit rgb, no interlacing
+    png_end_chunk(&writer);
+
+    // A zlib header, stored deflate blocks of at most 65535 bytes, and the adler32
+    png_begin_chunk(&writer, "IDAT", 2 + n_blocks * 5 + data_size + 4);
+    png_write(&writer, "\x78\x01", 2);
+
+    size_t remaining_in_block = 0;
+    size_t written            = 0;
+
+    for (uint32_t y = 0; y < height; y++) {
+        const uint8_t *src = &pixels[(size_t)(height - 1 - y) * width * 4];
+
+        row[0] = 0;
+        for (uint32_t x = 0; x < width; x++)
+            memcpy(&row[1 + x * 3], &src[x * 4], 3);
+
+        for (size_t offset = 0; offset < row_size;) {
+            if (remaining_in_block == 0) {
+                size_t  block_size = data_size - written < 65535 ? data_size - written : 65535;
+                bool    final      = written + block_size == data_size;
+                uint8_t header[5]  = {final, block_size & 0xff, block_size >> 8, ~block_size & 0xff,
+                                      (~block_size >> 8) & 0xff};
+
+                png_write(&writer, header, 5);
+                remaining_in_block = block_size;
+            }
+
+            size_t size = row_size - offset < remaining_in_block ? row_size - offset : remaining_in_block;
+
+            png_write_data(&writer, &row[offset], size);
+            offset += size;
+            written += size;
+            remaining_in_block -= size;
+        }
+    }
+
+    png_write_u32(&writer, writer.adler_b << 16 | writer.adler_a);
+    png_end_chunk(&writer);
+
+    png_begin_chunk(&writer, "IEND", 0);
+    png_end_chunk(&writer);
+
+    free(row);
+
+    return !ferror(file);
+}
+
+// The accumulation holds a sum of frames in rgb and their count in alpha
+static void mean_radiance(const float *texel, float rgb[3]) {
+    for (int c = 0; c < 3; c++)
+        rgb[c] = texel[3] > 0 ? texel[c] / texel[3] : 0;
+}
+
+static void exr_attribute(FILE *file, const char *name, const char *type, int32_t size, const void *value) {
+    fwrite(name, strlen(name) + 1, 1, file);
+    fwrite(type, strlen(type) + 1, 1, file);
+    fwrite(&size, 4, 1, file);
+    fwrite(value, size, 1, file);
+}
+
+// Single part scanline file, one line per chunk, no compression. Everything
+// in EXR is little endian, like the hosts we run on.
+static bool write_exr(FILE *file, const float *pixels, int32_t width, int32_t height) {
+    const uint8_t magic[8] = {0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0};
+    fwrite(magic, 8, 1, file);
+
+    // Channels are sorted by name. Each is its name, then the FLOAT pixel
+    // type, the pLinear flag, three reserved bytes and the x and y sampling.
+    uint8_t     channels[3 * 18 + 1] = {0};
+    const char *names                = "BGR";
+
+    for (int i = 0; i < 3; i++) {
+        uint8_t *channel  = &channels[i * 18];
+        int32_t  type     = 2;
+        int32_t  sampling = 1;
+
+        channel[0] = names[i];
+        memcpy(&channel[2], &type, 4);
+        memcpy(&channel[10], &sampling, 4);
+        memcpy(&channel[14], &sampling, 4);
+    }
+
+    int32_t window[4] = {0, 0, width - 1, height - 1};
+    uint8_t zero      = 0;
+    float   one       = 1.0f;
+    float   center[2] = {0.0f, 0.0f};
+
+    exr_attribute(file, "channels", "chlist", sizeof(channels), channels);
+    exr_attribute(file, "compression", "compression", 1, &zero);
+    exr_attribute(file, "dataWindow", "box2i", sizeof(window), window);
+    exr_attribute(file, "displayWindow", "box2i", sizeof(window), window);
+    exr_attribute(file, "lineOrder", "lineOrder", 1, &zero);
+    exr_attribute(file, "pixelAspectRatio", "float", 4, &one);
+    exr_attribute(file, "screenWindowCenter", "v2f", sizeof(center), center);
+    exr_attribute(file, "screenWindowWidth", "float", 4, &one);
+    fwrite(&zero, 1, 1, file);
+
+    // Offsets of every line, which come right after this table
+    int32_t  line_size  = width * 3 * sizeof(float);
+    uint64_t line_start = ftell(file) + (uint64_t)height * sizeof(uint64_t);
+
+    for (int32_t y = 0; y < height; y++) {
+        uint64_t offset = line_start + (uint64_t)y * (8 + line_size);
+        fwrite(&offset, 8, 1, file);
+    }
+
+    float *line = malloc(line_size);
+
+    // Top row first, with the channels one after the other
+    for (int32_t y = 0; y < height; y++) {
+        const float *src = &pixels[(size_t)(height - 1 - y) * width * 4];
+
+        for (int32_t x = 0; x < width; x++) {
+            float rgb[3];
+            mean_radiance(&src[x * 4], rgb);
+
+            line[x]             = rgb[2];
+            line[width + x]     = rgb[1];
+            line[2 * width + x] = rgb[0];
+        }
+
+        fwrite(&y, 4, 1, file);
+        fwrite(&line_size, 4, 1, file);
+        fwrite(line, line_size, 1, file);
+    }
+
+    free(line);
+
+    return !ferror(file);
+}
+
+// Bottom row first, like OpenGL. A negative scale means little endian.
+static bool write_pfm(FILE *file, const float *pixels, uint32_t width, uint32_t height) {
+    const size_t count = (size_t)width * height;
+    float       *rgb   = malloc(count * 3 * sizeof(float));
+
+    for (size_t i = 0; i < count; i++)
+        mean_radiance(&pixels[i * 4], &rgb[i * 3]);
+
+    fprintf(file, "PF\n%u %u\n-1.0\n", width, height);
+    fwrite(rgb, count * 3 * sizeof(float), 1, file);
+    free(rgb);
+
+    return !ferror(file);
+}
+
+static void encode(capture_slot_t *slot) {
+    FILE *file = fopen(slot->path, "wb");
+
+    if (file == NULL) {
+        printf("capture: failed to open %s for writing\n", slot->path);
+        return;
+    }
+
+    bool ok = false;
+
+    switch (slot->format) {
+        case CAPTURE_PNG: ok = write_png(file, slot->buffer->mapped, slot->width, slot->height); break;
+        case CAPTURE_EXR: ok = write_exr(file, slot->buffer->mapped, slot->width, slot->height); break;
+        case CAPTURE_PFM: ok = write_pfm(file, slot->buffer->mapped, slot->width, slot->height); break;
+    }
+
+    ok = fclose(file) == 0 && ok;
+
+    if (!ok)
+        printf("capture: failed to write %s\n", slot->path);
+}
+
+static void *encode_loop(void *arg) {
+    pthread_mutex_lock(&capture_lock);
+
+    while (true) {
+        while (encode_count == 0 && !quit)
+            pthread_cond_wait(&encoder_wake, &capture_lock);
+
+        if (encode_count == 0)
+            break;
+
+        capture_slot_t *slot = &slots[encode_queue[encode_head]];
+        encode_head          = (encode_head + 1) % CAPTURE_SLOTS;
+        encode_count--;
+
+        pthread_mutex_unlock(&capture_lock);
+        encode(slot);
+        pthread_mutex_lock(&capture_lock);
+
+        slot->state = SLOT_FREE;
+        n_written++;
+        pthread_cond_broadcast(&slot_freed);
+    }
+
+    pthread_mutex_unlock(&capture_lock);
+
+    return NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Render thread
+
+// Sized for the float image, the 8 bit one only uses a quarter of it
+static gpu_buffer_t *make_capture_buffer() {
+    return make_gpu_buffer("capture", GL_PIXEL_PACK_BUFFER, GPU_BUFFER_NO_BINDING, image_size(),
+                           GPU_BUFFER_PERSISTENT_READBACK);
+}
+
+void init_capture() {
+    init_crc_table();
+
+    for (int i = 0; i < CAPTURE_SLOTS; i++) {
+        slots[i].buffer = make_capture_buffer();
+        slots[i].state  = SLOT_FREE;
+    }
+
+    if (pthread_create(&encoder, NULL, encode_loop, NULL) != 0) {
+        printf("Failed to start the capture encoder thread\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Render thread, with the lock held, once per frame. Sequences capture every
+// traced frame, screenshots whatever is on screen.
+void capture_update(bool traced) {
+    pthread_mutex_lock(&capture_lock);
+    manager->n_captures = n_written;
+    pthread_mutex_unlock(&capture_lock);
+
+    if (pending)
+        return;
+
+    if (options.sequence_pattern && traced) {
+        capture_format_from_path(options.sequence_pattern, &pending_format);
+        snprintf(pending_path, sizeof(pending_path), options.sequence_pattern, sequence_frame++);
+        pending = true;
+    } else if (manager->capture_requested) {
+        char      timestamp[32];
+        time_t    now   = time(NULL);
+        struct tm local = *localtime(&now);
+
+        strftime(timestamp, sizeof(timestamp), "%Y%m%d_%H%M%S", &local);
+
+        pending_format = manager->capture_format;
+        snprintf(pending_path, sizeof(pending_path), "capture_%s_%u.%s", timestamp, screenshot_count++,
+                 capture_format_extension(pending_format));
+        pending = true;
+
+        manager->capture_requested = false;
+    }
+}
+
+// Render thread, without the lock. Hands the readbacks the GPU is done with
+// to the encoder, or all of them when waiting.
+static void collect_readbacks(bool wait) {
+    for (int i = 0; i < CAPTURE_SLOTS; i++) {
+        capture_slot_t *slot = &slots[i];
+
+        if (slot->state != SLOT_READBACK)
+            continue;
+
+        GLenum status = glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? GL_TIMEOUT_IGNORED : 0);
+
+        if (status == GL_TIMEOUT_EXPIRED)
+            continue;
+
+        glDeleteSync(slot->fence);
+        slot->fence = NULL;
+
+        pthread_mutex_lock(&capture_lock);
+
+        if (status == GL_WAIT_FAILED) {
+            printf("capture: glClientWaitSync failed, dropping %s\n", slot->path);
+            slot->state = SLOT_FREE;
+        } else {
+            slot->state = SLOT_ENCODING;
+            encode_queue[(encode_head + encode_count++) % CAPTURE_SLOTS] = i;
+            pthread_cond_signal(&encoder_wake);
+        }
+
+        pthread_mutex_unlock(&capture_lock);
+    }
+}
+
+void capture_poll() { collect_readbacks(false); }
+
+// Screenshots wait for a slot to free up on their own, sequences can't drop
+// frames so they wait for the GPU and the encoder instead
+static int acquire_slot(bool wait) {
+    while (true) {
+        bool encoding = false;
+
+        pthread_mutex_lock(&capture_lock);
+
+        for (int i = 0; i < CAPTURE_SLOTS; i++) {
+            if (slots[i].state == SLOT_FREE) {
+                pthread_mutex_unlock(&capture_lock);
+                return i;
+            }
+
+            encoding |= slots[i].state == SLOT_ENCODING;
+        }
+
+        if (wait && encoding)
+            pthread_cond_wait(&slot_freed, &capture_lock);
+
+        pthread_mutex_unlock(&capture_lock);
+
+        if (!wait)
+            return -1;
+
+        // Everything is still on the GPU
+        if (!encoding)
+            collect_readbacks(true);
+    }
+}
+
+// The display image has to be up to date for PNG
+bool capture_wants_display() { return pending && pending_format == CAPTURE_PNG; }
+
+// Render thread, after the frame was traced and displayed
+void capture_readback() {
+    if (!pending)
+        return;
+
+    int slot_id = acquire_slot(options.sequence_pattern != NULL);
+
+    if (slot_id < 0)
+        return;
+
+    capture_slot_t *slot = &slots[slot_id];
+
+    // Grows with the render resolution. The slot is free, so nothing reads the
+    // mapping, and the GUI lists the buffers under the lock.
+    if (slot->buffer->element_size < image_size()) {
+        lock_render_state();
+        destroy_gpu_buffer(slot->buffer);
+        slot->buffer = make_capture_buffer();
+        unlock_render_state();
+    }
+
+    slot->width  = manager->render_width;
+    slot->height = manager->render_height;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer->id);
+
+    if (pending_format == CAPTURE_PNG) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, display_framebuffer());
+        glReadPixels(0, 0, slot->width, slot->height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    } else {
+        // The accumulation texture is written with image stores
+        glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+        glGetTextureImage(accumulation_export(), 0, GL_RGBA, GL_FLOAT, image_size(), 0);
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    slot->fence  = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot->format = pending_format;
+    snprintf(slot->path, sizeof(slot->path), "%s", pending_path);
+
+    pthread_mutex_lock(&capture_lock);
+    slot->state = SLOT_READBACK;
+    pthread_mutex_unlock(&capture_lock);
+
+    pending = false;
+}
+
+// At exit, with the render thread stopped. Writes everything in flight.
+void capture_finish() {
+    collect_readbacks(true);
+
+    pthread_mutex_lock(&capture_lock);
+    quit = true;
+    pthread_cond_signal(&encoder_wake);
+    pthread_mutex_unlock(&capture_lock);
+
+    pthread_join(encoder, NULL);
+
+    if (n_written > 0)
+        printf("capture: %u images written\n", n_written);
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef SRC_CAPTURE_H_
+#define SRC_CAPTURE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Readbacks in flight or waiting to be encoded. A sequence waits for a free
+// slot rather than dropping frames, so this is how far it can run ahead of
+// the encoder before it does.
+#define CAPTURE_SLOTS 4
+
+typedef enum {
+    CAPTURE_PNG, // Tone mapped, as on screen
+    CAPTURE_EXR, // Raw HDR, 32 bit float
+    CAPTURE_PFM, // Raw HDR, 32 bit float
+} capture_format_t;
+
+void init_capture();
+void capture_update(bool traced);
+void capture_poll();
+bool capture_wants_display();
+void capture_readback();
+void capture_finish();
+
+const char *capture_format_extension(capture_format_t format);
+bool        capture_format_from_path(const char *path, capture_format_t *format);
+
+#endif // SRC_CAPTURE_H_
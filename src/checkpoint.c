@@ -0,0 +1,354 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// The accumulation texture is copied into a pixel pack buffer by the GPU, and
+// only mapped once its fence has signalled, a few frames later. Writing the
+// file happens on a separate thread, so neither the readback nor the disk
+// ever stall the render loop.
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glad/glad.h>
+
+#include <GLFW/glfw3.h>
+
+#include "checkpoint.h"
+#include "gpu_buffer.h"
+#include "manager.h"
+#include "options.h"
+#include "render_targets.h"
+#include "rendering.h"
+#include "scene.h"
+
+static GLsync              readback_fence;
+static checkpoint_header_t readback_header; // Describes the readback in flight
+static double              last_checkpoint_time;
+static uint32_t            last_checkpoint_spp;
+
+// Owned by the writer thread while it runs
+static pthread_t           writer;
+static bool                writer_started;
+static checkpoint_header_t writer_header;
+static float              *writer_pixels;
+
+static size_t image_size(const checkpoint_header_t *header) {
+    return (size_t)header->width * header->height * 4 * sizeof(float);
+}
+
+void init_checkpoint() {
+    if (options.checkpoint_path == NULL)
+        return;
+
+    last_checkpoint_time = glfwGetTime();
+    last_checkpoint_spp  = manager->accumulated_spp;
+}
+
+// Written next to the old file and renamed over it, so a crash mid-write never loses the last one
+bool save_checkpoint(const char *path, const checkpoint_header_t *header, const float *pixels) {
+    char tmp_path[1024];
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *file = fopen(tmp_path, "wb");
+
+    if (file == NULL) {
+        printf("checkpoint: failed to open %s for writing\n", tmp_path);
+        return false;
+    }
+
+    size_t pixels_size = (size_t)header->width * header->height * 4 * sizeof(float);
+
+    bool ok = fwrite(header, sizeof(checkpoint_header_t), 1, file) == 1 && fwrite(pixels, pixels_size, 1, file) == 1;
+
+    ok = fclose(file) == 0 && ok;
+
+    if (!ok || rename(tmp_path, path) != 0) {
+        printf("checkpoint: failed to write %s\n", path);
+        remove(tmp_path);
+        return false;
+    }
+
+    return true;
+}
+
+static void *write_checkpoint(void *arg) {
+    if (save_checkpoint(options.checkpoint_path, &writer_header, writer_pixels))
+        printf("checkpoint: %u spp written to %s\n", writer_header.accumulated_spp, options.checkpoint_path);
+
+    return NULL;
+}
+
+static void wait_for_writer() {
+    if (!writer_started)
+        return;
+
+    pthread_join(writer, NULL);
+    writer_started = false;
+}
+
+// Copies the finished readback out of the pixel pack buffer and hands it to the writer thread
+static void finish_readback(bool wait) {
+    GLenum status = glClientWaitSync(readback_fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? GL_TIMEOUT_IGNORED : 0);
+
+    if (status == GL_TIMEOUT_EXPIRED)
+        return;
+
+    glDeleteSync(readback_fence);
+    readback_fence = NULL;
+
+    if (status == GL_WAIT_FAILED) {
+        printf("checkpoint: glClientWaitSync failed, skipping\n");
+        return;
+    }
+
+    wait_for_writer();
+
+    gpu_buffer_t *buffer = manager->checkpoint_buffer;
+    size_t        size   = image_size(&readback_header);
+
+    writer_pixels = realloc(writer_pixels, size);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer->id);
+    void *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+    memcpy(writer_pixels, pixels, size);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    writer_header = readback_header;
+
+    if (pthread_create(&writer, NULL, write_checkpoint, NULL) != 0) {
+        printf("checkpoint: failed to start the writer thread\n");
+        return;
+    }
+
+    writer_started = true;
+}
+
+// Render thread, every frame, without the lock
+void checkpoint_poll() {
+    if (readback_fence)
+        finish_readback(false);
+}
+
+// Describes the current accumulation. Must hold the render state lock.
+void checkpoint_fill_header(checkpoint_header_t *header) {
+    Camera *camera = manager->camera;
+
+    memset(header, 0, sizeof(checkpoint_header_t));
+    memcpy(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic));
+    header->version         = CHECKPOINT_VERSION;
+    header->width           = manager->render_width;
+    header->height          = manager->render_height;
+    header->accumulated_spp = manager->accumulated_spp;
+    header->rng_seeds[0]    = manager->rng_seeds[0];
+    header->rng_seeds[1]    = manager->rng_seeds[1];
+    header->rng_frame_index = manager->rng_frame_index;
+    header->scene_hash      = scene_hash();
+
+    glm_vec3_copy(camera->camera_pos, header->camera_position);
+    header->yaw            = camera->yaw;
+    header->pitch          = camera->pitch;
+    header->zoom           = camera->zoom;
+    header->aperture       = camera->aperture;
+    header->focus_distance = camera->focus_distance;
+    header->orthographic   = camera->orthographic;
+    header->n_bounces      = manager->n_bounces;
+    header->ambient_light  = manager->ambient_light;
+}
+
+// Must hold the render state lock
+static void start_readback() {
+    checkpoint_fill_header(&readback_header);
+
+    // A single element holding the whole image, which changes size with the render resolution
+    gpu_buffer_t *buffer = manager->checkpoint_buffer;
+    size_t        size   = image_size(&readback_header);
+
+    if (buffer == NULL || buffer->element_size != size) {
+        if (buffer)
+            destroy_gpu_buffer(buffer);
+
+        manager->checkpoint_buffer = make_gpu_buffer("checkpoint", GL_PIXEL_PACK_BUFFER, GPU_BUFFER_NO_BINDING, size,
+                                                     GPU_BUFFER_READBACK);
+    }
+
+    // The accumulation texture is written with image stores
+    glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, manager->checkpoint_buffer->id);
+    glGetTextureImage(accumulation_export(), 0, GL_RGBA, GL_FLOAT, size, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    readback_fence       = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    last_checkpoint_time = glfwGetTime();
+    last_checkpoint_spp  = manager->accumulated_spp;
+}
+
+static bool worth_saving() {
+    // An animated scene starts over every frame, there is nothing to keep
+    if (manager->animate_scene || manager->reset_accumulation || !manager->incremental_rendering)
+        return false;
+
+    return manager->accumulated_spp > 0 && manager->accumulated_spp != last_checkpoint_spp;
+}
+
+// Render thread, with the lock held, before the frame is traced. Starts a
+// readback once the interval has passed and there is anything new.
+void checkpoint_update() {
+    if (options.checkpoint_path == NULL || readback_fence)
+        return;
+
+    if (glfwGetTime() - last_checkpoint_time < options.checkpoint_interval || !worth_saving())
+        return;
+
+    start_readback();
+}
+
+// At exit, with the render thread stopped. Saves whatever was accumulated
+// since the last checkpoint and waits for the file to be written.
+void checkpoint_finish() {
+    if (options.checkpoint_path == NULL)
+        return;
+
+    if (readback_fence)
+        finish_readback(true);
+
+    if (worth_saving()) {
+        start_readback();
+        finish_readback(true);
+    }
+
+    wait_for_writer();
+    free(writer_pixels);
+}
+
+void read_checkpoint_header(const char *path, checkpoint_header_t *header) {
+    FILE *file = fopen(path, "rb");
+
+    if (file == NULL) {
+        printf("failed to open checkpoint %s\n", path);
+        exit(1);
+    }
+
+    if (fread(header, sizeof(checkpoint_header_t), 1, file) != 1 ||
+        memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) != 0) {
+        printf("%s is not a checkpoint\n", path);
+        exit(1);
+    }
+
+    fclose(file);
+
+    if (header->version != CHECKPOINT_VERSION) {
+        printf("checkpoint %s has version %u, expected %u\n", path, header->version, CHECKPOINT_VERSION);
+        exit(1);
+    }
+}
+
+// The pixels are malloc'ed, and owned by the caller
+float *load_checkpoint(const char *path, checkpoint_header_t *header) {
+    read_checkpoint_header(path, header);
+
+    size_t pixels_size = (size_t)header->width * header->height * 4 * sizeof(float);
+    FILE  *file        = fopen(path, "rb");
+
+    if (file == NULL) {
+        printf("failed to open checkpoint %s\n", path);
+        exit(1);
+    }
+
+    // The size in the header can't be trusted before it matches the file, a
+    // corrupt one would otherwise ask for an arbitrarily large allocation
+    long file_size = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+
+    if (pixels_size == 0 || file_size < 0 || (size_t)file_size != sizeof(checkpoint_header_t) + pixels_size) {
+        printf("checkpoint %s does not hold a %ux%u image\n", path, header->width, header->height);
+        exit(1);
+    }
+
+    float *pixels = malloc(pixels_size);
+
+    if (pixels == NULL) {
+        printf("failed to allocate %zu bytes for checkpoint %s\n", pixels_size, path);
+        exit(1);
+    }
+
+    if (fseek(file, sizeof(checkpoint_header_t), SEEK_SET) != 0 || fread(pixels, pixels_size, 1, file) != 1) {
+        printf("checkpoint %s is truncated\n", path);
+        exit(1);
+    }
+
+    fclose(file);
+
+    return pixels;
+}
+
+// Restores the view and the settings the header was rendered with, but not
+// the accumulation. The render targets switch to its resolution with the next
+// render_targets_update, and stick to it even if the window changes.
+void checkpoint_apply_header(const checkpoint_header_t *header) {
+    Camera *camera = manager->camera;
+
+    manager->requested_width  = header->width;
+    manager->requested_height = header->height;
+
+    glm_vec3_copy((float *)header->camera_position, camera->camera_pos);
+    camera->yaw            = header->yaw;
+    camera->pitch          = header->pitch;
+    camera->zoom           = header->zoom;
+    camera->aperture       = header->aperture;
+    camera->focus_distance = header->focus_distance;
+    camera->orthographic   = header->orthographic;
+
+    update_camera_target(camera, 0, 0);
+    update_camera_projection_matrix(camera);
+
+    manager->n_bounces     = header->n_bounces;
+    manager->ambient_light = header->ambient_light;
+}
+
+// Needs the scene, the camera and the accumulation texture to exist, and the
+// scene to have been generated from the seeds in the header
+void resume_from_checkpoint(const char *path) {
+    checkpoint_header_t header;
+    float              *pixels = load_checkpoint(path, &header);
+
+    if (header.scene_hash != scene_hash()) {
+        printf("checkpoint %s was rendered from a different scene\n", path);
+        exit(1);
+    }
+
+    checkpoint_apply_header(&header);
+
+    // The pixels go in right away
+    if (!render_targets_resize(header.width, header.height))
+        exit(1);
+
+    accumulation_import(pixels);
+    free(pixels);
+
+    // Updating the camera asked for the texture to be cleared, which would throw away what was just loaded
+    manager->reset_accumulation = false;
+    manager->accumulated_spp    = header.accumulated_spp;
+    manager->rng_frame_index    = header.rng_frame_index;
+
+    printf("resumed %u spp from %s\n", header.accumulated_spp, path);
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef SRC_CHECKPOINT_H_
+#define SRC_CHECKPOINT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CHECKPOINT_MAGIC   "RTCKPT\r\n"
+#define CHECKPOINT_VERSION 1
+
+// Followed by width * height RGBA32F texels of the accumulation texture,
+// everything in host byte order
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t accumulated_spp;
+    uint64_t rng_seeds[2];
+    uint64_t rng_frame_index;
+    uint64_t scene_hash;
+
+    float    camera_position[3];
+    float    yaw;
+    float    pitch;
+    float    zoom;
+    float    aperture;
+    float    focus_distance;
+    uint32_t orthographic;
+
+    uint32_t n_bounces;
+    uint32_t ambient_light;
+} checkpoint_header_t;
+
+void init_checkpoint();
+void checkpoint_poll();
+void checkpoint_update();
+void checkpoint_finish();
+
+void checkpoint_fill_header(checkpoint_header_t *header);
+void checkpoint_apply_header(const checkpoint_header_t *header);
+
+bool   save_checkpoint(const char *path, const checkpoint_header_t *header, const float *pixels);
+float *load_checkpoint(const char *path, checkpoint_header_t *header);
+void   read_checkpoint_header(const char *path, checkpoint_header_t *header);
+void   resume_from_checkpoint(const char *path);
+
+#endif // SRC_CHECKPOINT_H_
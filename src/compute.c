@@ -24,23 +24,34 @@
 #include <cglm/call.h>
 #include <cglm/cglm.h>
 #include <glad/glad.h>
-#include <stb.h>
 
 #include "compute.h"
+#include "glsl_shader_includes_c.h"
 
-compute_t *build_compute_shader(char *shader_path) {
+compute_t *build_compute_shader(char *shader_path) { return build_compute_shader_with_header(shader_path, ""); }
+
+// The header goes right after the #version line, for defines that are only
+// known at runtime
+compute_t *build_compute_shader_with_header(char *shader_path, const char *header) {
     printf("loading compute shader: %s\n", shader_path);
     compute_t *shader = malloc(sizeof(compute_t));
 
     memcpy(shader->shader_path, shader_path, strlen(shader_path));
 
-    const char *shader_code = stb_file(shader_path, NULL);
+    char *shader_code = Shadinclude_load(shader_path);
+    char *body        = strchr(shader_code, '\n');
+
+    body = body ? body + 1 : shader_code + strlen(shader_code);
+
+    const char *sources[3] = {shader_code, header, body};
+    GLint       lengths[3] = {body - shader_code, -1, -1};
 
     // compute shader
     uint64_t compute = glCreateShader(GL_COMPUTE_SHADER);
-    glShaderSource(compute, 1, (char const *const *)&shader_code, NULL);
+    glShaderSource(compute, 3, sources, lengths);
     glCompileShader(compute);
     check_compile_errors(compute, "COMPUTE");
+    free(shader_code);
 
     // shader Program
     shader->id = glCreateProgram();
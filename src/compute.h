@@ -31,6 +31,7 @@ typedef struct {
 } compute_t;
 
 compute_t *build_compute_shader(char *shader_path);
+compute_t *build_compute_shader_with_header(char *shader_path, const char *header);
 void       compute_use(compute_t *compute);
 void       compute_set_int(compute_t *compute, char *name, int value);
 void       compute_set_float(compute_t *compute, char *name, float value);
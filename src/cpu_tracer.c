@@ -0,0 +1,724 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// A straight port of raytracer.comp, for the tiles the hybrid scheduler gives
+// to the CPU. It follows the shader line by line, down to the random number
+// generator, so both halves of the image converge to the same result. Only
+// the binary BVH is traversed, the 4-wide one gives the same hits.
+//
+// The tracer reads from a snapshot of the scene taken under the render state
+// lock, so the main thread can keep editing the scene while the CPU traces.
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <cglm/cglm.h>
+
+#include "cpu_tracer.h"
+#include "scene.h"
+#include "settings.h"
+
+#define HIT_NOTHING  0
+#define HIT_PLANE    1
+#define HIT_SPHERE   2
+#define HIT_TRIANGLE 3
+#define HIT_QUAD     4
+#define HIT_BOX      5
+
+#define NO_HIT         1e30f
+#define BVH_STACK_SIZE BVH_MAX_DEPTH // Near first traversal leaves at most one node per level on it
+
+#define TWO_PI 6.28318530f
+
+typedef struct {
+    bool  hit;
+    vec3  normal;
+    vec3  position;
+    float distance;
+    int   id;
+    int   hit_type;
+    int   material_id;
+} hit_t;
+
+static gpu_material_t materials[max_materials];
+static gpu_sphere_t   spheres[n_spheres];
+static gpu_triangle_t triangles[n_triangles];
+static gpu_quad_t     quads[n_quads];
+static gpu_box_t      boxes[n_boxes];
+static gpu_plane_t    planes[n_planes];
+static gpu_bvh_node_t blas_nodes[max_blas_nodes];
+static gpu_bvh_node_t tlas_nodes[max_tlas_nodes];
+static gpu_instance_t instances[max_instances];
+
+// Must hold the render state lock, and the scene must already be flushed to the GPU
+void cpu_tracer_snapshot() {
+    memcpy(materials, scene_materials, sizeof(materials));
+    memcpy(spheres, scene_spheres, sizeof(spheres));
+    memcpy(triangles, scene_triangles, sizeof(triangles));
+    memcpy(quads, scene_quads, sizeof(quads));
+    memcpy(boxes, scene_boxes, sizeof(boxes));
+    memcpy(planes, scene_planes, sizeof(planes));
+    memcpy(blas_nodes, scene_blas_nodes, n_blas_nodes * sizeof(gpu_bvh_node_t));
+    memcpy(tlas_nodes, scene_tlas_nodes, n_tlas_nodes * sizeof(gpu_bvh_node_t));
+    memcpy(instances, scene_gpu_instances, n_instances * sizeof(gpu_instance_t));
+}
+
+static uint32_t rand_xorshift(uint32_t *rng_state) {
+    *rng_state ^= (*rng_state << 13);
+    *rng_state ^= (*rng_state >> 17);
+    *rng_state ^= (*rng_state << 5);
+    return *rng_state;
+}
+
+static float rand_float(uint32_t *rng_state) { return (float)rand_xorshift(rng_state) / 4294967296.0f; }
+
+static uint32_t hash_lowbias32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+static void random_vec3_sphere(uint32_t *rng_state, vec3 dest) {
+    float theta = TWO_PI * rand_float(rng_state);
+    float phi   = acosf(2.0f * rand_float(rng_state) - 1.0f);
+
+    dest[0] = sinf(theta) * cosf(phi);
+    dest[1] = sinf(theta) * sinf(phi);
+    dest[2] = cosf(theta);
+}
+
+static void sample_lambert(uint32_t *rng_state, vec3 normal, vec3 dest) {
+    vec3 offset;
+    random_vec3_sphere(rng_state, offset);
+    glm_vec3_add(normal, offset, dest);
+
+    // Handle degenerate rays
+    if (glm_vec3_dot(dest, dest) < 0.001f)
+        glm_vec3_copy(normal, dest);
+
+    glm_vec3_normalize(dest);
+}
+
+static void reflect(vec3 direction, vec3 normal, vec3 dest) {
+    vec3 scaled;
+    glm_vec3_scale(normal, 2.0f * glm_vec3_dot(normal, direction), scaled);
+    glm_vec3_sub(direction, scaled, dest);
+}
+
+static void refract(vec3 direction, vec3 normal, float refraction_ratio, vec3 dest) {
+    float cos_theta = fminf(-glm_vec3_dot(direction, normal), 1.0f);
+    vec3  r_out_perp;
+    vec3  r_out_parallel;
+
+    glm_vec3_scale(normal, cos_theta, r_out_perp);
+    glm_vec3_add(direction, r_out_perp, r_out_perp);
+    glm_vec3_scale(r_out_perp, refraction_ratio, r_out_perp);
+    glm_vec3_scale(normal, -sqrtf(fabsf(1.0f - glm_vec3_norm2(r_out_perp))), r_out_parallel);
+    glm_vec3_add(r_out_perp, r_out_parallel, dest);
+}
+
+static float schlick(float cosine, float refraction_ratio) {
+    float r0 = (1.0f - refraction_ratio) / (1.0f + refraction_ratio);
+    r0       = r0 * r0;
+    return r0 + (1.0f - r0) * powf(1.0f - cosine, 5.0f);
+}
+
+static void set_hit(hit_t *hit_info, vec3 origin, vec3 direction, float t, int id, int hit_type, int material_id) {
+    hit_info->hit         = true;
+    hit_info->distance    = t;
+    hit_info->id          = id;
+    hit_info->hit_type    = hit_type;
+    hit_info->material_id = material_id;
+    glm_vec3_copy(origin, hit_info->position);
+    glm_vec3_muladds(direction, t, hit_info->position);
+}
+
+// The *_distance functions return how far along the ray the primitive is hit,
+// or NO_HIT, see the raytracer
+
+// Moller-Trumbore, using the edges precomputed at upload time
+static float triangle_distance(int triangle_id, vec3 origin, vec3 direction) {
+    gpu_triangle_t *triangle = &triangles[triangle_id];
+    vec3            p, s, q;
+
+    glm_vec3_cross(direction, triangle->edge2, p);
+    float det = glm_vec3_dot(triangle->edge1, p);
+
+    // Parallel to the triangle plane
+    if (fabsf(det) < 1e-8f)
+        return NO_HIT;
+
+    float inv_det = 1.0f / det;
+    glm_vec3_sub(origin, triangle->v0, s);
+    float u = glm_vec3_dot(s, p) * inv_det;
+
+    if (u < 0.0f || u > 1.0f)
+        return NO_HIT;
+
+    glm_vec3_cross(s, triangle->edge1, q);
+    float v = glm_vec3_dot(direction, q) * inv_det;
+
+    if (v < 0.0f || u + v > 1.0f)
+        return NO_HIT;
+
+    float t = glm_vec3_dot(triangle->edge2, q) * inv_det;
+
+    return t >= near_plane ? t : NO_HIT;
+}
+
+// Same as triangle_distance, with v bound by 1 instead of 1 - u
+static float quad_distance(int quad_id, vec3 origin, vec3 direction) {
+    gpu_quad_t *quad = &quads[quad_id];
+    vec3        p, s, q;
+
+    glm_vec3_cross(direction, quad->edge_v, p);
+    float det = glm_vec3_dot(quad->edge_u, p);
+
+    // Parallel to the quad plane
+    if (fabsf(det) < 1e-8f)
+        return NO_HIT;
+
+    float inv_det = 1.0f / det;
+    glm_vec3_sub(origin, quad->corner, s);
+    float u = glm_vec3_dot(s, p) * inv_det;
+
+    if (u < 0.0f || u > 1.0f)
+        return NO_HIT;
+
+    glm_vec3_cross(s, quad->edge_u, q);
+    float v = glm_vec3_dot(direction, q) * inv_det;
+
+    if (v < 0.0f || v > 1.0f)
+        return NO_HIT;
+
+    float t = glm_vec3_dot(quad->edge_v, q) * inv_det;
+
+    return t >= near_plane ? t : NO_HIT;
+}
+
+// The far root is only used when the near one is behind the origin
+static float sphere_distance(int sphere_id, vec3 origin, vec3 direction) {
+    gpu_sphere_t *sphere = &spheres[sphere_id];
+    vec3          omc;
+
+    glm_vec3_sub(origin, sphere->center, omc);
+
+    float a            = glm_vec3_dot(direction, direction);
+    float b            = glm_vec3_dot(omc, direction);
+    float c            = glm_vec3_dot(omc, omc) - sphere->radius * sphere->radius;
+    float discriminant = b * b - a * c;
+
+    if (discriminant < 0.0f)
+        return NO_HIT;
+
+    float t_a = (-b - sqrtf(discriminant)) / a;
+    float t_b = (-b + sqrtf(discriminant)) / a;
+
+    if (t_a >= near_plane)
+        return t_a;
+
+    if (t_b >= near_plane)
+        return t_b;
+
+    return NO_HIT;
+}
+
+// Slab test, like intersect_aabb. Rays starting inside the box hit it on the
+// way out. `normal` is the outward normal of the face that is hit, see the raytracer.
+static float box_distance(int box_id, vec3 origin, vec3 direction, vec3 normal) {
+    gpu_box_t *box        = &boxes[box_id];
+    float      t_enter    = -INFINITY;
+    float      t_exit     = INFINITY;
+    int        enter_axis = 0;
+    int        exit_axis  = 0;
+
+    for (int axis = 0; axis < 3; axis++) {
+        float t0 = (box->box_min[axis] - origin[axis]) / direction[axis];
+        float t1 = (box->box_max[axis] - origin[axis]) / direction[axis];
+
+        if (fminf(t0, t1) > t_enter) {
+            t_enter    = fminf(t0, t1);
+            enter_axis = axis;
+        }
+
+        if (fmaxf(t0, t1) < t_exit) {
+            t_exit    = fmaxf(t0, t1);
+            exit_axis = axis;
+        }
+    }
+
+    glm_vec3_zero(normal);
+
+    if (t_enter > t_exit)
+        return NO_HIT;
+
+    if (t_enter >= near_plane) {
+        normal[enter_axis] = direction[enter_axis] > 0.0f ? -1.0f : 1.0f;
+        return t_enter;
+    }
+
+    if (t_exit >= near_plane) {
+        normal[exit_axis] = direction[exit_axis] > 0.0f ? 1.0f : -1.0f;
+        return t_exit;
+    }
+
+    return NO_HIT;
+}
+
+static float plane_distance(int plane_id, vec3 origin, vec3 direction) {
+    gpu_plane_t *plane = &planes[plane_id];
+    float        t     = (plane->offset - glm_vec3_dot(plane->normal, origin)) / glm_vec3_dot(plane->normal, direction);
+
+    // Also false for the NaN of rays that lie on the plane
+    return t >= near_plane ? t : NO_HIT;
+}
+
+static bool test_triangle_hit(vec3 origin, vec3 direction, int triangle_id, hit_t *hit_info) {
+    float t = triangle_distance(triangle_id, origin, direction);
+
+    if (t > hit_info->distance)
+        return false;
+
+    set_hit(hit_info, origin, direction, t, triangle_id, HIT_TRIANGLE, triangles[triangle_id].material_id);
+    glm_vec3_copy(triangles[triangle_id].normal, hit_info->normal);
+
+    return true;
+}
+
+static bool test_quad_hit(vec3 origin, vec3 direction, int quad_id, hit_t *hit_info) {
+    float t = quad_distance(quad_id, origin, direction);
+
+    if (t > hit_info->distance)
+        return false;
+
+    set_hit(hit_info, origin, direction, t, quad_id, HIT_QUAD, quads[quad_id].material_id);
+    glm_vec3_copy(quads[quad_id].normal, hit_info->normal);
+
+    return true;
+}
+
+static bool test_sphere_hit(vec3 origin, vec3 direction, int sphere_id, hit_t *hit_info) {
+    float t = sphere_distance(sphere_id, origin, direction);
+
+    if (t > hit_info->distance)
+        return false;
+
+    set_hit(hit_info, origin, direction, t, sphere_id, HIT_SPHERE, spheres[sphere_id].material_id);
+    glm_vec3_sub(hit_info->position, spheres[sphere_id].center, hit_info->normal);
+    glm_vec3_normalize(hit_info->normal);
+
+    return true;
+}
+
+static bool test_box_hit(vec3 origin, vec3 direction, int box_id, hit_t *hit_info) {
+    vec3  normal;
+    float t = box_distance(box_id, origin, direction, normal);
+
+    if (t > hit_info->distance)
+        return false;
+
+    set_hit(hit_info, origin, direction, t, box_id, HIT_BOX, boxes[box_id].material_id);
+    glm_vec3_copy(normal, hit_info->normal);
+
+    return true;
+}
+
+static void test_plane_hit(vec3 origin, vec3 direction, int plane_id, hit_t *hit_info) {
+    gpu_plane_t *plane = &planes[plane_id];
+    float        t     = plane_distance(plane_id, origin, direction);
+
+    if (t > hit_info->distance)
+        return;
+
+    set_hit(hit_info, origin, direction, t, plane_id, HIT_PLANE, plane->material_id);
+    glm_vec3_copy(plane->normal, hit_info->normal);
+
+    // Checkerboard pattern, same parity test as the shader
+    if (plane->checker_material_id >= 0) {
+        int ix = (int)floorf(glm_vec3_dot(hit_info->position, plane->checker_u));
+        int iy = (int)floorf(glm_vec3_dot(hit_info->position, plane->checker_v));
+
+        if (((ix + iy) & 1) != 0)
+            hit_info->material_id = plane->checker_material_id;
+    }
+}
+
+// Slab test. Returns the distance where the ray enters the box, or NO_HIT
+static float intersect_aabb(vec3 origin, vec3 inv_direction, float max_distance, const gpu_bvh_node_t *node) {
+    float t_enter = -INFINITY;
+    float t_exit  = INFINITY;
+
+    for (int axis = 0; axis < 3; axis++) {
+        float t0 = (node->aabb_min[axis] - origin[axis]) * inv_direction[axis];
+        float t1 = (node->aabb_max[axis] - origin[axis]) * inv_direction[axis];
+
+        t_enter = fmaxf(t_enter, fminf(t0, t1));
+        t_exit  = fminf(t_exit, fmaxf(t0, t1));
+    }
+
+    if (t_exit >= fmaxf(t_enter, 0.0f) && t_enter <= max_distance)
+        return t_enter;
+
+    return NO_HIT;
+}
+
+typedef bool (*visit_leaf_t)(const gpu_bvh_node_t *node, int primitive_type, vec3 origin, vec3 direction,
+                             hit_t *hit_info);
+
+// Nearest child first, like traverse_blas and cast_ray in the shader
+static bool traverse(const gpu_bvh_node_t *nodes, int root_node, int primitive_type, visit_leaf_t visit_leaf,
+                     vec3 origin, vec3 direction, hit_t *hit_info) {
+    vec3 inv_direction = {1.0f / direction[0], 1.0f / direction[1], 1.0f / direction[2]};
+    int  stack[BVH_STACK_SIZE];
+    int  stack_size    = 0;
+    int  node_id       = root_node;
+    bool hit_something = false;
+
+    while (true) {
+        const gpu_bvh_node_t *node = &nodes[node_id];
+
+        if (node->count > 0) {
+            hit_something = visit_leaf(node, primitive_type, origin, direction, hit_info) || hit_something;
+        } else {
+            int   near_child    = node->left_first;
+            int   far_child     = node->left_first + 1;
+            float near_distance = intersect_aabb(origin, inv_direction, hit_info->distance, &nodes[near_child]);
+            float far_distance  = intersect_aabb(origin, inv_direction, hit_info->distance, &nodes[far_child]);
+
+            if (far_distance < near_distance) {
+                int   child   = near_child;
+                float t       = near_distance;
+                near_child    = far_child;
+                near_distance = far_distance;
+                far_child     = child;
+                far_distance  = t;
+            }
+
+            if (near_distance != NO_HIT) {
+                if (far_distance != NO_HIT && stack_size < BVH_STACK_SIZE)
+                    stack[stack_size++] = far_child;
+
+                node_id = near_child;
+                continue;
+            }
+        }
+
+        if (stack_size == 0)
+            break;
+
+        node_id = stack[--stack_size];
+    }
+
+    return hit_something;
+}
+
+static bool intersect_primitives(const gpu_bvh_node_t *node, int primitive_type, vec3 origin, vec3 direction,
+                                 hit_t *hit_info) {
+    bool hit_something = false;
+
+    for (int i = node->left_first; i < node->left_first + node->count; i++) {
+        if (primitive_type == PRIMITIVE_SPHERE)
+            hit_something = test_sphere_hit(origin, direction, i, hit_info) || hit_something;
+        else if (primitive_type == PRIMITIVE_TRIANGLE)
+            hit_something = test_triangle_hit(origin, direction, i, hit_info) || hit_something;
+        else if (primitive_type == PRIMITIVE_QUAD)
+            hit_something = test_quad_hit(origin, direction, i, hit_info) || hit_something;
+        else
+            hit_something = test_box_hit(origin, direction, i, hit_info) || hit_something;
+    }
+
+    return hit_something;
+}
+
+// Top level leaves hold a single instance id
+static bool intersect_instance(const gpu_bvh_node_t *node, int primitive_type, vec3 origin, vec3 direction,
+                               hit_t *hit_info) {
+    gpu_instance_t *instance = &instances[node->left_first];
+    vec3            local_origin;
+    vec3            local_direction;
+
+    glm_mat4_mulv3(instance->world_to_object, origin, 1.0f, local_origin);
+    glm_mat4_mulv3(instance->world_to_object, direction, 0.0f, local_direction);
+
+    if (!traverse(blas_nodes, instance->root_node, instance->primitive_type, intersect_primitives, local_origin,
+                  local_direction, hit_info))
+        return false;
+
+    // Bring the hit back to world space. Normals go through the inverse transpose.
+    vec3 normal;
+    glm_vec3_copy(hit_info->normal, normal);
+
+    for (int i = 0; i < 3; i++)
+        hit_info->normal[i] = glm_vec3_dot(instance->world_to_object[i], normal);
+
+    glm_vec3_normalize(hit_info->normal);
+    glm_vec3_copy(origin, hit_info->position);
+    glm_vec3_muladds(direction, hit_info->distance, hit_info->position);
+
+    if (instance->material_override >= 0)
+        hit_info->material_id = instance->material_override;
+
+    return true;
+}
+
+static bool cast_ray(vec3 origin, vec3 direction, hit_t *hit_info) {
+    hit_info->distance = far_plane;
+
+    // Planes have no bounds to put in a BVH
+    for (int i = 0; i < n_planes; i++)
+        test_plane_hit(origin, direction, i, hit_info);
+
+    vec3 inv_direction = {1.0f / direction[0], 1.0f / direction[1], 1.0f / direction[2]};
+
+    if (intersect_aabb(origin, inv_direction, hit_info->distance, &tlas_nodes[0]) == NO_HIT)
+        return hit_info->hit;
+
+    traverse(tlas_nodes, 0, 0, intersect_instance, origin, direction, hit_info);
+
+    return hit_info->hit;
+}
+
+typedef bool (*leaf_occludes_t)(const gpu_bvh_node_t *node, int primitive_type, vec3 origin, vec3 direction,
+                                float max_distance);
+
+// Any hit will do, so unlike traverse the children are not visited nearest
+// first, and the first leaf that occludes ends the search
+static bool traverse_any(const gpu_bvh_node_t *nodes, int root_node, int primitive_type, leaf_occludes_t leaf_occludes,
+                         vec3 origin, vec3 direction, float max_distance) {
+    vec3 inv_direction = {1.0f / direction[0], 1.0f / direction[1], 1.0f / direction[2]};
+    int  stack[BVH_STACK_SIZE];
+    int  stack_size = 0;
+    int  node_id    = root_node;
+
+    while (true) {
+        const gpu_bvh_node_t *node = &nodes[node_id];
+
+        if (node->count > 0) {
+            if (leaf_occludes(node, primitive_type, origin, direction, max_distance))
+                return true;
+        } else {
+            for (int child = node->left_first; child < node->left_first + 2; child++) {
+                if (intersect_aabb(origin, inv_direction, max_distance, &nodes[child]) != NO_HIT &&
+                    stack_size < BVH_STACK_SIZE)
+                    stack[stack_size++] = child;
+            }
+        }
+
+        if (stack_size == 0)
+            break;
+
+        node_id = stack[--stack_size];
+    }
+
+    return false;
+}
+
+static bool primitives_occlude(const gpu_bvh_node_t *node, int primitive_type, vec3 origin, vec3 direction,
+                               float max_distance) {
+    for (int i = node->left_first; i < node->left_first + node->count; i++) {
+        vec3  normal;
+        float t;
+
+        if (primitive_type == PRIMITIVE_SPHERE)
+            t = sphere_distance(i, origin, direction);
+        else if (primitive_type == PRIMITIVE_TRIANGLE)
+            t = triangle_distance(i, origin, direction);
+        else if (primitive_type == PRIMITIVE_QUAD)
+            t = quad_distance(i, origin, direction);
+        else
+            t = box_distance(i, origin, direction, normal);
+
+        if (t <= max_distance)
+            return true;
+    }
+
+    return false;
+}
+
+static bool instance_occludes(const gpu_bvh_node_t *node, int primitive_type, vec3 origin, vec3 direction,
+                              float max_distance) {
+    gpu_instance_t *instance = &instances[node->left_first];
+    vec3            local_origin;
+    vec3            local_direction;
+
+    glm_mat4_mulv3(instance->world_to_object, origin, 1.0f, local_origin);
+    glm_mat4_mulv3(instance->world_to_object, direction, 0.0f, local_direction);
+
+    return traverse_any(blas_nodes, instance->root_node, instance->primitive_type, primitives_occlude, local_origin,
+                        local_direction, max_distance);
+}
+
+// Whether anything along the ray is closer than `max_distance`, same as
+// occluded in the raytracer. Reads the snapshot, like the tracing.
+bool cpu_tracer_occluded(vec3 origin, vec3 direction, float max_distance) {
+    for (int i = 0; i < n_planes; i++) {
+        if (plane_distance(i, origin, direction) <= max_distance)
+            return true;
+    }
+
+    vec3 inv_direction = {1.0f / direction[0], 1.0f / direction[1], 1.0f / direction[2]};
+
+    if (intersect_aabb(origin, inv_direction, max_distance, &tlas_nodes[0]) == NO_HIT)
+        return false;
+
+    return traverse_any(tlas_nodes, 0, 0, instance_occludes, origin, direction, max_distance);
+}
+
+// `uv` is the position on the image, in [0, 1]
+static void generate_ray(uint32_t *rng_state, const gpu_frame_params_t *frame, float u, float v, vec3 origin,
+                         vec3 direction) {
+    vec3 focus_point;
+
+    glm_vec3_copy((float *)frame->camera_lower_left, focus_point);
+    glm_vec3_muladds((float *)frame->camera_horizontal, u, focus_point);
+    glm_vec3_muladds((float *)frame->camera_vertical, v, focus_point);
+
+    if (frame->orthographic) {
+        glm_vec3_sub(focus_point, (float *)frame->camera_forward, origin);
+        glm_vec3_normalize_to((float *)frame->camera_forward, direction);
+        return;
+    }
+
+    glm_vec3_copy((float *)frame->camera_origin, origin);
+
+    if (frame->thin_lens) {
+        float r     = sqrtf(rand_float(rng_state));
+        float theta = TWO_PI * rand_float(rng_state);
+
+        glm_vec3_muladds((float *)frame->camera_lens_u, r * cosf(theta), origin);
+        glm_vec3_muladds((float *)frame->camera_lens_v, r * sinf(theta), origin);
+    }
+
+    glm_vec3_sub(focus_point, origin, direction);
+    glm_vec3_normalize(direction);
+}
+
+static void trace_sample(uint32_t *rng_state, const gpu_frame_params_t *frame, float u, float v, vec3 result) {
+    vec3 origin;
+    vec3 direction;
+
+    glm_vec3_copy((float *)frame->ambient_light, result);
+    generate_ray(rng_state, frame, u, v, origin, direction);
+
+    for (int i = 0; i < frame->n_bounces; i++) {
+        hit_t hit_info;
+        memset(&hit_info, 0, sizeof(hit_t));
+
+        // Russian roulette, same as begin_bounce in the raytracer
+        if (i >= frame->roulette_depth) {
+            float survival = glm_vec3_max(result) / fmaxf(glm_vec3_max((float *)frame->ambient_light), 1e-6f);
+            survival       = fminf(survival, 1.0f);
+
+            if (rand_float(rng_state) >= survival) {
+                glm_vec3_zero(result);
+                break;
+            }
+
+            glm_vec3_divs(result, survival, result);
+        }
+
+        if (!cast_ray(origin, direction, &hit_info)) {
+            float t         = 0.5f * (direction[1] + 1.0f);
+            vec3  sky_color = {(1.0f - t) + t * 0.5f, (1.0f - t) + t * 0.7f, 1.0f};
+            glm_vec3_mul(result, sky_color, result);
+            break;
+        }
+
+        float           cosine_loss = -glm_vec3_dot(hit_info.normal, direction);
+        gpu_material_t *material    = &materials[hit_info.material_id];
+        vec3            attenuation;
+
+        if (material->type == MATERIAL_DIFFUSE) {
+            glm_vec3_scale(material->albedo, cosine_loss, attenuation);
+            glm_vec3_add(material->emission, attenuation, attenuation);
+            glm_vec3_mul(result, attenuation, result);
+            sample_lambert(rng_state, hit_info.normal, direction);
+        } else if (material->type == MATERIAL_METAL) {
+            vec3 fuzz;
+
+            glm_vec3_scale(material->albedo, cosine_loss, attenuation);
+            glm_vec3_add(material->emission, attenuation, attenuation);
+            glm_vec3_mul(result, attenuation, result);
+            reflect(direction, hit_info.normal, direction);
+            random_vec3_sphere(rng_state, fuzz);
+            glm_vec3_scale(fuzz, material->roughness, fuzz);
+
+            // Make sure that the fuzz doesn't push the ray inside the object at glancing angles
+            if (glm_vec3_dot(fuzz, hit_info.normal) < 0.0f)
+                glm_vec3_negate(fuzz);
+
+            glm_vec3_add(direction, fuzz, direction);
+            glm_vec3_normalize(direction);
+        } else if (material->type == MATERIAL_DIELECTRIC) {
+            vec3 normal;
+
+            glm_vec3_add(material->emission, material->albedo, attenuation);
+            glm_vec3_mul(result, attenuation, result);
+            glm_vec3_copy(hit_info.normal, normal);
+
+            // The roughness holds the refraction index
+            float refraction_ratio = material->roughness;
+
+            if (glm_vec3_dot(direction, normal) > 0.0f)
+                glm_vec3_negate(normal);
+            else
+                refraction_ratio = 1.0f / refraction_ratio;
+
+            float cos_theta      = fminf(-glm_vec3_dot(direction, normal), 1.0f);
+            float sin_theta      = sqrtf(1.0f - cos_theta * cos_theta);
+            bool  cannot_refract = refraction_ratio * sin_theta > 1.0f;
+
+            if (cannot_refract || schlick(cos_theta, refraction_ratio) > rand_float(rng_state))
+                reflect(direction, normal, direction);
+            else
+                refract(direction, normal, refraction_ratio, direction);
+        }
+
+        glm_vec3_copy(hit_info.position, origin);
+        glm_vec3_muladds(hit_info.normal, 0.001f, origin);
+    }
+}
+
+// Traces the pixels [x0, x1) of row y, and writes the average of the frame's
+// samples to the rgb of `pixels`, which holds the whole image
+void cpu_tracer_trace_span(const gpu_frame_params_t *frame, int width, int height, int x0, int x1, int y,
+                           float *pixels) {
+    uint32_t rng_state;
+
+    for (int x = x0; x < x1; x++) {
+        vec3 pixel_color = {0.0f, 0.0f, 0.0f};
+
+        rng_state = hash_lowbias32((uint32_t)x * (uint32_t)y + (uint32_t)x) + (uint32_t)frame->rng_seed;
+
+        for (int i_sample = 0; i_sample < frame->n_samples; i_sample++) {
+            vec3  result;
+            float u = (x + rand_float(&rng_state)) / width;
+            float v = (y + rand_float(&rng_state)) / height;
+
+            trace_sample(&rng_state, frame, u, v, result);
+            glm_vec3_muladds(result, 1.0f / frame->n_samples, pixel_color);
+        }
+
+        glm_vec3_copy(pixel_color, &pixels[((size_t)y * width + x) * 4]);
+    }
+}
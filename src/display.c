@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// Turns the accumulation into the 8 bit image that is shown, captured and
+// streamed. The tone mapping settings are baked into a LUT whenever they
+// change, and the image is only resolved again when the accumulation or the
+// LUT changed, so converged or idle frames just blit the last one. The image
+// has the render resolution, and is scaled to fit the window when shown.
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <glad/glad.h>
+
+#include "auto_exposure.h"
+#include "compute.h"
+#include "display.h"
+#include "gpu_layout.h"
+#include "manager.h"
+#include "render_targets.h"
+
+#define DISPLAY_WORKGROUP_SIZE 16
+#define LUT_WORKGROUP_SIZE     64
+#define LUT_IMAGE_UNIT         5
+#define LUT_TEXTURE_UNIT       5
+#define DISPLAY_IMAGE_UNIT     4
+
+static compute_t *lut_shader;
+static compute_t *display_shader;
+
+static uint32_t lut_texture;
+static uint32_t display_texture;
+static uint32_t display_fbo;
+
+static display_state_t baked; // Settings the LUT was baked with
+static bool            lut_valid;
+static bool            image_valid;
+
+void init_display() {
+    lut_shader     = build_compute_shader("shaders/tonemap_lut.comp");
+    display_shader = build_compute_shader_with_header("shaders/display.comp", render_targets_shader_header());
+
+    glCreateTextures(GL_TEXTURE_1D, 1, &lut_texture);
+    glTextureStorage1D(lut_texture, 1, GL_R32F, DISPLAY_LUT_SIZE);
+    glTextureParameteri(lut_texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(lut_texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(lut_texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+    glCreateFramebuffers(1, &display_fbo);
+    display_resize();
+
+    lut_valid = false;
+}
+
+// The render resolution changed
+void display_resize() {
+    if (display_texture != 0)
+        glDeleteTextures(1, &display_texture);
+
+    glCreateTextures(GL_TEXTURE_2D, 1, &display_texture);
+    glTextureStorage2D(display_texture, 1, GL_RGBA8, manager->render_width, manager->render_height);
+    glNamedFramebufferTexture(display_fbo, GL_COLOR_ATTACHMENT0, display_texture, 0);
+
+    if (glCheckNamedFramebufferStatus(display_fbo, GL_READ_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        printf("display: framebuffer is incomplete\n");
+        exit(EXIT_FAILURE);
+    }
+
+    image_valid = false;
+}
+
+// The accumulation changed
+void display_invalidate() { image_valid = false; }
+
+static void bake_lut(const display_state_t *display) {
+    compute_use(lut_shader);
+    compute_set_int(lut_shader, "tone_mapping_mode", display->tone_mapping_mode);
+    compute_set_float(lut_shader, "exposure", display->exposure);
+    compute_set_int(lut_shader, "auto_exposure", display->auto_exposure);
+
+    glBindImageTexture(LUT_IMAGE_UNIT, lut_texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+    glDispatchCompute((DISPLAY_LUT_SIZE + LUT_WORKGROUP_SIZE - 1) / LUT_WORKGROUP_SIZE, 1, 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+    baked     = *display;
+    lut_valid = true;
+}
+
+// Render thread, after the frame was traced. Does nothing when neither the
+// accumulation nor the settings changed since the last call.
+void display_update(const display_state_t *display) {
+    bool changed = !lut_valid || display->tone_mapping_mode != baked.tone_mapping_mode ||
+                   display->exposure != baked.exposure || display->auto_exposure != baked.auto_exposure;
+
+    // Turning auto exposure on snaps to the current image, afterwards it
+    // follows the image as it changes
+    if (display->auto_exposure && changed && !baked.auto_exposure)
+        auto_exposure_reset();
+
+    if (display->auto_exposure && (changed || !image_valid)) {
+        auto_exposure_update(display->delta_time);
+        changed = true;
+    }
+
+    if (changed) {
+        bake_lut(display);
+        image_valid = false;
+    }
+
+    if (image_valid)
+        return;
+
+    compute_use(display_shader);
+
+    glBindTextureUnit(LUT_TEXTURE_UNIT, lut_texture);
+    glBindImageTexture(DISPLAY_IMAGE_UNIT, display_texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+    glDispatchCompute((manager->render_width + DISPLAY_WORKGROUP_SIZE - 1) / DISPLAY_WORKGROUP_SIZE,
+                      (manager->render_height + DISPLAY_WORKGROUP_SIZE - 1) / DISPLAY_WORKGROUP_SIZE, 1);
+
+    // Blits and readbacks go through the framebuffer
+    glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+
+    image_valid = true;
+}
+
+// Into the default framebuffer, the GUI is drawn over it. Scaled to fit the
+// window, keeping the aspect ratio, with black bars around it.
+void display_present(const display_state_t *display) {
+    const float black[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+
+    int32_t width  = manager->render_width;
+    int32_t height = manager->render_height;
+    int32_t x      = 0;
+    int32_t y      = 0;
+    GLenum  filter = GL_NEAREST;
+
+    if (width != (int32_t)display->window_width || height != (int32_t)display->window_height) {
+        double scale = fmin((double)display->window_width / width, (double)display->window_height / height);
+
+        width  = lround(width * scale);
+        height = lround(height * scale);
+        x      = ((int32_t)display->window_width - width) / 2;
+        y      = ((int32_t)display->window_height - height) / 2;
+        filter = GL_LINEAR;
+
+        glClearNamedFramebufferfv(0, GL_COLOR, 0, black);
+    }
+
+    // Downscaling huge offscreen resolutions skips most of the pixels, but
+    // this is only a preview
+    glBlitNamedFramebuffer(display_fbo, 0, 0, 0, manager->render_width, manager->render_height, x, y, x + width,
+                           y + height, GL_COLOR_BUFFER_BIT, filter);
+}
+
+uint32_t display_framebuffer() { return display_fbo; }
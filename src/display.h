@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef SRC_DISPLAY_H_
+#define SRC_DISPLAY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// What the display pass needs, copied while holding the lock
+typedef struct {
+    uint32_t tone_mapping_mode;
+    float    exposure;
+    bool     auto_exposure;
+    float    delta_time; // How long the auto exposure adapts for
+    uint32_t window_width;
+    uint32_t window_height;
+} display_state_t;
+
+void     init_display();
+void     display_resize();
+void     display_invalidate();
+void     display_update(const display_state_t *display);
+void     display_present(const display_state_t *display);
+uint32_t display_framebuffer();
+
+#endif // SRC_DISPLAY_H_
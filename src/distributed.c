@@ -0,0 +1,565 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// A coordinator hands out sample ranges of the same image to any number of
+// workers over plain TCP, and merges what comes back. Every job is seeded from
+// its own range of frame indices, so the partial images are statistically
+// independent and can simply be averaged, weighted by their sample counts.
+// Messages are sent in host byte order, like checkpoint files, so the pool is
+// expected to share the same architecture.
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <glad/glad.h>
+
+#include "distributed.h"
+#include "manager.h"
+#include "options.h"
+#include "render_targets.h"
+#include "rendering.h"
+
+typedef enum {
+    JOB_PENDING,
+    JOB_RUNNING,
+    JOB_DONE,
+} job_state_t;
+
+// Coordinator
+static pthread_mutex_t     jobs_lock    = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t      jobs_changed = PTHREAD_COND_INITIALIZER;
+static job_state_t        *job_states;
+static uint32_t            n_jobs;
+static uint32_t            n_jobs_done;
+static checkpoint_header_t job_template;
+
+// Sums of the partial images, in double so thousands of them add up exactly enough
+static double  *merged_sum;    // Per pixel rgb mean, times the samples it was averaged over
+static double  *merged_frames; // Per pixel frame count, which is what the alpha channel holds
+static uint32_t merged_spp;
+
+// Worker
+static int                 worker_socket = -1;
+static uint32_t            worker_job_id;
+static checkpoint_header_t worker_job;
+
+static size_t pixel_count(const checkpoint_header_t *header) { return (size_t)header->width * header->height; }
+
+static size_t pixels_size(const checkpoint_header_t *header) { return pixel_count(header) * 4 * sizeof(float); }
+
+static bool send_all(int fd, const void *data, size_t size) {
+    const char *bytes = data;
+
+    while (size > 0) {
+        ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+
+        if (sent < 0 && errno == EINTR)
+            continue;
+
+        if (sent <= 0)
+            return false;
+
+        bytes += sent;
+        size -= sent;
+    }
+
+    return true;
+}
+
+static bool recv_all(int fd, void *data, size_t size) {
+    char *bytes = data;
+
+    while (size > 0) {
+        ssize_t received = recv(fd, bytes, size, 0);
+
+        if (received < 0 && errno == EINTR)
+            continue;
+
+        if (received <= 0)
+            return false;
+
+        bytes += received;
+        size -= received;
+    }
+
+    return true;
+}
+
+static void make_message(distributed_message_t *message, distributed_message_type_t type, uint32_t job_id) {
+    memset(message, 0, sizeof(distributed_message_t));
+    message->magic  = DISTRIBUTED_MAGIC;
+    message->type   = type;
+    message->job_id = job_id;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Merging
+
+static void init_merge(const checkpoint_header_t *header) {
+    merged_sum    = calloc(pixel_count(header) * 3, sizeof(double));
+    merged_frames = calloc(pixel_count(header), sizeof(double));
+    merged_spp    = 0;
+}
+
+// The texture holds a sum of per frame averages in rgb and the frame count in
+// alpha, so each partial contributes its mean, weighted by its sample count
+static void merge_partial(const checkpoint_header_t *header, const float *pixels) {
+    size_t count = pixel_count(header);
+
+    for (size_t i = 0; i < count; i++) {
+        const float *texel  = &pixels[i * 4];
+        float        frames = texel[3];
+
+        if (frames <= 0)
+            continue;
+
+        for (int c = 0; c < 3; c++)
+            merged_sum[i * 3 + c] += (double)texel[c] / frames * header->accumulated_spp;
+
+        merged_frames[i] += frames;
+    }
+
+    merged_spp += header->accumulated_spp;
+}
+
+// Back into the same layout, so the result can be resumed from like any other checkpoint
+static float *finish_merge(checkpoint_header_t *header) {
+    size_t count  = pixel_count(header);
+    float *pixels = malloc(pixels_size(header));
+
+    for (size_t i = 0; i < count; i++) {
+        double frames = merged_frames[i];
+
+        for (int c = 0; c < 3; c++)
+            pixels[i * 4 + c] = merged_spp > 0 ? merged_sum[i * 3 + c] / merged_spp * frames : 0;
+
+        pixels[i * 4 + 3] = frames;
+    }
+
+    header->accumulated_spp = merged_spp;
+
+    free(merged_sum);
+    free(merged_frames);
+
+    return pixels;
+}
+
+static bool compatible(const checkpoint_header_t *a, const checkpoint_header_t *b) {
+    return a->width == b->width && a->height == b->height && a->scene_hash == b->scene_hash;
+}
+
+int run_merge() {
+    checkpoint_header_t header;
+    float              *pixels           = load_checkpoint(options.merge_inputs[0], &header);
+    uint64_t            last_frame_index = header.rng_frame_index;
+
+    init_merge(&header);
+    merge_partial(&header, pixels);
+    free(pixels);
+
+    for (int i = 1; i < options.n_merge_inputs; i++) {
+        checkpoint_header_t partial;
+
+        pixels = load_checkpoint(options.merge_inputs[i], &partial);
+
+        if (!compatible(&header, &partial)) {
+            printf("%s is not a render of the same scene at the same resolution as %s\n", options.merge_inputs[i],
+                   options.merge_inputs[0]);
+            return 1;
+        }
+
+        merge_partial(&partial, pixels);
+        free(pixels);
+
+        if (partial.rng_frame_index > last_frame_index)
+            last_frame_index = partial.rng_frame_index;
+    }
+
+    // Resuming from the merged image must not reuse the frames of any of the inputs
+    header.rng_frame_index = last_frame_index;
+
+    pixels = finish_merge(&header);
+
+    if (!save_checkpoint(options.merge_output, &header, pixels))
+        return 1;
+
+    printf("merged %d checkpoints into %s, %u spp\n", options.n_merge_inputs, options.merge_output,
+           header.accumulated_spp);
+
+    free(pixels);
+
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Coordinator
+
+static uint32_t job_spp(uint32_t job_id) {
+    uint32_t first = job_id * options.job_spp;
+
+    return options.spp - first < options.job_spp ? options.spp - first : options.job_spp;
+}
+
+// Blocks while every remaining job is running somewhere else, since any of
+// them might still come back. Returns -1 once all of them are done.
+static int64_t take_job() {
+    pthread_mutex_lock(&jobs_lock);
+
+    while (n_jobs_done < n_jobs) {
+        for (uint32_t i = 0; i < n_jobs; i++) {
+            if (job_states[i] == JOB_PENDING) {
+                job_states[i] = JOB_RUNNING;
+                pthread_mutex_unlock(&jobs_lock);
+                return i;
+            }
+        }
+
+        pthread_cond_wait(&jobs_changed, &jobs_lock);
+    }
+
+    pthread_mutex_unlock(&jobs_lock);
+
+    return -1;
+}
+
+static void return_job(uint32_t job_id) {
+    pthread_mutex_lock(&jobs_lock);
+    job_states[job_id] = JOB_PENDING;
+    pthread_cond_broadcast(&jobs_changed);
+    pthread_mutex_unlock(&jobs_lock);
+}
+
+static void finish_job(uint32_t job_id, const checkpoint_header_t *header, const float *pixels) {
+    pthread_mutex_lock(&jobs_lock);
+
+    merge_partial(header, pixels);
+    job_states[job_id] = JOB_DONE;
+    n_jobs_done++;
+
+    printf("coordinator: job %u done with %u spp, %u/%u jobs, %u spp merged\n", job_id, header->accumulated_spp,
+           n_jobs_done, n_jobs, merged_spp);
+
+    pthread_cond_broadcast(&jobs_changed);
+    pthread_mutex_unlock(&jobs_lock);
+}
+
+static bool valid_result(const distributed_message_t *message, uint32_t job_id) {
+    return message->magic == DISTRIBUTED_MAGIC && message->type == DISTRIBUTED_RESULT && message->job_id == job_id &&
+           compatible(&message->header, &job_template) && message->header.accumulated_spp > 0;
+}
+
+// One per connected worker, which gets jobs until there are none left
+static void *serve_worker(void *arg) {
+    int    fd     = (int)(intptr_t)arg;
+    float *pixels = malloc(pixels_size(&job_template));
+
+    while (true) {
+        distributed_message_t message;
+        int64_t               job_id = take_job();
+
+        if (job_id < 0) {
+            make_message(&message, DISTRIBUTED_DONE, 0);
+            send_all(fd, &message, sizeof(message));
+            break;
+        }
+
+        make_message(&message, DISTRIBUTED_JOB, job_id);
+        message.header                 = job_template;
+        message.header.accumulated_spp = job_spp(job_id);
+        // The frames before the first job belong to the image the coordinator was resumed from, if any
+        message.header.rng_frame_index = (uint64_t)(job_id + 1) << DISTRIBUTED_FRAME_SHIFT;
+
+        if (!send_all(fd, &message, sizeof(message)) || !recv_all(fd, &message, sizeof(message)) ||
+            !valid_result(&message, job_id) || !recv_all(fd, pixels, pixels_size(&job_template))) {
+            printf("coordinator: lost job %u, it goes back to the queue\n", (uint32_t)job_id);
+            return_job(job_id);
+            break;
+        }
+
+        finish_job(job_id, &message.header, pixels);
+    }
+
+    close(fd);
+    free(pixels);
+
+    return NULL;
+}
+
+static int listen_on(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (fd < 0) {
+        printf("coordinator: failed to create a socket: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family      = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port        = htons(port);
+
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, 16) != 0) {
+        printf("coordinator: failed to listen on port %d: %s\n", port, strerror(errno));
+        exit(1);
+    }
+
+    return fd;
+}
+
+// Needs the manager, the camera and the scene, but no GL context. The image
+// is rendered with the current view, or the one from --resume, whose samples
+// are merged into the output too.
+int run_coordinator() {
+    checkpoint_header_t resumed;
+    float              *resumed_pixels = NULL;
+
+    if (options.resume_path) {
+        resumed_pixels = load_checkpoint(options.resume_path, &resumed);
+
+        if (resumed.rng_frame_index >= (1ull << DISTRIBUTED_FRAME_SHIFT)) {
+            printf("checkpoint %s already has distributed samples, merge into it with --merge instead\n",
+                   options.resume_path);
+            return 1;
+        }
+
+        checkpoint_apply_header(&resumed);
+    }
+
+    // Nothing is rendered here, but the jobs are rendered at this resolution
+    if (manager->requested_width) {
+        manager->render_width  = manager->requested_width;
+        manager->render_height = manager->requested_height;
+    }
+
+    checkpoint_fill_header(&job_template);
+    job_template.accumulated_spp = 0;
+
+    init_merge(&job_template);
+
+    if (resumed_pixels) {
+        if (!compatible(&resumed, &job_template)) {
+            printf("checkpoint %s does not match the scene being rendered\n", options.resume_path);
+            return 1;
+        }
+
+        merge_partial(&resumed, resumed_pixels);
+        free(resumed_pixels);
+    }
+
+    n_jobs     = (options.spp + options.job_spp - 1) / options.job_spp;
+    job_states = calloc(n_jobs, sizeof(job_state_t));
+
+    int listen_fd = listen_on(options.coordinate_port);
+
+    printf("coordinator: %u spp in %u jobs, listening on port %d\n", options.spp, n_jobs, options.coordinate_port);
+
+    while (true) {
+        pthread_mutex_lock(&jobs_lock);
+        bool done = n_jobs_done == n_jobs;
+        pthread_mutex_unlock(&jobs_lock);
+
+        if (done)
+            break;
+
+        // Wakes up now and then to notice that the last job came in
+        struct pollfd poll_fd = {.fd = listen_fd, .events = POLLIN};
+
+        if (poll(&poll_fd, 1, 1000) <= 0)
+            continue;
+
+        int fd = accept(listen_fd, NULL, NULL);
+
+        if (fd < 0)
+            continue;
+
+        pthread_t thread;
+
+        if (pthread_create(&thread, NULL, serve_worker, (void *)(intptr_t)fd) != 0) {
+            printf("coordinator: failed to start a thread for a worker\n");
+            close(fd);
+            continue;
+        }
+
+        pthread_detach(thread);
+    }
+
+    close(listen_fd);
+
+    pthread_mutex_lock(&jobs_lock);
+
+    checkpoint_header_t header = job_template;
+    float              *pixels = finish_merge(&header);
+
+    // Anything rendered from the output later starts after the last job
+    header.rng_frame_index = (uint64_t)(n_jobs + 1) << DISTRIBUTED_FRAME_SHIFT;
+
+    pthread_mutex_unlock(&jobs_lock);
+
+    if (!save_checkpoint(options.output_path, &header, pixels))
+        return 1;
+
+    printf("coordinator: %u spp written to %s\n", header.accumulated_spp, options.output_path);
+
+    free(pixels);
+    free(job_states);
+
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Worker
+
+static bool receive_job() {
+    distributed_message_t message;
+
+    if (!recv_all(worker_socket, &message, sizeof(message)))
+        return false;
+
+    if (message.magic != DISTRIBUTED_MAGIC || message.type != DISTRIBUTED_JOB)
+        return false;
+
+    worker_job_id = message.job_id;
+    worker_job    = message.header;
+
+    return true;
+}
+
+// The address is host:port. Returns false if the coordinator had nothing to do.
+bool worker_connect(const char *address, checkpoint_header_t *first_job) {
+    char        host[256];
+    const char *port = strrchr(address, ':');
+
+    if (port == NULL || port == address || (size_t)(port - address) >= sizeof(host)) {
+        printf("worker: expected host:port, got %s\n", address);
+        exit(1);
+    }
+
+    memcpy(host, address, port - address);
+    host[port - address] = '\0';
+    port++;
+
+    struct addrinfo  hints;
+    struct addrinfo *addresses;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int error = getaddrinfo(host, port, &hints, &addresses);
+
+    if (error != 0) {
+        printf("worker: failed to resolve %s: %s\n", host, gai_strerror(error));
+        exit(1);
+    }
+
+    for (struct addrinfo *it = addresses; it != NULL && worker_socket < 0; it = it->ai_next) {
+        worker_socket = socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+
+        if (worker_socket >= 0 && connect(worker_socket, it->ai_addr, it->ai_addrlen) != 0) {
+            close(worker_socket);
+            worker_socket = -1;
+        }
+    }
+
+    freeaddrinfo(addresses);
+
+    if (worker_socket < 0) {
+        printf("worker: failed to connect to %s\n", address);
+        exit(1);
+    }
+
+    printf("worker: connected to %s\n", address);
+
+    if (!receive_job())
+        return false;
+
+    *first_job = worker_job;
+
+    return true;
+}
+
+// Needs the camera and the accumulation texture, and the render thread stopped
+void worker_start_job() {
+    checkpoint_apply_header(&worker_job);
+
+    manager->rng_frame_index       = worker_job.rng_frame_index;
+    manager->incremental_rendering = true;
+    manager->animate_scene         = false;
+    manager->freeze_movement       = true;
+    manager->target_spp            = 0;
+
+    reset_accumulation();
+
+    printf("worker: job %u, %u spp\n", worker_job_id, worker_job.accumulated_spp);
+}
+
+// Must hold the render state lock
+bool worker_job_done() {
+    return !manager->reset_accumulation && manager->accumulated_spp >= worker_job.accumulated_spp;
+}
+
+// With the render thread stopped. Sends the accumulation back and starts on
+// the next job, if there is one.
+bool worker_finish_job() {
+    distributed_message_t message;
+
+    make_message(&message, DISTRIBUTED_RESULT, worker_job_id);
+    checkpoint_fill_header(&message.header);
+
+    float *pixels = malloc(pixels_size(&message.header));
+
+    // A single readback per job, stalling here is fine
+    glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+    glGetTextureImage(accumulation_export(), 0, GL_RGBA, GL_FLOAT, pixels_size(&message.header), pixels);
+
+    bool sent = send_all(worker_socket, &message, sizeof(message)) &&
+                send_all(worker_socket, pixels, pixels_size(&message.header));
+
+    free(pixels);
+
+    if (!sent) {
+        printf("worker: lost the connection to the coordinator\n");
+        return false;
+    }
+
+    if (!receive_job()) {
+        printf("worker: no jobs left\n");
+        close(worker_socket);
+        return false;
+    }
+
+    worker_start_job();
+
+    return true;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef SRC_DISTRIBUTED_H_
+#define SRC_DISTRIBUTED_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "checkpoint.h"
+
+#define DISTRIBUTED_MAGIC       0x4a425452 // "RTBJ"
+#define DISTRIBUTED_JOB_SPP     256
+#define DISTRIBUTED_FRAME_SHIFT 32 // Each job starts 2^32 frames after the previous one
+
+typedef enum {
+    DISTRIBUTED_JOB    = 1,
+    DISTRIBUTED_RESULT = 2,
+    DISTRIBUTED_DONE   = 3,
+} distributed_message_type_t;
+
+// Jobs carry the view, the seeds and the settings to render with. The
+// accumulated_spp of a job is how many samples to take, and rng_frame_index
+// the first frame to seed them with. Results echo the job back with what was
+// actually rendered, followed by the pixels, exactly like a checkpoint file.
+typedef struct {
+    uint32_t            magic;
+    uint32_t            type;
+    uint32_t            job_id;
+    uint32_t            _pad0;
+    checkpoint_header_t header;
+} distributed_message_t;
+
+int run_coordinator();
+int run_merge();
+
+bool worker_connect(const char *address, checkpoint_header_t *first_job);
+void worker_start_job();
+bool worker_job_done();
+bool worker_finish_job();
+
+#endif // SRC_DISTRIBUTED_H_
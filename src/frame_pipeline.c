@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glad/glad.h>
+
+#include <GLFW/glfw3.h>
+
+#include "frame_pipeline.h"
+#include "gpu_buffer.h"
+#include "manager.h"
+
+// One second, only reached if the GPU hung
+#define FENCE_TIMEOUT 1000000000ull
+
+static GLsync   fences[FRAMES_IN_FLIGHT];
+static size_t   slot_stride;
+static uint64_t frame_index;
+static bool     frame_open;
+static float    wait_time;
+
+void init_frame_pipeline() {
+    GLint alignment;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+
+    // Every slot has to start at an offset glBindBufferRange accepts
+    slot_stride = (sizeof(gpu_frame_params_t) + alignment - 1) / alignment * alignment;
+
+    manager->frame_params_buffer = make_gpu_buffer("frame params", GL_UNIFORM_BUFFER, GPU_BUFFER_NO_BINDING,
+                                                   slot_stride, GPU_BUFFER_PERSISTENT);
+    gpu_buffer_reserve(manager->frame_params_buffer, FRAMES_IN_FLIGHT);
+
+    memset(fences, 0, sizeof(fences));
+    frame_index = 0;
+    frame_open  = false;
+}
+
+static void wait_for_slot(int slot) {
+    if (fences[slot] == NULL)
+        return;
+
+    double start = glfwGetTime();
+
+    GLenum status = glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT);
+    while (status == GL_TIMEOUT_EXPIRED) {
+        printf("frame pipeline: still waiting on frame %lu\n", (unsigned long)(frame_index - FRAMES_IN_FLIGHT));
+        status = glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT);
+    }
+
+    if (status == GL_WAIT_FAILED) {
+        printf("frame pipeline: glClientWaitSync failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    glDeleteSync(fences[slot]);
+    fences[slot] = NULL;
+
+    wait_time = glfwGetTime() - start;
+}
+
+// Waits until the GPU is done with the frame that last used the next slot,
+// binds the slot and returns it to be filled. Only blocks when the CPU is
+// FRAMES_IN_FLIGHT frames ahead.
+gpu_frame_params_t *frame_pipeline_begin() {
+    assert(!frame_open);
+
+    int slot = frame_index % FRAMES_IN_FLIGHT;
+
+    wait_time = 0;
+    wait_for_slot(slot);
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, UBO_BINDING_FRAME_PARAMS, manager->frame_params_buffer->id,
+                      slot * slot_stride, sizeof(gpu_frame_params_t));
+
+    frame_open = true;
+
+    return (gpu_frame_params_t *)((char *)manager->frame_params_buffer->mapped + slot * slot_stride);
+}
+
+// Must come after the last command that reads the slot
+void frame_pipeline_end() {
+    assert(frame_open);
+
+    int slot = frame_index % FRAMES_IN_FLIGHT;
+
+    fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    frame_open   = false;
+    frame_index++;
+}
+
+// Slot of the frame between frame_pipeline_begin and frame_pipeline_end
+int frame_pipeline_slot() { return frame_index % FRAMES_IN_FLIGHT; }
+
+// How long the last frame_pipeline_begin blocked, in seconds
+float frame_pipeline_wait_time() { return wait_time; }
@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef SRC_FRAME_PIPELINE_H_
+#define SRC_FRAME_PIPELINE_H_
+
+#include "gpu_layout.h"
+
+// How many frames the CPU can queue before waiting on the GPU. Each one has
+// its own slot of per frame parameters, guarded by a fence.
+#define FRAMES_IN_FLIGHT 3
+
+void                init_frame_pipeline();
+gpu_frame_params_t *frame_pipeline_begin();
+void                frame_pipeline_end();
+int                 frame_pipeline_slot();
+float               frame_pipeline_wait_time();
+
+#endif // SRC_FRAME_PIPELINE_H_
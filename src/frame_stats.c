@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <GLFW/glfw3.h>
+
+#include <cJSON.h>
+
+#include "frame_stats.h"
+
+frame_stats_t frame_stats;
+
+static uint64_t last_tick;
+static bool     has_last_tick;
+
+void init_frame_stats() {
+    frame_stats_reset();
+
+    has_last_tick = false;
+}
+
+void frame_stats_reset() {
+    memset(&frame_stats, 0, sizeof(frame_stats_t));
+
+    frame_stats.min = UINT64_MAX;
+}
+
+static uint32_t bucket_index(uint64_t value) {
+    if (value < FRAME_STATS_SUB_BUCKET_COUNT)
+        return value;
+
+    uint32_t shift = 1;
+    while ((value >> shift) >= FRAME_STATS_SUB_BUCKET_COUNT)
+        shift++;
+
+    if (shift > FRAME_STATS_MAX_SHIFT)
+        return FRAME_STATS_BUCKET_COUNT - 1;
+
+    uint32_t sub_bucket = (value >> shift) - FRAME_STATS_SUB_BUCKET_HALF;
+
+    return FRAME_STATS_SUB_BUCKET_COUNT + (shift - 1) * FRAME_STATS_SUB_BUCKET_HALF + sub_bucket;
+}
+
+// Middle of the range of values that land in `index`
+static uint64_t bucket_value(uint32_t index) {
+    if (index < FRAME_STATS_SUB_BUCKET_COUNT)
+        return index;
+
+    uint32_t shift      = (index - FRAME_STATS_SUB_BUCKET_COUNT) / FRAME_STATS_SUB_BUCKET_HALF + 1;
+    uint64_t sub_bucket = (index - FRAME_STATS_SUB_BUCKET_COUNT) % FRAME_STATS_SUB_BUCKET_HALF +
+                          FRAME_STATS_SUB_BUCKET_HALF;
+
+    return (sub_bucket << shift) + ((uint64_t)1 << (shift - 1));
+}
+
+static uint64_t ticks_to_nanoseconds(uint64_t ticks) {
+    uint64_t frequency = glfwGetTimerFrequency();
+
+    // Split to avoid overflowing ticks * 1e9
+    return ticks / frequency * 1000000000ull + ticks % frequency * 1000000000ull / frequency;
+}
+
+// Records the wall clock time since the previous call
+void frame_stats_tick() {
+    uint64_t now = glfwGetTimerValue();
+
+    if (has_last_tick)
+        frame_stats_add_sample(ticks_to_nanoseconds(now - last_tick));
+
+    last_tick     = now;
+    has_last_tick = true;
+}
+
+// The next tick only starts a new frame, used to leave out time spent idling
+void frame_stats_discard_tick() { has_last_tick = false; }
+
+void frame_stats_add_sample(uint64_t frame_time) {
+    frame_stats.count++;
+    frame_stats.total += frame_time;
+    frame_stats.last = frame_time;
+
+    if (frame_time < frame_stats.min)
+        frame_stats.min = frame_time;
+    if (frame_time > frame_stats.max)
+        frame_stats.max = frame_time;
+
+    frame_stats.histogram[bucket_index(frame_time)]++;
+
+    float ms = frame_time * 1e-6;
+
+    frame_stats.history[frame_stats.history_pivot]                            = ms;
+    frame_stats.history[frame_stats.history_pivot + FRAME_STATS_HISTORY_SIZE] = ms;
+
+    frame_stats.history_pivot = (frame_stats.history_pivot + 1) % FRAME_STATS_HISTORY_SIZE;
+    if (frame_stats.history_count < FRAME_STATS_HISTORY_SIZE)
+        frame_stats.history_count++;
+}
+
+void frame_stats_add_rays(uint64_t rays, uint64_t paths) {
+    frame_stats.rays += rays;
+    frame_stats.paths += paths;
+}
+
+double frame_stats_mean() {
+    if (frame_stats.count == 0)
+        return 0;
+
+    return (double)frame_stats.total / frame_stats.count;
+}
+
+// Average number of rays traced per path, 0 when nothing was counted
+double frame_stats_path_length() {
+    if (frame_stats.paths == 0)
+        return 0;
+
+    return (double)frame_stats.rays / frame_stats.paths;
+}
+
+// Nearest rank, in nanoseconds
+uint64_t frame_stats_percentile(double percentile) {
+    if (frame_stats.count == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)ceil(percentile / 100.0 * frame_stats.count);
+    if (rank == 0)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < FRAME_STATS_BUCKET_COUNT; i++) {
+        seen += frame_stats.histogram[i];
+
+        if (seen >= rank) {
+            uint64_t value = bucket_value(i);
+
+            // The bucket midpoint can fall outside of what was actually measured
+            if (value < frame_stats.min)
+                return frame_stats.min;
+            if (value > frame_stats.max)
+                return frame_stats.max;
+
+            return value;
+        }
+    }
+
+    return frame_stats.max;
+}
+
+// Oldest first, `last_n_samples` is clamped to the number of samples recorded
+const float *frame_stats_history(uint32_t last_n_samples) {
+    if (last_n_samples > frame_stats.history_count)
+        last_n_samples = frame_stats.history_count;
+
+    return &frame_stats.history[frame_stats.history_pivot + FRAME_STATS_HISTORY_SIZE - last_n_samples];
+}
+
+bool frame_stats_dump(const char *path) {
+    FILE *file = fopen(path, "w");
+
+    if (file == NULL) {
+        printf("failed to open %s for writing\n", path);
+        return false;
+    }
+
+    const double percentiles[]      = {50, 90, 95, 99, 99.9};
+    const char  *percentile_names[] = {"p50", "p90", "p95", "p99", "p99.9"};
+
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "unit", "ns");
+    cJSON_AddNumberToObject(root, "frames", frame_stats.count);
+    cJSON_AddNumberToObject(root, "min", frame_stats.count ? frame_stats.min : 0);
+    cJSON_AddNumberToObject(root, "max", frame_stats.max);
+    cJSON_AddNumberToObject(root, "mean", frame_stats_mean());
+    cJSON_AddNumberToObject(root, "total", frame_stats.total);
+
+    if (frame_stats.paths > 0) {
+        cJSON_AddNumberToObject(root, "rays", frame_stats.rays);
+        cJSON_AddNumberToObject(root, "paths", frame_stats.paths);
+        cJSON_AddNumberToObject(root, "mean_path_length", frame_stats_path_length());
+    }
+
+    cJSON *percentiles_json = cJSON_AddObjectToObject(root, "percentiles");
+    for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++)
+        cJSON_AddNumberToObject(percentiles_json, percentile_names[i], frame_stats_percentile(percentiles[i]));
+
+    // Only the buckets that have samples, as [value, count] pairs
+    cJSON *histogram_json = cJSON_AddArrayToObject(root, "histogram");
+    for (uint32_t i = 0; i < FRAME_STATS_BUCKET_COUNT; i++) {
+        if (frame_stats.histogram[i] == 0)
+            continue;
+
+        cJSON *bucket = cJSON_CreateArray();
+        cJSON_AddItemToArray(bucket, cJSON_CreateNumber(bucket_value(i)));
+        cJSON_AddItemToArray(bucket, cJSON_CreateNumber(frame_stats.histogram[i]));
+        cJSON_AddItemToArray(histogram_json, bucket);
+    }
+
+    char *json = cJSON_Print(root);
+    fprintf(file, "%s\n", json);
+    fclose(file);
+
+    cJSON_free(json);
+    cJSON_Delete(root);
+
+    printf("frame statistics written to %s\n", path);
+
+    return true;
+}
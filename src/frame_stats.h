@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef SRC_FRAME_STATS_H_
+#define SRC_FRAME_STATS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Most recent frame times kept for plotting
+#define FRAME_STATS_HISTORY_SIZE 512
+
+// Log-linear histogram, every power of two range is split into 64 linear
+// buckets, so percentiles are exact to within 1/64 (~1.6%) of the value.
+// Values below 2^41 ns (~37 minutes) are tracked, anything above is clamped.
+#define FRAME_STATS_SUB_BUCKET_BITS  7
+#define FRAME_STATS_SUB_BUCKET_COUNT (1 << FRAME_STATS_SUB_BUCKET_BITS)
+#define FRAME_STATS_SUB_BUCKET_HALF  (FRAME_STATS_SUB_BUCKET_COUNT / 2)
+#define FRAME_STATS_MAX_SHIFT        34
+#define FRAME_STATS_BUCKET_COUNT     (FRAME_STATS_SUB_BUCKET_COUNT + FRAME_STATS_MAX_SHIFT * FRAME_STATS_SUB_BUCKET_HALF)
+
+typedef struct {
+    uint64_t count;
+    uint64_t min; // Nanoseconds
+    uint64_t max;
+    uint64_t total;
+    uint64_t last;
+
+    // Rays and paths traced by the GPU, see benchmark_counts_rays
+    uint64_t rays;
+    uint64_t paths;
+
+    uint64_t histogram[FRAME_STATS_BUCKET_COUNT];
+
+    // Each sample is written twice, so the last n samples are always contiguous in memory
+    float    history[FRAME_STATS_HISTORY_SIZE * 2]; // Milliseconds
+    uint32_t history_pivot;
+    uint32_t history_count;
+} frame_stats_t;
+
+extern frame_stats_t frame_stats;
+
+void init_frame_stats();
+void frame_stats_reset();
+void frame_stats_tick();
+void frame_stats_discard_tick();
+void frame_stats_add_sample(uint64_t frame_time);
+void frame_stats_add_rays(uint64_t rays, uint64_t paths);
+
+double       frame_stats_mean();
+double       frame_stats_path_length();
+uint64_t     frame_stats_percentile(double percentile);
+const float *frame_stats_history(uint32_t last_n_samples);
+
+bool frame_stats_dump(const char *path);
+
+#endif // SRC_FRAME_STATS_H_
@@ -66,7 +66,7 @@ std::string Shadinclude::load(std::string path) {
     std::string includeIndentifier = "#include";
 
     includeIndentifier += ' ';
-    static bool isRecursiveCall = false;
+    static int includeDepth = 0;
 
     std::string   fullSourceCode = "";
     std::ifstream file(path);
@@ -78,10 +78,24 @@ std::string Shadinclude::load(std::string path) {
 
     std::string lineBuffer;
     while (std::getline(file, lineBuffer)) {
-        // Look for the new shader include identifier
-        if (lineBuffer.find(includeIndentifier) != lineBuffer.npos) {
+        // Look for the new shader include identifier, only at the start of
+        // the line so that includes mentioned in comments are left alone
+        size_t lineStart = lineBuffer.find_first_not_of(" \t");
+        if (lineStart != lineBuffer.npos &&
+            lineBuffer.compare(lineStart, includeIndentifier.size(), includeIndentifier) == 0) {
             // Remove the include identifier, this will cause the path to remain
-            lineBuffer.erase(0, includeIndentifier.size());
+            lineBuffer.erase(0, lineStart + includeIndentifier.size());
+
+            // Angle bracket includes are meant for headers shared with the C
+            // code (see gpu_layout.h), GLSL has no use for them
+            if (lineBuffer.find('<') != lineBuffer.npos) {
+                fullSourceCode += '\n';
+                continue;
+            }
+
+            // Quotes around the path are optional
+            lineBuffer.erase(0, lineBuffer.find_first_not_of(" \t\""));
+            lineBuffer.erase(lineBuffer.find_last_not_of(" \t\"\r") + 1);
 
             // The include path is relative to the current shader file path
             std::string pathOfThisFile = Shadinclude::getFilePath(path);
@@ -89,8 +103,9 @@ std::string Shadinclude::load(std::string path) {
 
             // By using recursion, the new include file can be extracted
             // and inserted at this location in the shader source code
-            isRecursiveCall = true;
+            includeDepth++;
             fullSourceCode += load(lineBuffer);
+            includeDepth--;
 
             // Do not add this line to the shader source code, as the include
             // path would generate a compilation issue in the final source code
@@ -102,7 +117,7 @@ std::string Shadinclude::load(std::string path) {
 
     // Only add the null terminator at the end of the complete file,
     // essentially skipping recursive function calls this way
-    if (!isRecursiveCall) {
+    if (includeDepth == 0) {
         fullSourceCode += '\0';
 
         // Since we preprocess the shaders, it is useful to have the final code
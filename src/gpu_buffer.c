@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glad/glad.h>
+
+#include "gpu_buffer.h"
+
+// GL is not fond of zero sized buffers, and empty scenes are a thing
+#define MIN_STORAGE_SIZE 256
+
+static gpu_buffer_t *gpu_buffers[MAX_GPU_BUFFERS];
+static size_t        n_gpu_buffers = 0;
+
+static size_t storage_size(gpu_buffer_t *buffer, size_t capacity) {
+    size_t size = capacity * buffer->element_size;
+
+    return size < MIN_STORAGE_SIZE ? MIN_STORAGE_SIZE : size;
+}
+
+static size_t grown_capacity(gpu_buffer_t *buffer, size_t count) {
+    size_t capacity = buffer->capacity > 0 ? buffer->capacity : 1;
+
+    while (capacity < count)
+        capacity *= 2;
+
+    return capacity;
+}
+
+// Creates new storage with room for `capacity` elements. Immutable storage
+// can't be resized, and a new name also means that the GPU never waits on
+// us, so all modes always get a fresh buffer here.
+static void reallocate(gpu_buffer_t *buffer, size_t capacity, bool keep_contents) {
+    GLuint old_id = buffer->id;
+    GLuint new_id;
+    size_t size = storage_size(buffer, capacity);
+
+    glGenBuffers(1, &new_id);
+    glBindBuffer(buffer->target, new_id);
+
+    if (buffer->mode == GPU_BUFFER_PERSISTENT) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(buffer->target, size, NULL, flags | GL_DYNAMIC_STORAGE_BIT);
+        buffer->mapped = glMapBufferRange(buffer->target, 0, size, flags);
+    } else if (buffer->mode == GPU_BUFFER_PERSISTENT_READBACK) {
+        GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(buffer->target, size, NULL, flags | GL_CLIENT_STORAGE_BIT);
+        buffer->mapped = glMapBufferRange(buffer->target, 0, size, flags);
+    } else if (buffer->mode == GPU_BUFFER_READBACK) {
+        glBufferData(buffer->target, size, NULL, GL_STREAM_READ);
+    } else {
+        glBufferData(buffer->target, size, NULL, GL_DYNAMIC_DRAW);
+    }
+
+    glBindBuffer(buffer->target, 0);
+
+    if (old_id) {
+        if (keep_contents && buffer->count > 0) {
+            glBindBuffer(GL_COPY_READ_BUFFER, old_id);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, new_id);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                                buffer->count * buffer->element_size);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        }
+
+        // Deleting a mapped buffer implicitly unmaps it
+        glDeleteBuffers(1, &old_id);
+    }
+
+    buffer->id       = new_id;
+    buffer->capacity = capacity;
+
+    gpu_buffer_bind(buffer);
+}
+
+static void write_range(gpu_buffer_t *buffer, size_t first, size_t count, const void *data) {
+    if (count == 0 || data == NULL)
+        return;
+
+    size_t offset = first * buffer->element_size;
+    size_t size   = count * buffer->element_size;
+
+    if (buffer->mode == GPU_BUFFER_PERSISTENT) {
+        memcpy((char *)buffer->mapped + offset, data, size);
+    } else {
+        glBindBuffer(buffer->target, buffer->id);
+        glBufferSubData(buffer->target, offset, size, data);
+        glBindBuffer(buffer->target, 0);
+    }
+}
+
+gpu_buffer_t *make_gpu_buffer(const char *name, uint32_t target, uint32_t binding, size_t element_size,
+                              gpu_buffer_mode_t mode) {
+    assert(name);
+    assert(element_size > 0);
+
+    if (n_gpu_buffers >= MAX_GPU_BUFFERS) {
+        printf("Too many gpu buffers, could not create %s\n", name);
+        exit(EXIT_FAILURE);
+    }
+
+    gpu_buffer_t *buffer = malloc(sizeof(gpu_buffer_t));
+    memset(buffer, 0, sizeof(gpu_buffer_t));
+
+    snprintf(buffer->name, sizeof(buffer->name), "%s", name);
+    buffer->mode         = mode;
+    buffer->target       = target;
+    buffer->binding      = binding;
+    buffer->element_size = element_size;
+
+    reallocate(buffer, 1, false);
+
+    gpu_buffers[n_gpu_buffers++] = buffer;
+
+    return buffer;
+}
+
+void destroy_gpu_buffer(gpu_buffer_t *buffer) {
+    assert(buffer);
+
+    for (size_t i = 0; i < n_gpu_buffers; i++) {
+        if (gpu_buffers[i] == buffer) {
+            gpu_buffers[i] = gpu_buffers[--n_gpu_buffers];
+            break;
+        }
+    }
+
+    glDeleteBuffers(1, &buffer->id);
+    free(buffer);
+}
+
+// Replaces the whole contents of the buffer
+void gpu_buffer_upload(gpu_buffer_t *buffer, const void *data, size_t count) {
+    assert(buffer);
+
+    if (count > buffer->capacity) {
+        reallocate(buffer, grown_capacity(buffer, count), false);
+    } else if (buffer->mode == GPU_BUFFER_DYNAMIC) {
+        // Orphan the old storage, so we don't stall if the GPU is still using it
+        glBindBuffer(buffer->target, buffer->id);
+        glBufferData(buffer->target, storage_size(buffer, buffer->capacity), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(buffer->target, 0);
+    }
+
+    buffer->count = count;
+    buffer->dirty = false;
+
+    write_range(buffer, 0, count, data);
+}
+
+// Writes `count` elements starting at `first`, growing the buffer if needed
+void gpu_buffer_update(gpu_buffer_t *buffer, size_t first, size_t count, const void *data) {
+    assert(buffer);
+
+    gpu_buffer_reserve(buffer, first + count);
+    write_range(buffer, first, count, data);
+
+    if (first + count > buffer->count)
+        buffer->count = first + count;
+}
+
+void gpu_buffer_reserve(gpu_buffer_t *buffer, size_t count) {
+    assert(buffer);
+
+    if (count > buffer->capacity)
+        reallocate(buffer, grown_capacity(buffer, count), true);
+}
+
+void gpu_buffer_bind(gpu_buffer_t *buffer) {
+    assert(buffer);
+
+    if (buffer->binding != GPU_BUFFER_NO_BINDING)
+        glBindBufferBase(buffer->target, buffer->binding, buffer->id);
+}
+
+void gpu_buffer_mark_dirty(gpu_buffer_t *buffer, size_t first, size_t count) {
+    assert(buffer);
+
+    if (count == 0)
+        return;
+
+    if (!buffer->dirty) {
+        buffer->dirty_begin = first;
+        buffer->dirty_end   = first + count;
+        buffer->dirty       = true;
+        return;
+    }
+
+    if (first < buffer->dirty_begin)
+        buffer->dirty_begin = first;
+
+    if (first + count > buffer->dirty_end)
+        buffer->dirty_end = first + count;
+}
+
+// Uploads the dirty range from `data`, which is the host copy of the whole buffer
+void gpu_buffer_flush(gpu_buffer_t *buffer, const void *data) {
+    assert(buffer);
+
+    if (!buffer->dirty)
+        return;
+
+    size_t first = buffer->dirty_begin;
+    size_t count = buffer->dirty_end - buffer->dirty_begin;
+
+    gpu_buffer_update(buffer, first, count, (const char *)data + first * buffer->element_size);
+
+    buffer->dirty = false;
+}
+
+size_t gpu_buffer_count() { return n_gpu_buffers; }
+
+gpu_buffer_t *gpu_buffer_get(size_t index) {
+    assert(index < n_gpu_buffers);
+
+    return gpu_buffers[index];
+}
+
+size_t gpu_buffer_memory(gpu_buffer_t *buffer) {
+    assert(buffer);
+
+    return storage_size(buffer, buffer->capacity);
+}
+
+size_t gpu_buffer_total_memory() {
+    size_t total = 0;
+
+    for (size_t i = 0; i < n_gpu_buffers; i++)
+        total += gpu_buffer_memory(gpu_buffers[i]);
+
+    return total;
+}
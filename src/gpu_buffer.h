@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef SRC_GPU_BUFFER_H_
+#define SRC_GPU_BUFFER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MAX_GPU_BUFFERS 64
+
+// For targets without indexed binding points (eg: pixel pack buffers)
+#define GPU_BUFFER_NO_BINDING UINT32_MAX
+
+typedef enum {
+    // Mutable storage. Full uploads orphan the old storage instead of waiting
+    // for the GPU to be done with it, partial uploads use glBufferSubData.
+    GPU_BUFFER_DYNAMIC,
+    // Immutable storage that is persistently and coherently mapped. Uploads
+    // are plain memcpys, so callers must make sure the GPU is not reading the
+    // range being written (eg: with fences).
+    GPU_BUFFER_PERSISTENT,
+    // Mutable storage written by the GPU and mapped for reading once a fence
+    // says it is done (eg: pixel pack buffers for async readbacks).
+    GPU_BUFFER_READBACK,
+    // Immutable storage written by the GPU, persistently and coherently mapped
+    // for reading. Any thread can read the mapping once a fence says the GPU
+    // is done, without copying it out first.
+    GPU_BUFFER_PERSISTENT_READBACK,
+} gpu_buffer_mode_t;
+
+typedef struct {
+    char              name[64];
+    gpu_buffer_mode_t mode;
+
+    uint32_t id;
+    uint32_t target;
+    uint32_t binding;
+
+    size_t element_size;
+    size_t count;    // Elements in use
+    size_t capacity; // Elements allocated
+
+    void *mapped; // GPU_BUFFER_PERSISTENT and GPU_BUFFER_PERSISTENT_READBACK only
+
+    // Range of elements waiting for gpu_buffer_flush, end is exclusive
+    size_t dirty_begin;
+    size_t dirty_end;
+    bool   dirty;
+} gpu_buffer_t;
+
+gpu_buffer_t *make_gpu_buffer(const char *name, uint32_t target, uint32_t binding, size_t element_size,
+                              gpu_buffer_mode_t mode);
+void          destroy_gpu_buffer(gpu_buffer_t *buffer);
+
+void gpu_buffer_upload(gpu_buffer_t *buffer, const void *data, size_t count);
+void gpu_buffer_update(gpu_buffer_t *buffer, size_t first, size_t count, const void *data);
+void gpu_buffer_reserve(gpu_buffer_t *buffer, size_t count);
+void gpu_buffer_bind(gpu_buffer_t *buffer);
+
+void gpu_buffer_mark_dirty(gpu_buffer_t *buffer, size_t first, size_t count);
+void gpu_buffer_flush(gpu_buffer_t *buffer, const void *data);
+
+size_t        gpu_buffer_count();
+gpu_buffer_t *gpu_buffer_get(size_t index);
+size_t        gpu_buffer_memory(gpu_buffer_t *buffer);
+size_t        gpu_buffer_total_memory();
+
+#endif // SRC_GPU_BUFFER_H_
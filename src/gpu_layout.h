@@ -0,0 +1,300 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// This header is shared between the C code and the GLSL shaders, and is the
+// single place where the layout of the GPU buffers is defined. It must only
+// contain preprocessor directives and struct definitions made of types that
+// exist in both languages (int, float, vec3, vec4, mat4 and arrays of them).
+// All records follow std430 rules and are padded to a multiple of 16 bytes.
+//
+// The shaders pull it in with `#include "../src/gpu_layout.h"`. Angle bracket
+// includes are dropped by the shader preprocessor, so they are host only.
+
+#ifndef SRC_GPU_LAYOUT_H_
+#define SRC_GPU_LAYOUT_H_
+
+#ifdef GL_core_profile
+
+#define GPU_STRUCT_BEGIN(name) struct name {
+#define GPU_STRUCT_END(name)   };
+
+#else
+
+#include <cglm/cglm.h>
+
+#define GPU_STRUCT_BEGIN(name) typedef struct name {
+#define GPU_STRUCT_END(name)   } name;
+
+#endif // GL_core_profile
+
+/////////////////
+// SSBO binding points
+//
+#define SSBO_BINDING_MATERIALS   10
+#define SSBO_BINDING_SPHERES     11
+#define SSBO_BINDING_TRIANGLES   12
+#define SSBO_BINDING_BLAS_NODES  13
+#define SSBO_BINDING_TLAS_NODES  14
+#define SSBO_BINDING_INSTANCES   15
+#define SSBO_BINDING_REFIT_ORDER 16
+#define SSBO_BINDING_BVH_STATS   17
+#define SSBO_BINDING_BLAS4_NODES 18
+#define SSBO_BINDING_RAY_COUNTER 19 // See RAY_COUNTER_*
+#define SSBO_BINDING_CONVERGENCE 20
+#define SSBO_BINDING_HISTOGRAM   21
+#define SSBO_BINDING_EXPOSURE    22
+#define SSBO_BINDING_WORK_QUEUE  23
+#define SSBO_BINDING_QUADS       24
+#define SSBO_BINDING_BOXES       25
+#define SSBO_BINDING_PLANES      26
+
+/////////////////
+// UBO binding points
+//
+#define UBO_BINDING_FRAME_PARAMS 0
+
+/////////////////
+// Render target formats, picked at startup. The shaders get the ones in use
+// as ACCUMULATION_FORMAT and NORMAL_FORMAT, see render_targets.c.
+//
+#define ACCUMULATION_RGBA32F    0 // Sum of the frames in rgb, their count in a
+#define ACCUMULATION_RGBA16F    1 // Running mean in rgb, stochastically rounded
+#define ACCUMULATION_R11G11B10F 2 // Running mean, stochastically rounded
+#define NORMALS_RGBA32F         0 // Normal mapped to [0, 1] in rgb
+#define NORMALS_OCT16           1 // Octahedral encoding, in RG16_SNORM
+
+/////////////////
+// Material types
+//
+#define MATERIAL_DIFFUSE    1
+#define MATERIAL_METAL      2
+#define MATERIAL_DIELECTRIC 3
+#define MATERIAL_LIGHT      5
+
+/////////////////
+// Primitive types, one per bottom level acceleration structure
+//
+#define PRIMITIVE_SPHERE   1
+#define PRIMITIVE_TRIANGLE 2
+#define PRIMITIVE_QUAD     3
+#define PRIMITIVE_BOX      4
+
+// Layout of the ray counter. Every benchmark slot holds the rays, then the
+// paths traced in its frame, as 64 bit counts split in a low and a high word,
+// since a single frame can trace more than 2^32 rays.
+#define RAY_COUNTER_RAYS   0
+#define RAY_COUNTER_PATHS  2
+#define RAY_COUNTER_STRIDE 4
+
+// Cost of visiting an internal BVH node, relative to intersecting one
+// primitive. Used by the builder and by the SAH cost of refitted trees.
+#define BVH_TRAVERSAL_COST 1.0
+
+// Deepest level a BVH node can be at, the root being at level 0. The builder
+// keeps every tree within it, which bounds the traversal stacks.
+#define BVH_MAX_DEPTH 32
+
+// Fixed point scale of the convergence counters, the relative change of each
+// pixel is clamped to 1 before scaling so a full frame fits in 32 bits
+#define CONVERGENCE_SCALE 65536
+
+// Tone mapping LUT baked by tonemap_lut.comp and applied by display.comp.
+// Entry 0 is black, the others are spaced evenly in log2 of the exposed
+// radiance over [MIN_LOG2, MAX_LOG2].
+#define DISPLAY_LUT_SIZE     1024
+#define DISPLAY_LUT_MIN_LOG2 -16.0
+#define DISPLAY_LUT_MAX_LOG2 12.0
+
+// Log luminance histogram of the auto exposure. Bin 0 counts black pixels,
+// the others split [MIN_LOG2, MAX_LOG2] evenly. Also the size of the single
+// workgroup that reduces it.
+#define AUTO_EXPOSURE_BINS     256
+#define AUTO_EXPOSURE_MIN_LOG2 -12.0
+#define AUTO_EXPOSURE_MAX_LOG2 8.0
+
+// Shading data, only fetched once per bounce for the closest hit. Shared by
+// all primitive types and indexed by their `material_id`.
+GPU_STRUCT_BEGIN(gpu_material_t)
+    vec4  albedo;    // rgb: albedo, a: unused
+    vec4  emission;  // rgb: emission, a: unused
+    float roughness; // Also used as the refraction index by dielectrics
+    int   type;      // One of the MATERIAL_* values
+    int   _pad0;
+    int   _pad1;
+GPU_STRUCT_END(gpu_material_t)
+
+// Geometry only records, read in the hot intersection loop.
+GPU_STRUCT_BEGIN(gpu_sphere_t)
+    vec3  center;
+    float radius;
+    int   material_id;
+    int   _pad0;
+    int   _pad1;
+    int   _pad2;
+GPU_STRUCT_END(gpu_sphere_t)
+
+// Edges and normal are precomputed at upload time, so that the intersection
+// test only has to fetch `v0`, `edge1` and `edge2`, which share a cache line
+// with the normal used for shading.
+GPU_STRUCT_BEGIN(gpu_triangle_t)
+    vec3  v0;
+    int   material_id;
+    vec3  edge1; // v1 - v0
+    float _pad0;
+    vec3  edge2; // v2 - v0
+    float _pad1;
+    vec3  normal; // normalize(cross(edge1, edge2))
+    float _pad2;
+GPU_STRUCT_END(gpu_triangle_t)
+
+// Parallelogram spanned by the two edges from `corner`. Same layout as
+// gpu_triangle_t, the intersection only swaps the u + v <= 1 test for v <= 1.
+GPU_STRUCT_BEGIN(gpu_quad_t)
+    vec3  corner;
+    int   material_id;
+    vec3  edge_u;
+    float _pad0;
+    vec3  edge_v;
+    float _pad1;
+    vec3  normal; // normalize(cross(edge_u, edge_v))
+    float _pad2;
+GPU_STRUCT_END(gpu_quad_t)
+
+// Axis aligned in object space, instances can still rotate it
+GPU_STRUCT_BEGIN(gpu_box_t)
+    vec3 box_min;
+    int  material_id;
+    vec3 box_max;
+    int  _pad0;
+GPU_STRUCT_END(gpu_box_t)
+
+// Infinite plane of the points p with dot(normal, p) == offset. Having no
+// bounds, planes live outside of the BVHs and every ray tests all of them.
+// When `checker_material_id` is not -1 the plane is a checkerboard, with unit
+// squares along `checker_u` and `checker_v` that alternate between the two
+// materials.
+GPU_STRUCT_BEGIN(gpu_plane_t)
+    vec3  normal;
+    float offset;
+    vec3  checker_u;
+    int   material_id;
+    vec3  checker_v;
+    int   checker_material_id;
+GPU_STRUCT_END(gpu_plane_t)
+
+// Binary BVH node. Leaves have `count > 0` and reference the primitives
+// [left_first, left_first + count). Internal nodes have `count == 0` and their
+// children are stored next to each other at `left_first` and `left_first + 1`.
+//
+// Bottom level nodes of all meshes live in a single array and reference
+// primitives of the array of their mesh's type. Top level leaves reference a
+// single instance each.
+GPU_STRUCT_BEGIN(gpu_bvh_node_t)
+    vec3 aabb_min;
+    int  left_first;
+    vec3 aabb_max;
+    int  count;
+GPU_STRUCT_END(gpu_bvh_node_t)
+
+// One placement of a mesh in the world. Rays are moved into object space
+// before traversing the bottom level BVH, so only unique geometry is stored.
+GPU_STRUCT_BEGIN(gpu_instance_t)
+    mat4 world_to_object;
+    int  root_node;         // Into the bottom level nodes
+    int  primitive_type;    // One of the PRIMITIVE_* values
+    int  material_override; // -1 to keep the materials of the primitives
+    int  root_wide_node;    // Into the bottom level 4-wide nodes
+GPU_STRUCT_END(gpu_instance_t)
+
+// 4-wide BVH node, collapsed from the binary one. Child bounds are stored with
+// 8 bits per plane, relative to `origin` (the parent minimum) and scaled by a
+// per axis power of two, which is what keeps the node at 64 bytes.
+//
+// `exponents` holds the biased float exponent of each axis scale, x in the low
+// byte. `bounds_min` and `bounds_max` hold one axis each, with child `i` in
+// bits [8i, 8i + 8). `counts` holds the primitive count of each child in the
+// same way, 0 for internal children. `child` is a node index for internal
+// children, the first primitive for leaves, and -1 for empty slots.
+GPU_STRUCT_BEGIN(gpu_bvh4_node_t)
+    vec3 origin;
+    int  exponents;
+    int  child[4];
+    int  counts;
+    int  bounds_min[3];
+    int  bounds_max[3];
+    int  _pad0;
+GPU_STRUCT_END(gpu_bvh4_node_t)
+
+// Everything the raytracer needs that changes from one frame to the next. It
+// lives in a ring of uniform buffer slots, one per frame in flight, so the CPU
+// never writes to a slot that a queued dispatch still reads. Only scalars and
+// vec3/scalar pairs, which lay out the same under std140 and std430.
+GPU_STRUCT_BEGIN(gpu_frame_params_t)
+    vec3  camera_origin;
+    float time;
+    vec3  camera_lower_left;
+    int   rng_seed;
+    vec3  camera_horizontal;
+    int   n_samples;
+    vec3  camera_vertical;
+    int   n_bounces;
+    vec3  camera_forward;
+    int   orthographic;
+    vec3  camera_lens_u;
+    int   thin_lens;
+    vec3  camera_lens_v;
+    int   incremental_rendering;
+    vec3  ambient_light;
+    int   wide_bvh;
+    int   count_rays;
+    int   ray_counter_slot;
+    int   convergence_slot;
+    int   first_cpu_tile;     // Tiles from here on, in row major order, are traced by the CPU
+    int   accumulated_frames; // Already in the accumulation, the running mean formats weigh the new one by this
+    int   image_offset_x;     // Of the render targets inside the image, when rendering it in tiles
+    int   image_offset_y;
+    int   image_width;        // Of the whole image, the render targets when not tiled
+    int   image_height;
+    int   roulette_depth;     // Bounces before paths start being terminated at random
+    int   plane_count;        // Tested by every ray, outside of the BVHs
+    int   _pad2;
+GPU_STRUCT_END(gpu_frame_params_t)
+
+// Written by exposure_adapt.comp and read by tonemap_lut.comp, never by the CPU
+GPU_STRUCT_BEGIN(gpu_exposure_t)
+    float exposure;          // Multiplies the manual exposure
+    float average_luminance; // Of the pixels between the percentiles, as of the last frame
+    int   initialized;       // Until set, the first frame adapts all the way at once
+    int   _pad0;
+GPU_STRUCT_END(gpu_exposure_t)
+
+#ifndef GL_core_profile
+_Static_assert(sizeof(gpu_material_t) == 48, "gpu_material_t does not match the std430 layout");
+_Static_assert(sizeof(gpu_sphere_t) == 32, "gpu_sphere_t does not match the std430 layout");
+_Static_assert(sizeof(gpu_triangle_t) == 64, "gpu_triangle_t does not match the std430 layout");
+_Static_assert(sizeof(gpu_quad_t) == 64, "gpu_quad_t does not match the std430 layout");
+_Static_assert(sizeof(gpu_box_t) == 32, "gpu_box_t does not match the std430 layout");
+_Static_assert(sizeof(gpu_plane_t) == 48, "gpu_plane_t does not match the std430 layout");
+_Static_assert(sizeof(gpu_bvh_node_t) == 32, "gpu_bvh_node_t does not match the std430 layout");
+_Static_assert(sizeof(gpu_instance_t) == 80, "gpu_instance_t does not match the std430 layout");
+_Static_assert(sizeof(gpu_bvh4_node_t) == 64, "gpu_bvh4_node_t does not match the std430 layout");
+_Static_assert(sizeof(gpu_frame_params_t) == 176, "gpu_frame_params_t does not match the std140 layout");
+_Static_assert(sizeof(gpu_exposure_t) == 16, "gpu_exposure_t does not match the std430 layout");
+#endif // GL_core_profile
+
+#endif // SRC_GPU_LAYOUT_H_
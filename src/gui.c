@@ -26,11 +26,17 @@
 
 #include <GLFW/glfw3.h>
 
-#include "fps.h"
+#include "animation.h"
+#include "capture.h"
+#include "frame_pipeline.h"
+#include "frame_stats.h"
+#include "gpu_buffer.h"
 #include "gui.h"
 #include "imgui_custom_c.h"
 #include "manager.h"
-#include "settings.h"
+#include "options.h"
+#include "rendering.h"
+#include "scene.h"
 
 struct ImGuiContext  *ctx;
 struct ImGuiIO       *io;
@@ -38,6 +44,13 @@ struct ImPlotContext *plot_ctx;
 
 char buffer[1024];
 
+static float history_index[FRAME_STATS_HISTORY_SIZE];
+
+// Render resolutions to pick from, the first one follows the window
+static const char    *resolution_names[]    = {"Window", "720p", "1080p", "1440p", "4K", "8K"};
+static const uint32_t resolution_sizes[][2] = {{0, 0},       {1280, 720},  {1920, 1080},
+                                               {2560, 1440}, {3840, 2160}, {7680, 4320}};
+
 void gui_init() {
     ctx      = igCreateContext(NULL);
     io       = igGetIO();
@@ -47,9 +60,15 @@ void gui_init() {
     ImGui_ImplGlfw_InitForOpenGL(window, true);
     ImGui_ImplOpenGL3_Init(glsl_version);
 
+    // The backend builds the font atlas texture on its first new frame. The main
+    // thread calls igNewFrame before the render thread gets there, so it has to
+    // happen now, while this thread still owns the context.
+    ImGui_ImplOpenGL3_NewFrame();
+
     igStyleColorsDark(NULL);
 
-    init_fps();
+    for (int i = 0; i < FRAME_STATS_HISTORY_SIZE; i++)
+        history_index[i] = i;
 }
 
 void gui_terminate() {
@@ -60,22 +79,29 @@ void gui_terminate() {
 }
 
 void gui_new_frame() {
-    ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplGlfw_NewFrame();
     igNewFrame();
 }
 
-void gui_render() {
+// Runs on the main thread, which owns the window and the input. Only produces
+// the draw data, gui_draw turns it into GL calls on the render thread.
+void gui_build() {
     gui_new_frame();
 
     if (!manager->hide_ui) {
-        gui_update_fps();
+        gui_update_frame_stats();
         gui_update_scene();
         gui_update_camera();
         gui_debug();
     }
 
     igRender();
+}
+
+// Runs on the render thread. The draw data stays valid until the next
+// gui_build, which the main thread holds off until this returns.
+void gui_draw() {
+    ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplOpenGL3_RenderDrawData(igGetDrawData());
 }
 
@@ -94,8 +120,104 @@ void gui_update_scene() {
 
     igSliderFloat("Exposure", &manager->exposure, 0, 2, "%.3f", 0);
 
+    if (manager->auto_exposure)
+        snprintf(buffer, sizeof(buffer), "auto_exposure: ON");
+    else
+        snprintf(buffer, sizeof(buffer), "auto_exposure: OFF");
+
+    toggle_button("auto_exposure", buffer, &manager->auto_exposure);
+
     igSliderInt("Samples", (int *)&manager->n_samples, 1, 20, "%3d", 0);
     igSliderInt("Bounces", (int *)&manager->n_bounces, 1, 20, "%3d", 0);
+    igSliderInt("Roulette depth", (int *)&manager->roulette_depth, 1, 20, "%3d", 0);
+
+    igSeparator();
+
+    snprintf(buffer, sizeof(buffer), "resolution: %ux%u  window %ux%u", manager->render_width, manager->render_height,
+             manager->window_width, manager->window_height);
+    igText(buffer);
+
+    // Streams keep the resolution they started with
+    if (!options.stream_path) {
+        for (size_t i = 0; i < sizeof(resolution_names) / sizeof(resolution_names[0]); i++) {
+            bool selected = manager->requested_width == resolution_sizes[i][0] &&
+                            manager->requested_height == resolution_sizes[i][1];
+
+            if (i > 0)
+                igSameLine(0, -1);
+
+            if (igRadioButton_Bool(resolution_names[i], selected)) {
+                manager->requested_width  = resolution_sizes[i][0];
+                manager->requested_height = resolution_sizes[i][1];
+            }
+        }
+    }
+
+    igSeparator();
+
+    const char *idle_states[] = {"rendering", "throttled", "converged"};
+
+    snprintf(buffer, sizeof(buffer), "%s: %u spp  change %.5f", idle_states[manager->idle_state],
+             manager->accumulated_spp, manager->convergence);
+    igText(buffer);
+
+    igSliderInt("Target spp", (int *)&manager->target_spp, 0, 65536, "%d", ImGuiSliderFlags_Logarithmic);
+    igSliderFloat("Noise threshold", &manager->noise_threshold, 0, 0.01, "%.5f", ImGuiSliderFlags_Logarithmic);
+
+    if (manager->throttle_unfocused)
+        snprintf(buffer, sizeof(buffer), "throttle_unfocused: ON");
+    else
+        snprintf(buffer, sizeof(buffer), "throttle_unfocused: OFF");
+
+    toggle_button("throttle_unfocused", buffer, &manager->throttle_unfocused);
+    igSliderFloat("Background fps", &manager->background_fps, 1, 30, "%.1f", 0);
+
+    igSeparator();
+
+    if (manager->hybrid_rendering)
+        snprintf(buffer, sizeof(buffer), "hybrid_rendering: ON");
+    else
+        snprintf(buffer, sizeof(buffer), "hybrid_rendering: OFF");
+
+    toggle_button("hybrid_rendering", buffer, &manager->hybrid_rendering);
+
+    snprintf(buffer, sizeof(buffer), "cpu: %u tiles on %u threads", manager->cpu_tiles, manager->cpu_threads);
+    igText(buffer);
+
+    snprintf(buffer, sizeof(buffer), "per tile: cpu %.3f ms  gpu %.3f ms", manager->cpu_tile_time * 1e3,
+             manager->gpu_tile_time * 1e3);
+    igText(buffer);
+
+    // The sorted raytracer needs whole tiles in lock step
+    if (!options.material_sort) {
+        if (manager->persistent_threads)
+            snprintf(buffer, sizeof(buffer), "persistent_threads: ON");
+        else
+            snprintf(buffer, sizeof(buffer), "persistent_threads: OFF");
+
+        toggle_button("persistent_threads", buffer, &manager->persistent_threads);
+    }
+
+    igSeparator();
+
+    ImVec2 zero = {0, 0};
+    if (igButton("Capture (F12)", zero))
+        manager->capture_requested = true;
+
+    igRadioButton_IntPtr("PNG", (int *)&manager->capture_format, CAPTURE_PNG);
+    igSameLine(0, -1);
+    igRadioButton_IntPtr("EXR", (int *)&manager->capture_format, CAPTURE_EXR);
+    igSameLine(0, -1);
+    igRadioButton_IntPtr("PFM", (int *)&manager->capture_format, CAPTURE_PFM);
+
+    snprintf(buffer, sizeof(buffer), "captures written: %u", manager->n_captures);
+    igText(buffer);
+
+    if (options.stream_path) {
+        snprintf(buffer, sizeof(buffer), "stream: %u frames  %u dropped", manager->n_streamed_frames,
+                 manager->n_dropped_frames);
+        igText(buffer);
+    }
 
     igSeparator();
 
@@ -111,53 +233,112 @@ void gui_update_scene() {
     igRadioButton_IntPtr("Uncharted 2", (int *)&manager->tone_mapping_mode, 7);
     igRadioButton_IntPtr("Unreal", (int *)&manager->tone_mapping_mode, 8);
 
+    igSeparator();
+
+    igText("Instances");
+    for (int i = 0; i < n_instances; i++) {
+        mat4 transform;
+        glm_mat4_copy(scene_instances[i].transform, transform);
+
+        snprintf(buffer, sizeof(buffer), "instance %d (mesh %d)", i, scene_instances[i].mesh_id);
+        if (igDragFloat3(buffer, transform[3], 0.05f, -100.0f, 100.0f, "%.2f", 0)) {
+            scene_set_instance_transform(i, transform);
+            reset_accumulation();
+        }
+    }
+
+    igSeparator();
+
+    if (manager->animate_scene)
+        snprintf(buffer, sizeof(buffer), "animate: ON");
+    else
+        snprintf(buffer, sizeof(buffer), "animate: OFF");
+
+    toggle_button("animate", buffer, &manager->animate_scene);
+
+    if (manager->wide_bvh)
+        snprintf(buffer, sizeof(buffer), "wide_bvh: ON");
+    else
+        snprintf(buffer, sizeof(buffer), "wide_bvh: OFF");
+
+    toggle_button("wide_bvh", buffer, &manager->wide_bvh);
+
+    // GPU refits only update the binary nodes, the 4-wide ones are rebuilt with the mesh
+    if (manager->wide_bvh && !wide_bvh_up_to_date())
+        igText(" stale after GPU refit, tracing the binary BVH");
+
+    igText("BVH update");
+    igRadioButton_IntPtr("Rebuild", (int *)&manager->bvh_update_mode, BVH_UPDATE_REBUILD);
+    igRadioButton_IntPtr("Refit CPU", (int *)&manager->bvh_update_mode, BVH_UPDATE_REFIT_CPU);
+    igRadioButton_IntPtr("Refit GPU", (int *)&manager->bvh_update_mode, BVH_UPDATE_REFIT_GPU);
+    igSliderFloat("Rebuild threshold", &manager->bvh_rebuild_threshold, 1.0, 3.0, "%.2f", 0);
+
+    snprintf(buffer, sizeof(buffer), "update: %8.2f us  rebuilds: %u", manager->bvh_update_time * 1e6,
+             manager->n_bvh_rebuilds);
+    igText(buffer);
+
+    for (int i = 0; i < n_meshes; i++) {
+        snprintf(buffer, sizeof(buffer), "mesh %d: SAH %.2f (built %.2f)  nodes %u / %d wide", i,
+                 scene_meshes[i].sah_cost, scene_meshes[i].bvh->build_cost, scene_meshes[i].bvh->n_nodes,
+                 scene_meshes[i].n_wide_nodes);
+        igText(buffer);
+    }
+
     igEnd();
 }
 
-void gui_update_fps() {
+void gui_update_frame_stats() {
     if (!igBegin("Window", NULL, 0))
         return igEnd();
 
-    float ms          = manager->delta_time;
-    float instant_fps = 1.0 / ms;
-    float average_fps = 0.0f;
-
-    add_fps_sample(instant_fps);
+    double last_ms = frame_stats.last * 1e-6;
+    double mean_ms = frame_stats_mean() * 1e-6;
+    double p50_ms  = frame_stats_percentile(50) * 1e-6;
+    double p95_ms  = frame_stats_percentile(95) * 1e-6;
+    double p99_ms  = frame_stats_percentile(99) * 1e-6;
 
-    static int n_samples_old = -1;
-    int        n_samples     = get_fps_sample_count();
-    n_samples                = (float)fmin(n_samples, (((int)(instant_fps * 1.2f) / 10.0f) * 10.0f));
+    snprintf(buffer, sizeof(buffer), "FPS: %6.2f  (%.2f)", last_ms > 0 ? 1e3 / last_ms : 0,
+             mean_ms > 0 ? 1e3 / mean_ms : 0);
+    igText(buffer);
 
-    if (n_samples_old == -1) {
-        n_samples_old = n_samples;
-    } else if (n_samples_old != n_samples) {
-        n_samples     = n_samples_old * 0.9 + n_samples * 0.1;
-        n_samples_old = n_samples;
-    }
+    snprintf(buffer, sizeof(buffer), " ms: %9.3f  mean %.3f", last_ms, mean_ms);
+    igText(buffer);
 
-    average_fps             = get_average_fps_with_sample_limit(n_samples);
-    float        max_fps    = get_max_fps_with_sample_limit(n_samples);
-    const float *fps_buffer = get_fps_buffer_with_sample_limit(n_samples);
-    const float *fps_index  = get_fps_index_buffer();
+    snprintf(buffer, sizeof(buffer), " min %.3f  max %.3f", frame_stats.count ? frame_stats.min * 1e-6 : 0,
+             frame_stats.max * 1e-6);
+    igText(buffer);
 
-    snprintf(buffer, sizeof(buffer), "FPS: %6.2f  (%.2f)", instant_fps, average_fps);
+    snprintf(buffer, sizeof(buffer), " p50 %.3f  p95 %.3f  p99 %.3f", p50_ms, p95_ms, p99_ms);
     igText(buffer);
 
-    snprintf(buffer, sizeof(buffer), " ms: %9.5f", ms);
+    snprintf(buffer, sizeof(buffer), " frames: %lu", (unsigned long)frame_stats.count);
     igText(buffer);
 
+    if (frame_stats.paths > 0) {
+        snprintf(buffer, sizeof(buffer), " rays per path: %.2f", frame_stats_path_length());
+        igText(buffer);
+    }
+
+    ImVec2 zero = {0, 0};
+    if (igButton("Reset", zero))
+        frame_stats_reset();
+
+    uint32_t     n_samples = frame_stats.history_count;
+    const float *history   = frame_stats_history(n_samples);
+
     ImVec2 size            = {200, 100};
     ImVec4 plot_color_line = {1, 1, 0, 1};
     ImVec4 plot_color_fill = {1, 1, 0, 0.25};
 
-    if (ImPlot_BeginPlot("fps", size, 0)) {
-        ImPlot_SetupAxesLimits(0, n_samples, 0, max_fps * 1.2, ImGuiCond_Always);
-        ImPlot_SetupAxes("time", "fps", 0, 0);
+    if (ImPlot_BeginPlot("frame time", size, 0)) {
+        // Scaled by the p99 instead of the max, so a single hitch doesn't flatten the plot
+        ImPlot_SetupAxesLimits(0, FRAME_STATS_HISTORY_SIZE, 0, p99_ms * 1.5, ImGuiCond_Always);
+        ImPlot_SetupAxes("frame", "ms", 0, 0);
         ImPlot_PushStyleColor_Vec4(ImPlotCol_Line, plot_color_line);
         ImPlot_PushStyleColor_Vec4(ImPlotCol_Line, plot_color_fill);
         ImPlotAxisFlags axis_flags = ImPlotAxisFlags_NoDecorations | ImPlotAxisFlags_Lock |
                                      ImPlotAxisFlags_NoTickMarks | ImPlotAxisFlags_NoTickLabels;
-        ImPlot_PlotLine_FloatPtrFloatPtr("f(x)", fps_index, fps_buffer, n_samples, axis_flags, 0, 4);
+        ImPlot_PlotLine_FloatPtrFloatPtr("f(x)", history_index, history, n_samples, axis_flags, 0, 4);
         ImPlot_PopStyleColor(2);
 
         ImPlot_EndPlot();
@@ -205,6 +386,17 @@ void gui_update_camera() {
     snprintf(buffer, sizeof(buffer), "fov: %4.2f", camera->zoom);
     igText(buffer);
 
+    igSeparator();
+
+    bool lens_changed = false;
+    lens_changed |= igSliderFloat("Aperture", &camera->aperture, 0.0, 1.0, "%.3f", 0);
+    lens_changed |= igSliderFloat("Focus distance", &camera->focus_distance, 0.1, 50.0, "%.2f", 0);
+
+    if (lens_changed) {
+        update_camera_basis(camera);
+        reset_accumulation();
+    }
+
 #ifdef __SHOW_MVP
     {
         igSeparator();
@@ -233,8 +425,28 @@ void gui_update_camera() {
 void gui_debug() {
     igBegin("Debug", NULL, 0);
 
+    float aspect_ratio = (float)manager->render_width / (float)manager->render_height;
+
     igImage((ImTextureID)(intptr_t)manager->debug_texture, (ImVec2){200 * aspect_ratio, 200}, (ImVec2){0, 1},
             (ImVec2){1, 0}, (ImVec4){1, 1, 1, 1}, (ImVec4){1, 1, 1, 0});
 
+    igSeparator();
+
+    snprintf(buffer, sizeof(buffer), "frames in flight: %d  wait: %.3f ms", FRAMES_IN_FLIGHT,
+             manager->pipeline_wait_time * 1e3);
+    igText(buffer);
+
+    igSeparator();
+
+    snprintf(buffer, sizeof(buffer), "GPU buffers: %.2f KiB", gpu_buffer_total_memory() / 1024.0);
+    igText(buffer);
+
+    for (size_t i = 0; i < gpu_buffer_count(); i++) {
+        gpu_buffer_t *gpu_buffer = gpu_buffer_get(i);
+        snprintf(buffer, sizeof(buffer), "  %-16s %6zu / %6zu  %8.2f KiB", gpu_buffer->name, gpu_buffer->count,
+                 gpu_buffer->capacity, gpu_buffer_memory(gpu_buffer) / 1024.0);
+        igText(buffer);
+    }
+
     igEnd();
 }
@@ -43,10 +43,11 @@ void ImGui_ImplGlfw_NewFrame();
 
 void gui_init();
 void gui_terminate();
-void gui_render();
+void gui_build();
+void gui_draw();
 void gui_new_frame();
 
-void gui_update_fps();
+void gui_update_frame_stats();
 void gui_update_camera();
 void gui_update_scene();
 void gui_debug();
@@ -0,0 +1,335 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// Splits every frame between the GPU and a pool of CPU threads. The screen is
+// cut into raytracer workgroup sized tiles, the CPU takes the last ones in row
+// major order and the GPU the rest, in proportion to how long each took per
+// tile recently. The GPU tiles are dispatched first, so both trace at the same
+// time, and once the CPU is done its tiles are uploaded and composited into
+// the accumulation texture by the raytracer itself, which is what keeps the
+// accumulation and convergence bookkeeping in a single place.
+//
+// The GPU tiles are either one workgroup each, or handed out from a work
+// queue to the persistent threads kernel, which only launches as many
+// workgroups as the GPU runs at once.
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <glad/glad.h>
+
+#include <GLFW/glfw3.h>
+
+#include "cpu_tracer.h"
+#include "frame_pipeline.h"
+#include "gpu_buffer.h"
+#include "hybrid.h"
+#include "manager.h"
+#include "options.h"
+
+static int tiles_x;
+static int tiles_y;
+static int n_tiles;
+
+static uint32_t           cpu_texture;
+static float             *cpu_pixels;
+static gpu_frame_params_t cpu_frame; // What the CPU traces with, the slot in the ring is write only
+static int                first_cpu_tile;
+
+// From GL_NV_shader_thread_group
+#ifndef GL_SM_COUNT_NV
+#define GL_WARP_SIZE_NV    0x9339
+#define GL_WARPS_PER_SM_NV 0x933A
+#define GL_SM_COUNT_NV     0x933B
+#endif
+
+// Persistent threads kernel. The flag is the manager's as of hybrid_prepare,
+// so that it stays the same for the whole frame.
+static gpu_buffer_t *work_queue_buffer;
+static int           persistent_workgroups;
+static bool          persistent_threads;
+
+// Smoothed time to trace one tile, in seconds. Only touched by the render
+// thread, and copied to the manager for the GUI under the lock.
+static float cpu_tile_time;
+static float gpu_tile_time;
+
+// GPU timestamps around the dispatch of the GPU tiles, per frame slot
+static uint32_t timestamp_queries[FRAMES_IN_FLIGHT][2];
+static int      timestamp_tiles[FRAMES_IN_FLIGHT];
+
+// Worker pool. Each frame is split into spans of one tile row.
+static pthread_t      *workers;
+static int             n_workers;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  pool_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  pool_done = PTHREAD_COND_INITIALIZER;
+static uint64_t        pool_generation;
+static int             next_span;
+static int             n_spans;
+static int             busy_workers;
+
+static void trace_span(int span) {
+    int width  = manager->render_width;
+    int height = manager->render_height;
+    int tile   = first_cpu_tile + span / HYBRID_TILE_SIZE;
+    int x0     = (tile % tiles_x) * HYBRID_TILE_SIZE;
+    int x1     = x0 + HYBRID_TILE_SIZE < width ? x0 + HYBRID_TILE_SIZE : width;
+    int y      = (tile / tiles_x) * HYBRID_TILE_SIZE + span % HYBRID_TILE_SIZE;
+
+    // The last row and column of tiles hang over the edge of the image
+    if (y < height)
+        cpu_tracer_trace_span(&cpu_frame, width, height, x0, x1, y, cpu_pixels);
+}
+
+static void *cpu_worker(void *arg) {
+    uint64_t generation = 0;
+
+    pthread_mutex_lock(&pool_lock);
+
+    while (true) {
+        while (pool_generation == generation)
+            pthread_cond_wait(&pool_wake, &pool_lock);
+
+        generation = pool_generation;
+
+        while (next_span < n_spans) {
+            int span = next_span++;
+
+            pthread_mutex_unlock(&pool_lock);
+            trace_span(span);
+            pthread_mutex_lock(&pool_lock);
+        }
+
+        if (--busy_workers == 0)
+            pthread_cond_signal(&pool_done);
+    }
+
+    return NULL;
+}
+
+// The render resolution changed. Never runs while the CPU tiles are traced,
+// hybrid_dispatch waits for them.
+void hybrid_resize() {
+    uint32_t width  = manager->render_width;
+    uint32_t height = manager->render_height;
+
+    tiles_x = (width + HYBRID_TILE_SIZE - 1) / HYBRID_TILE_SIZE;
+    tiles_y = (height + HYBRID_TILE_SIZE - 1) / HYBRID_TILE_SIZE;
+    n_tiles = tiles_x * tiles_y;
+
+    if (cpu_texture != 0)
+        glDeleteTextures(1, &cpu_texture);
+
+    glCreateTextures(GL_TEXTURE_2D, 1, &cpu_texture);
+    glTextureStorage2D(cpu_texture, 1, GL_RGBA32F, width, height);
+    glBindImageTexture(3, cpu_texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+
+    free(cpu_pixels);
+    cpu_pixels     = calloc((size_t)width * height * 4, sizeof(float));
+    first_cpu_tile = n_tiles;
+}
+
+// Enough to fill every SM, the raytracer workgroups are a tile each
+static int count_persistent_workgroups() {
+    if (!glfwExtensionSupported("GL_NV_shader_thread_group"))
+        return HYBRID_PERSISTENT_WORKGROUPS;
+
+    int sm_count, warps_per_sm, warp_size;
+    glGetIntegerv(GL_SM_COUNT_NV, &sm_count);
+    glGetIntegerv(GL_WARPS_PER_SM_NV, &warps_per_sm);
+    glGetIntegerv(GL_WARP_SIZE_NV, &warp_size);
+
+    int per_sm = warps_per_sm * warp_size / (HYBRID_TILE_SIZE * HYBRID_TILE_SIZE);
+
+    return sm_count * (per_sm > 1 ? per_sm : 1);
+}
+
+void init_hybrid() {
+    uint32_t zero = 0;
+
+    hybrid_resize();
+
+    work_queue_buffer = make_gpu_buffer("work queue", GL_SHADER_STORAGE_BUFFER, SSBO_BINDING_WORK_QUEUE,
+                                        sizeof(uint32_t), GPU_BUFFER_DYNAMIC);
+    gpu_buffer_upload(work_queue_buffer, &zero, 1);
+
+    persistent_workgroups = count_persistent_workgroups();
+    printf("persistent threads: %d workgroups\n", persistent_workgroups);
+
+    glGenQueries(FRAMES_IN_FLIGHT * 2, &timestamp_queries[0][0]);
+
+    // Leaves a core for the main and render threads
+    n_workers = options.cpu_threads;
+    if (n_workers == 0)
+        n_workers = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    if (n_workers < 1)
+        n_workers = 1;
+
+    workers = malloc(sizeof(pthread_t) * n_workers);
+
+    for (int i = 0; i < n_workers; i++) {
+        if (pthread_create(&workers[i], NULL, cpu_worker, NULL) != 0) {
+            printf("Failed to start the CPU tracer threads\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    manager->cpu_threads = n_workers;
+}
+
+static void smooth(float *average, float sample) {
+    *average = *average > 0 ? *average + (sample - *average) * HYBRID_SMOOTHING : sample;
+}
+
+// The slot was just waited on by frame_pipeline_begin, so its timestamps are in
+static void collect_gpu_time(int slot) {
+    if (timestamp_tiles[slot] == 0)
+        return;
+
+    uint64_t start, end;
+    glGetQueryObjectui64v(timestamp_queries[slot][0], GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(timestamp_queries[slot][1], GL_QUERY_RESULT, &end);
+
+    smooth(&gpu_tile_time, (end - start) * 1e-9f / timestamp_tiles[slot]);
+    timestamp_tiles[slot] = 0;
+}
+
+// Balanced when both finish together, that is when cpu_tiles * cpu_tile_time
+// equals (n_tiles - cpu_tiles) * gpu_tile_time
+static int balance_cpu_tiles() {
+    // The CPU copy of the scene falls behind when the BVHs are refitted on the GPU
+    if (!manager->hybrid_rendering || manager->animate_scene)
+        return 0;
+
+    // A single tile until there is a measurement for both sides
+    if (cpu_tile_time <= 0 || gpu_tile_time <= 0)
+        return 1;
+
+    float cpu_share = gpu_tile_time / (gpu_tile_time + cpu_tile_time);
+    int   cpu_tiles = lroundf(cpu_share * n_tiles);
+
+    // Always at least one tile each, so that both keep being measured
+    if (cpu_tiles < 1)
+        cpu_tiles = 1;
+    if (cpu_tiles > n_tiles - 1)
+        cpu_tiles = n_tiles - 1;
+
+    return cpu_tiles;
+}
+
+// Runs with the lock held, after the rest of the frame parameters are filled
+void hybrid_prepare(gpu_frame_params_t *params) {
+    collect_gpu_time(frame_pipeline_slot());
+
+    manager->cpu_tiles     = balance_cpu_tiles();
+    manager->cpu_tile_time = cpu_tile_time;
+    manager->gpu_tile_time = gpu_tile_time;
+    first_cpu_tile         = n_tiles - manager->cpu_tiles;
+
+    params->first_cpu_tile = first_cpu_tile;
+    persistent_threads     = manager->persistent_threads && !options.material_sort;
+
+    if (manager->cpu_tiles > 0) {
+        cpu_frame = *params;
+        cpu_tracer_snapshot();
+    }
+}
+
+bool hybrid_persistent_threads() { return persistent_threads; }
+
+static void start_cpu_tiles() {
+    pthread_mutex_lock(&pool_lock);
+    next_span    = 0;
+    n_spans      = (n_tiles - first_cpu_tile) * HYBRID_TILE_SIZE;
+    busy_workers = n_workers;
+    pool_generation++;
+    pthread_cond_broadcast(&pool_wake);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+static void wait_cpu_tiles() {
+    pthread_mutex_lock(&pool_lock);
+    while (busy_workers > 0)
+        pthread_cond_wait(&pool_done, &pool_lock);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+// Takes the place of the raytracer dispatch, between frame_pipeline_begin and
+// frame_pipeline_end. Blocks until the CPU tiles are traced.
+void hybrid_dispatch(compute_t *raytracer) {
+    int    slot      = frame_pipeline_slot();
+    int    gpu_rows  = (first_cpu_tile + tiles_x - 1) / tiles_x;
+    double cpu_start = glfwGetTime();
+
+    if (first_cpu_tile < n_tiles)
+        start_cpu_tiles();
+
+    compute_use(raytracer);
+    compute_set_int(raytracer, "tile_row_offset", 0);
+    compute_set_int(raytracer, "composite_cpu_tiles", 0);
+
+    glQueryCounter(timestamp_queries[slot][0], GL_TIMESTAMP);
+
+    if (persistent_threads) {
+        // Cleared on the GPU, after the last frame is done taking work from it
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        glClearNamedBufferData(work_queue_buffer->id, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+
+        compute_set_int(raytracer, "persistent_threads", 1);
+        compute_set_int(raytracer, "tiles_per_row", tiles_x);
+        glDispatchCompute(persistent_workgroups, 1, 1);
+        compute_set_int(raytracer, "persistent_threads", 0);
+    } else {
+        glDispatchCompute(tiles_x, gpu_rows, 1);
+    }
+
+    glQueryCounter(timestamp_queries[slot][1], GL_TIMESTAMP);
+
+    timestamp_tiles[slot] = first_cpu_tile;
+
+    if (first_cpu_tile == n_tiles)
+        return;
+
+    // Gets the GPU going while this thread waits on the CPU
+    glFlush();
+    wait_cpu_tiles();
+
+    int cpu_tiles = n_tiles - first_cpu_tile;
+    smooth(&cpu_tile_time, (glfwGetTime() - cpu_start) / cpu_tiles);
+
+    int width     = manager->render_width;
+    int first_row = first_cpu_tile / tiles_x;
+    int y0        = first_row * HYBRID_TILE_SIZE;
+    int rows      = tiles_y - first_row;
+    int height    = rows * HYBRID_TILE_SIZE;
+
+    if (y0 + height > (int)manager->render_height)
+        height = manager->render_height - y0;
+
+    glTextureSubImage2D(cpu_texture, 0, 0, y0, width, height, GL_RGBA, GL_FLOAT, &cpu_pixels[(size_t)y0 * width * 4]);
+
+    compute_set_int(raytracer, "tile_row_offset", first_row);
+    compute_set_int(raytracer, "composite_cpu_tiles", 1);
+    glDispatchCompute(tiles_x, rows, 1);
+}
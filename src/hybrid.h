@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef SRC_HYBRID_H_
+#define SRC_HYBRID_H_
+
+#include <stdbool.h>
+
+#include "compute.h"
+#include "gpu_layout.h"
+
+#define HYBRID_TILE_SIZE 32   // Matches the raytracer workgroup
+#define HYBRID_SMOOTHING 0.1f // Weight of the newest measurement of the tile times
+
+// Workgroups launched by the persistent threads kernel when the driver can't
+// tell how many fit on the GPU at once
+#define HYBRID_PERSISTENT_WORKGROUPS 64
+
+void init_hybrid();
+void hybrid_resize();
+void hybrid_prepare(gpu_frame_params_t *params);
+void hybrid_dispatch(compute_t *raytracer);
+bool hybrid_persistent_threads();
+
+#endif // SRC_HYBRID_H_
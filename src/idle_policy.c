@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glad/glad.h>
+
+#include <GLFW/glfw3.h>
+
+#include "frame_pipeline.h"
+#include "frame_stats.h"
+#include "gpu_buffer.h"
+#include "gpu_layout.h"
+#include "hybrid.h"
+#include "idle_policy.h"
+#include "manager.h"
+#include "options.h"
+#include "render_thread.h"
+
+// What each frame parameter slot was last used for, so a convergence value
+// read back later can be matched with the accumulation it measured
+static uint32_t slot_epoch[FRAMES_IN_FLIGHT];
+static uint32_t slot_spp[FRAMES_IN_FLIGHT]; // Samples per pixel before the frame, 0 for the first after a reset
+static bool     slot_used[FRAMES_IN_FLIGHT];
+static uint32_t slot_value[FRAMES_IN_FLIGHT];
+static bool     slot_value_ready[FRAMES_IN_FLIGHT];
+
+static double last_throttled_frame;
+
+void init_idle_policy() {
+    uint32_t zeros[FRAMES_IN_FLIGHT] = {0};
+
+    manager->convergence_buffer = make_gpu_buffer("convergence", GL_SHADER_STORAGE_BUFFER, SSBO_BINDING_CONVERGENCE,
+                                                  sizeof(uint32_t), GPU_BUFFER_DYNAMIC);
+    gpu_buffer_upload(manager->convergence_buffer, zeros, FRAMES_IN_FLIGHT);
+
+    memset(slot_used, 0, sizeof(slot_used));
+    memset(slot_value_ready, 0, sizeof(slot_value_ready));
+}
+
+// Must hold the render state lock
+bool idle_policy_converged() {
+    // Benchmarks always trace every frame
+    if (options.play_path)
+        return false;
+
+    if (manager->reset_accumulation || manager->animate_scene || !manager->incremental_rendering)
+        return false;
+
+    if (manager->target_spp > 0 && manager->accumulated_spp >= manager->target_spp)
+        return true;
+
+    if (manager->noise_threshold > 0 && manager->accumulated_spp >= IDLE_MIN_SPP_FOR_NOISE &&
+        manager->convergence < manager->noise_threshold)
+        return true;
+
+    return false;
+}
+
+// Takes the place of glfwPollEvents in the main loop. Sleeps until something
+// happens once the image has converged, and paces the frames while the window
+// is in the background. Must hold the render state lock.
+void idle_policy_poll_events(GLFWwindow *window) {
+    if (idle_policy_converged()) {
+        manager->idle_state = IDLE_STATE_CONVERGED;
+
+        // Idle frames would only pollute the frame time percentiles
+        frame_stats_discard_tick();
+
+        // Lets the render thread finish the last frame before we sleep with the lock held
+        render_thread_wait_gui();
+        glfwWaitEventsTimeout(IDLE_WAIT_TIMEOUT);
+        return;
+    }
+
+    // A hidden window never has focus
+    bool background = !options.headless && !glfwGetWindowAttrib(window, GLFW_FOCUSED);
+
+    if (manager->throttle_unfocused && !options.play_path && background) {
+        manager->idle_state = IDLE_STATE_THROTTLED;
+
+        double remaining = 1.0 / manager->background_fps - (glfwGetTime() - last_throttled_frame);
+
+        frame_stats_discard_tick();
+        render_thread_wait_gui();
+
+        if (remaining > 0)
+            glfwWaitEventsTimeout(remaining);
+        else
+            glfwPollEvents();
+
+        last_throttled_frame = glfwGetTime();
+        return;
+    }
+
+    manager->idle_state = IDLE_STATE_RENDERING;
+    glfwPollEvents();
+}
+
+// Render thread, after frame_pipeline_begin returned `slot`, so the GPU is
+// done with the frame that last used it and reading it back doesn't stall
+void idle_policy_collect(int slot) {
+    gpu_buffer_t *buffer = manager->convergence_buffer;
+    uint32_t      zero   = 0;
+
+    if (slot_used[slot]) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer->id);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, slot * sizeof(uint32_t), sizeof(uint32_t), &slot_value[slot]);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        slot_value_ready[slot] = true;
+    }
+
+    gpu_buffer_update(buffer, slot, 1, &zero);
+}
+
+// Render thread, with the lock held, for every frame that is traced
+void idle_policy_trace_frame(int slot) {
+    if (slot_value_ready[slot] && slot_epoch[slot] == manager->accumulation_epoch && slot_spp[slot] > 0) {
+        uint32_t n_workgroups = ((manager->render_width + HYBRID_TILE_SIZE - 1) / HYBRID_TILE_SIZE) *
+                                ((manager->render_height + HYBRID_TILE_SIZE - 1) / HYBRID_TILE_SIZE);
+        manager->convergence  = (double)slot_value[slot] / CONVERGENCE_SCALE / n_workgroups;
+    }
+
+    slot_value_ready[slot] = false;
+    slot_used[slot]        = true;
+    slot_epoch[slot]       = manager->accumulation_epoch;
+    slot_spp[slot]         = manager->incremental_rendering ? manager->accumulated_spp : 0;
+
+    if (manager->incremental_rendering) {
+        manager->accumulated_spp += manager->n_samples;
+        manager->accumulated_frames++;
+    } else {
+        manager->accumulated_spp    = manager->n_samples;
+        manager->accumulated_frames = 1;
+    }
+}
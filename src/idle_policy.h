@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef SRC_IDLE_POLICY_H_
+#define SRC_IDLE_POLICY_H_
+
+#include <stdbool.h>
+
+#include <GLFW/glfw3.h>
+
+// How often the GUI is refreshed once the image has converged, in seconds
+#define IDLE_WAIT_TIMEOUT 0.25
+
+// The convergence measure is meaningless for the first few frames after a reset
+#define IDLE_MIN_SPP_FOR_NOISE 64
+
+typedef enum {
+    IDLE_STATE_RENDERING = 0,
+    IDLE_STATE_THROTTLED = 1,
+    IDLE_STATE_CONVERGED = 2,
+} idle_state_t;
+
+void init_idle_policy();
+bool idle_policy_converged();
+void idle_policy_poll_events(GLFWwindow *window);
+void idle_policy_collect(int slot);
+void idle_policy_trace_frame(int slot);
+
+#endif // SRC_IDLE_POLICY_H_
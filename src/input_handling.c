@@ -25,7 +25,7 @@
 #include "camera.h"
 #include "input_handling.h"
 #include "manager.h"
-#include "settings.h"
+#include "rendering.h"
 #include "utils.h"
 
 int firstMouse;
@@ -39,6 +39,7 @@ int f1_key_pressed;
 int f2_key_pressed;
 int f3_key_pressed;
 int f4_key_pressed;
+int f12_key_pressed;
 
 vec3 mouse_world_position;
 
@@ -86,7 +87,7 @@ void mouse_callback(GLFWwindow *window, double xpos, double ypos) {
     update_camera_projection_matrix(manager->camera);
 
     if (xpos != 0 && ypos != 0)
-        glClearTexImage(manager->render_texture, 0, GL_RGBA, GL_FLOAT, NULL);
+        reset_accumulation();
 }
 
 void scroll_callback(GLFWwindow *window, double xoffset, double yoffset) {
@@ -96,11 +97,11 @@ void scroll_callback(GLFWwindow *window, double xoffset, double yoffset) {
     update_camera_fov(manager->camera, xoffset, yoffset);
 }
 
+// The render thread picks the new size up, it owns the GL context and the
+// render targets follow the window unless a resolution was asked for
 void framebuffer_size_callback(GLFWwindow *window, int width, int height) {
-    // FIXME: Should update aspect_ratio and window size
-    glViewport(0, 0, width, height);
-
-    update_camera_projection_matrix(manager->camera);
+    manager->window_width  = width;
+    manager->window_height = height;
 }
 
 void process_input(GLFWwindow *window) {
@@ -118,8 +119,10 @@ void process_input(GLFWwindow *window) {
     }
 
     if (glfwGetKey(window, GLFW_KEY_F3) == GLFW_PRESS) {
-        if (!f3_key_pressed)
+        if (!f3_key_pressed) {
             toggle(&manager->camera->orthographic);
+            reset_accumulation();
+        }
 
         f3_key_pressed = 1;
     } else if (glfwGetKey(window, GLFW_KEY_F3) == GLFW_RELEASE) {
@@ -150,6 +153,15 @@ void process_input(GLFWwindow *window) {
         f2_key_pressed = 0;
     }
 
+    if (glfwGetKey(window, GLFW_KEY_F12) == GLFW_PRESS) {
+        if (!f12_key_pressed)
+            manager->capture_requested = true;
+
+        f12_key_pressed = 1;
+    } else if (glfwGetKey(window, GLFW_KEY_F12) == GLFW_RELEASE) {
+        f12_key_pressed = 0;
+    }
+
     if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS) {
         ctrl_key_pressed = 1;
     } else if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_RELEASE) {
@@ -33,24 +33,142 @@
 
 #include <entropy.h>
 
+#include "animation.h"
+#include "auto_exposure.h"
+#include "benchmark.h"
 #include "camera.h"
+#include "camera_path.h"
+#include "capture.h"
+#include "checkpoint.h"
 #include "compute.h"
+#include "display.h"
+#include "distributed.h"
+#include "frame_pipeline.h"
+#include "frame_stats.h"
 #include "gui.h"
+#include "hybrid.h"
+#include "idle_policy.h"
 #include "input_handling.h"
 #include "manager.h"
+#include "options.h"
+#include "render_targets.h"
+#include "render_thread.h"
 #include "rendering.h"
 #include "scene.h"
 #include "settings.h"
-#include "shader_c.h"
+#include "stream.h"
+#include "tiled.h"
 
 GLFWwindow *window;
 
+// Must hold the render state lock
+static bool job_done() {
+    if (options.worker_address)
+        return worker_job_done();
+
+    if (options.tiled_path)
+        return tiled_tile_done();
+
+    return false;
+}
+
+// With the render thread stopped. Goes around the render loop again if true.
+static bool next_job() {
+    if (options.worker_address)
+        return worker_finish_job();
+
+    if (options.tiled_path)
+        return tiled_finish_tile();
+
+    return false;
+}
+
 int main(int argc, char *argv[]) {
+    parse_options(argc, argv);
+
+    if (options.stream_path)
+        open_stream();
+
+    if (options.merge_output)
+        return run_merge();
+
+    if (options.compare_path)
+        return run_compare();
+
+    uint64_t            seeds[2];
+    checkpoint_header_t job;
+
+    if (options.worker_address) {
+        // The scene is generated from the coordinator's seeds
+        if (!worker_connect(options.worker_address, &job)) {
+            printf("worker: the coordinator has nothing to do\n");
+            return 0;
+        }
+
+        seeds[0] = job.rng_seeds[0];
+        seeds[1] = job.rng_seeds[1];
+    } else if (options.play_path) {
+        // Playback must render the exact same frames on every run
+        seeds[0] = 42;
+        seeds[1] = 54;
+    } else if (options.resume_path) {
+        // Same seeds, same scene
+        checkpoint_header_t header;
+        read_checkpoint_header(options.resume_path, &header);
+        seeds[0] = header.rng_seeds[0];
+        seeds[1] = header.rng_seeds[1];
+    } else {
+        entropy_getbytes((void *)seeds, sizeof(seeds));
+    }
+
+    pcg32_srandom(seeds[0], seeds[1]);
+
+    {
+        manager               = init_manager();
+        manager->rng_seeds[0] = seeds[0];
+        manager->rng_seeds[1] = seeds[1];
+
+        manager->hybrid_rendering   = options.hybrid;
+        manager->auto_exposure      = options.auto_exposure;
+        manager->persistent_threads = options.persistent_threads && !options.compare_kernels;
+
+        // Tiled renders size the render targets like a tile instead, see init_tiled
+        if (!options.tiled_path) {
+            manager->requested_width  = options.render_width;
+            manager->requested_height = options.render_height;
+        }
+
+        if (options.samples)
+            manager->n_samples = options.samples;
+
+        Camera *camera = make_camera();
+        Manager_set_camera(manager, camera);
+
+        camera->camera_pos[0] = camera_pos[0];
+        camera->camera_pos[1] = camera_pos[1];
+        camera->camera_pos[2] = camera_pos[2];
+
+        camera->pitch = camera_orientation[0];
+        camera->yaw   = camera_orientation[1];
+        camera->zoom  = camera_orientation[2];
+
+        update_camera_target(camera, 0, 0);
+        update_camera_position_matrix(camera);
+    }
+
+    init_scene();
+
+    if (options.coordinate_port)
+        return run_coordinator();
+
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
+    if (options.headless)
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
     window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "Raytracing for fun and fun", NULL, NULL);
     if (window == NULL) {
         printf("Failed to create GLFW window\n");
@@ -66,7 +184,13 @@ int main(int argc, char *argv[]) {
         return -1;
     }
 
-    glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+    int framebuffer_width, framebuffer_height;
+    glfwGetFramebufferSize(window, &framebuffer_width, &framebuffer_height);
+
+    manager->window_width  = framebuffer_width;
+    manager->window_height = framebuffer_height;
+
+    glViewport(0, 0, framebuffer_width, framebuffer_height);
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetScrollCallback(window, scroll_callback);
@@ -104,106 +228,50 @@ int main(int argc, char *argv[]) {
     glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &work_grp_inv);
     printf("max local work group invocations %i\n", work_grp_inv);
 
-    {
-        uint64_t seeds[2];
-        entropy_getbytes((void *)seeds, sizeof(seeds));
-        pcg32_srandom(seeds[0], seeds[1]);
-    }
-
-    {
-        gui_init();
-        manager        = init_manager();
-        Camera *camera = make_camera();
-        Manager_set_camera(manager, camera);
-
-        camera->camera_pos[0] = camera_pos[0];
-        camera->camera_pos[1] = camera_pos[1];
-        camera->camera_pos[2] = camera_pos[2];
+    gui_init();
 
-        camera->pitch = camera_orientation[0];
-        camera->yaw   = camera_orientation[1];
-        camera->zoom  = camera_orientation[2];
-
-        update_camera_target(camera, 0, 0);
-        update_camera_position_matrix(camera);
-    }
-
-    init_scene();
+    // Render targets, their formats are needed to build the shaders
+    init_render_targets();
 
     // Shaders
-    Shader *shader = newShader("shaders/main.vert", "shaders/main.frag", NULL);
-    Shader_use(shader);
-    Shader_set_int(shader, "tex", 0);
+    char raytracer_header[256];
+    snprintf(raytracer_header, sizeof(raytracer_header), "%s#define MATERIAL_SORT %d\n",
+             render_targets_shader_header(), options.material_sort);
 
-    compute_t *compute_shader = build_compute_shader("shaders/raytracer.comp");
+    compute_t *compute_shader = build_compute_shader_with_header("shaders/raytracer.comp", raytracer_header);
     compute_use(compute_shader);
     compute_set_float(compute_shader, "near_plane", near_plane);
     compute_set_float(compute_shader, "far_plane", far_plane);
-    compute_set_int(compute_shader, "n_spheres", n_spheres);
-    compute_set_int(compute_shader, "n_triangles", n_triangles);
-
-    // Quad
-    unsigned int VAO;
-    unsigned int VBO;
-    float        quadVertices[] = {
-        // positions        // texture Coords
-        -1.0f, +1.0f, 0.0f, 0.0f, 1.0f, //
-        -1.0f, -1.0f, 0.0f, 0.0f, 0.0f, //
-        +1.0f, +1.0f, 0.0f, 1.0f, 1.0f, //
-        +1.0f, -1.0f, 0.0f, 1.0f, 0.0f, //
-    };
-
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glBindVertexArray(VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)(3 * sizeof(float)));
 
     // SSBOs
-    // Spheres
-    set_shader_storage_buffer(10, n_spheres * sizeof(float) * 4, positions);
-    set_shader_storage_buffer(11, n_spheres * sizeof(float), radius);
-    set_shader_storage_buffer(12, n_spheres * sizeof(int), material_type);
-    set_shader_storage_buffer(13, n_spheres * sizeof(float) * 4, albedo);
-    set_shader_storage_buffer(14, n_spheres * sizeof(float) * 4, emission);
-    set_shader_storage_buffer(15, n_spheres * sizeof(float), roughness);
-    // Triangles
-    set_shader_storage_buffer(20, n_triangles * sizeof(float) * 4, triangle_v0);
-    set_shader_storage_buffer(21, n_triangles * sizeof(float) * 4, triangle_v1);
-    set_shader_storage_buffer(22, n_triangles * sizeof(float) * 4, triangle_v2);
-    set_shader_storage_buffer(23, n_triangles * sizeof(float) * 4, triangle_albedo);
-    set_shader_storage_buffer(24, n_triangles * sizeof(float) * 4, triangle_emission);
-
-    // Compute texture
-    const unsigned int TEXTURE_WIDTH  = WINDOW_WIDTH;
-    const unsigned int TEXTURE_HEIGHT = WINDOW_HEIGHT;
-
-    glGenTextures(1, &manager->render_texture);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, manager->render_texture);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, TEXTURE_WIDTH, TEXTURE_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
-    glBindImageTexture(0, manager->render_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, manager->render_texture);
-
-    glGenTextures(1, &manager->debug_texture);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, manager->debug_texture);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, TEXTURE_WIDTH, TEXTURE_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
-    glBindImageTexture(1, manager->debug_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+    init_scene_buffers();
+    init_animation();
+    init_benchmark();
+    init_frame_stats();
+    init_frame_pipeline();
+    init_idle_policy();
+    init_hybrid();
+    init_auto_exposure();
+    init_display();
+    init_capture();
+
+    // Camera paths
+    camera_path_t *recording      = NULL;
+    camera_path_t *playback       = NULL;
+    size_t         playback_frame = 0;
+
+    if (options.record_path)
+        recording = make_camera_path();
+
+    if (options.play_path) {
+        playback = load_camera_path(options.play_path);
+
+        manager->freeze_movement = true;
+        manager->fixed_timestep  = CAMERA_PATH_TIMESTEP;
+
+        start_benchmark();
+        printf("playing %zu frames from %s\n", playback->count, options.play_path);
+    }
 
 #if 0
     {
@@ -228,65 +296,103 @@ int main(int argc, char *argv[]) {
     }
 #endif
 
+    if (options.resume_path)
+        resume_from_checkpoint(options.resume_path);
+
+    if (options.worker_address)
+        worker_start_job();
+
+    if (options.tiled_path)
+        init_tiled();
+
+    // Streams keep the resolution they start with
+    if (options.stream_path)
+        init_stream();
+
+    init_checkpoint();
+
     printf("starting render loop\n");
 
-    while (!glfwWindowShouldClose(window)) {
-        // Process input
-        glfwPollEvents();
-        process_input(window);
+    // Workers go around once per job, tiled renders once per tile
+    do {
+        start_render_thread(compute_shader);
+
+        // Only released while waiting on the render thread, and between frames
+        lock_render_state();
+
+        while (!glfwWindowShouldClose(window)) {
+            if (job_done())
+                break;
+
+            // Process input
+            idle_policy_poll_events(window);
+            process_input(window);
+
+            if (playback) {
+                // Comparisons go around again with the other kernel
+                if (playback_frame == playback->count && options.compare_kernels && !manager->persistent_threads) {
+                    printf("playing again with the persistent threads kernel\n");
+                    manager->persistent_threads = true;
+                    playback_frame              = 0;
+                    reset_accumulation();
+                }
+
+                if (playback_frame == playback->count) {
+                    glfwSetWindowShouldClose(window, true);
+                    break;
+                }
+
+                camera_path_apply(playback, playback_frame++, manager->camera);
+
+                // Every streamed frame gets exactly the samples of one frame
+                if (options.stream_path)
+                    reset_accumulation();
+            }
 
-        // Timer
-        Manager_tick_timer(manager);
+            if (recording)
+                camera_path_record(recording, manager->camera);
 
-        if (manager->frame_count % 1000 == 0) {
-            printf("fps: %f\n", 1.0f / manager->delta_time);
+            // Timer
+            Manager_tick_timer(manager);
+            frame_stats_tick();
+
+            if (manager->frame_count % 1000 == 0) {
+                printf("frame time: mean %.3f ms  p99 %.3f ms\n", frame_stats_mean() * 1e-6,
+                       frame_stats_percentile(99) * 1e-6);
+            }
+
+            // Also keeps the main thread at most one frame ahead of the render thread
+            render_thread_wait_gui();
+
+            if (!options.headless)
+                gui_build();
+
+            render_thread_submit_frame();
+
+            unlock_render_state();
+            lock_render_state();
         }
 
-        // Run compute shader
-        compute_use(compute_shader);
-        compute_set_float(compute_shader, "time", manager->current_time);
-        compute_set_matrix4(compute_shader, "camera_view", &manager->camera->view);
-        compute_set_bool(compute_shader, "orthographic", manager->camera->orthographic);
-        compute_set_bool(compute_shader, "incremental_rendering", manager->incremental_rendering);
-        compute_set_int(compute_shader, "rng_seed", pcg32_random());
-        compute_set_int(compute_shader, "n_samples", manager->n_samples);
-        compute_set_int(compute_shader, "n_bounces", manager->n_bounces);
-
-        compute_set_vec3(compute_shader, "look_from", &manager->camera->camera_pos);
-        compute_set_vec3(compute_shader, "look_at", &manager->camera->camera_target);
-        compute_set_float(compute_shader, "vfov", manager->camera->zoom);
-        compute_set_float(compute_shader, "yaw", manager->camera->yaw);
-        compute_set_float(compute_shader, "pitch", manager->camera->pitch);
-
-        vec3 black = {0.0f, 0.0f, 0.0f};
-        vec3 white = {1.0f, 1.0f, 1.0f};
-        if (manager->ambient_light)
-            compute_set_vec3(compute_shader, "ambient_light", &white);
-        else
-            compute_set_vec3(compute_shader, "ambient_light", &black);
-
-        glDispatchCompute(TEXTURE_WIDTH / 32, TEXTURE_HEIGHT / 32, 1);
-        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-
-        // Main pass
-        glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-        // Clear screen
-        glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        Shader_use(shader);
-        Shader_set_int(shader, "tone_mapping_mode", manager->tone_mapping_mode);
-        Shader_set_float(shader, "exposure", manager->exposure);
-        glBindVertexArray(VAO);
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-        glBindVertexArray(0);
-
-        // Render gui
-        gui_render();
-
-        // Draw to screen
-        glfwSwapBuffers(window);
+        unlock_render_state();
+        stop_render_thread();
+    } while (!glfwWindowShouldClose(window) && next_job());
+
+    checkpoint_finish();
+    capture_finish();
+    stream_finish();
+
+    if (playback) {
+        benchmark_finish();
+        benchmark_report(options.report_path);
+        destroy_camera_path(playback);
+    }
+
+    if (options.stats_path)
+        frame_stats_dump(options.stats_path);
+
+    if (recording) {
+        save_camera_path(recording, options.record_path);
+        destroy_camera_path(recording);
     }
 
     gui_terminate();
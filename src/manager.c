@@ -23,6 +23,7 @@
 #include <GLFW/glfw3.h>
 
 #include "manager.h"
+#include "settings.h"
 
 Manager *manager;
 
@@ -35,16 +36,35 @@ Manager *init_manager() {
     _manager->ambient_light         = true;
     _manager->tone_mapping_mode     = 6; // Uchimura
 
-    _manager->n_samples = 10;
-    _manager->n_bounces = 5;
+    _manager->n_samples      = 10;
+    _manager->n_bounces      = 5;
+    _manager->roulette_depth = 3;
+
+    _manager->window_width  = WINDOW_WIDTH;
+    _manager->window_height = WINDOW_HEIGHT;
+    _manager->render_width  = WINDOW_WIDTH;
+    _manager->render_height = WINDOW_HEIGHT;
 
     _manager->exposure = 0.75f;
+    _manager->wide_bvh = true;
+
+    _manager->bvh_update_mode       = 1; // Refit on the CPU
+    _manager->bvh_rebuild_threshold = 1.25f;
+
+    _manager->target_spp         = 4096;
+    _manager->noise_threshold    = 0.0f;
+    _manager->throttle_unfocused = true;
+    _manager->background_fps     = 5.0f;
+    _manager->convergence        = 1.0f;
 
     return _manager;
 }
 
 void Manager_tick_timer(Manager *manager) {
-    manager->current_time = glfwGetTime();
+    if (manager->fixed_timestep > 0)
+        manager->current_time = manager->frame_count * manager->fixed_timestep;
+    else
+        manager->current_time = glfwGetTime();
 
     manager->last_frame_time    = manager->current_frame_time;
     manager->current_frame_time = manager->current_time;
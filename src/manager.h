@@ -22,6 +22,7 @@
 #include <stdint.h>
 
 #include "camera.h"
+#include "gpu_buffer.h"
 
 typedef struct {
     /////////////////
@@ -32,6 +33,7 @@ typedef struct {
     float    current_frame_time;
     float    last_frame_time;
     uint64_t frame_count;
+    float    fixed_timestep; // When non zero time advances by this much every frame, regardless of the wall clock
 
     /////////////////
     // Rendering
@@ -44,7 +46,93 @@ typedef struct {
     bool     ambient_light;
     uint32_t n_samples;
     uint32_t n_bounces;
-    float    exposure;
+    uint32_t roulette_depth; // Paths may be cut short after this many bounces, see trace_pixel
+    float    exposure;       // A compensation on top of the automatic one when auto_exposure is on
+    bool     auto_exposure;
+    bool     wide_bvh;
+    bool     reset_accumulation; // Consumed by the render thread, see reset_accumulation()
+
+    /////////////////
+    // Resolution
+    //
+    uint32_t window_width;    // Framebuffer of the window, the image is scaled to fit it
+    uint32_t window_height;
+    uint32_t render_width;    // Size of the render targets, only changed by the render thread
+    uint32_t render_height;
+    uint32_t requested_width; // Render resolution to switch to, 0 to follow the window
+    uint32_t requested_height;
+
+    /////////////////
+    // GPU buffers
+    //
+    gpu_buffer_t *materials_buffer;
+    gpu_buffer_t *spheres_buffer;
+    gpu_buffer_t *triangles_buffer;
+    gpu_buffer_t *quads_buffer;
+    gpu_buffer_t *boxes_buffer;
+    gpu_buffer_t *planes_buffer;
+    gpu_buffer_t *blas_nodes_buffer;
+    gpu_buffer_t *blas4_nodes_buffer;
+    gpu_buffer_t *tlas_nodes_buffer;
+    gpu_buffer_t *instances_buffer;
+    gpu_buffer_t *refit_order_buffer;
+    gpu_buffer_t *bvh_stats_buffer;
+    gpu_buffer_t *ray_counter_buffer;
+    gpu_buffer_t *frame_params_buffer;
+    gpu_buffer_t *convergence_buffer;
+    gpu_buffer_t *checkpoint_buffer;
+
+    /////////////////
+    // Frame pipeline
+    //
+    float pipeline_wait_time; // Time the render thread waited on the oldest frame in flight, in seconds
+
+    /////////////////
+    // Animation
+    //
+    bool     animate_scene;
+    uint32_t bvh_update_mode;
+    float    bvh_rebuild_threshold;
+    float    bvh_update_time; // CPU side, in seconds
+    uint32_t n_bvh_rebuilds;
+
+    /////////////////
+    // Idle policy
+    //
+    uint32_t target_spp;         // Stop tracing after this many samples per pixel, 0 to never stop
+    float    noise_threshold;    // Stop tracing once a frame changes the image by less than this, 0 to disable
+    bool     throttle_unfocused; // Trace at background_fps while the window is not focused
+    float    background_fps;
+    uint32_t accumulated_spp;    // Since the last accumulation reset
+    uint32_t accumulated_frames; // Since the last accumulation reset, including the one being traced
+    uint32_t accumulation_epoch; // Bumped on every accumulation reset
+    float    convergence;        // Mean relative change of the image in the last measured frame
+    uint32_t idle_state;         // One of idle_state_t
+
+    /////////////////
+    // Hybrid rendering
+    //
+    bool     hybrid_rendering;   // Trace part of every frame on the CPU, see hybrid.c
+    bool     persistent_threads; // Trace the GPU tiles with the persistent threads kernel
+    uint32_t cpu_threads;
+    uint32_t cpu_tiles;     // Given to the CPU in the last frame
+    float    cpu_tile_time; // Smoothed time to trace one tile, in seconds
+    float    gpu_tile_time;
+
+    /////////////////
+    // Capture
+    //
+    bool     capture_requested; // Consumed by the render thread, see capture.c
+    uint32_t capture_format;    // One of capture_format_t
+    uint32_t n_captures;        // Images written so far
+    uint32_t n_streamed_frames; // Written to --stream so far
+    uint32_t n_dropped_frames;  // Dropped by the stream while the consumer was behind
+
+    /////////////////
+    // Random numbers
+    //
+    uint64_t rng_seeds[2];    // Seeds the scene generation, and together with the frame index, every frame
+    uint64_t rng_frame_index; // Frames traced so far, only ever goes up
 
     /////////////////
     // Movement
@@ -0,0 +1,375 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture.h"
+#include "distributed.h"
+#include "gpu_layout.h"
+#include "options.h"
+#include "stream.h"
+#include "tiled.h"
+
+options_t options;
+
+#define DEFAULT_CHECKPOINT_INTERVAL 60.0
+
+static void print_usage(const char *program) {
+    printf("usage: %s [options]\n", program);
+    printf("  --record <file>       record the camera path to <file>\n");
+    printf("  --play <file>         play back the camera path in <file> and report frame statistics\n");
+    printf("  --report <file>       write per frame timings of the playback to <file>, as csv\n");
+    printf("  --frame-stats <file>  write frame time statistics to <file> at exit, as json\n");
+    printf("  --checkpoint <file>   periodically save the accumulated image to <file>\n");
+    printf("  --checkpoint-interval <seconds>\n");
+    printf("                        time between checkpoints, defaults to %.0f\n", DEFAULT_CHECKPOINT_INTERVAL);
+    printf("  --resume <file>       continue accumulating from a checkpoint, and keep checkpointing to it\n");
+    printf("  --headless            render without showing a window, requires --play\n");
+    printf("  --hybrid              trace part of every frame on the CPU\n");
+    printf("  --auto-exposure       adapt the exposure to the image, the exposure slider becomes a compensation\n");
+    printf("  --cpu-threads <n>     threads tracing on the CPU, defaults to one less than the cores\n");
+    printf("  --sequence <pattern>  capture every traced frame to a file named by the printf <pattern>, which\n");
+    printf("                        takes the frame number. The extension picks png, exr or pfm\n");
+    printf("  --samples <n>         samples per pixel traced every frame\n");
+    printf("  --resolution <width>x<height>\n");
+    printf("                        render at this resolution instead of the size of the window, which only\n");
+    printf("                        shows it scaled to fit. Can be far larger than the screen, like 7680x4320\n");
+    printf("  --accumulation-format <rgba32f|rgba16f|r11g11b10f>\n");
+    printf("                        precision of the accumulated image, defaults to rgba32f\n");
+    printf("  --normal-format <rgba32f|oct16>\n");
+    printf("                        full float normals, or octahedral 16 bit ones, defaults to rgba32f\n");
+    printf("  --compare <reference> <checkpoint>\n");
+    printf("                        report the error of <checkpoint> against <reference>, like a render in a\n");
+    printf("                        reduced --accumulation-format against a rgba32f one\n");
+    printf("  --material-sort       sort the paths of every workgroup by material before shading them, so that\n");
+    printf("                        neighbouring threads run the same shading code\n");
+    printf("  --persistent-threads  trace with as many workgroups as the GPU runs at once, taking pixels from a\n");
+    printf("                        work queue, instead of one workgroup per tile\n");
+    printf("  --compare-kernels     play the --play camera path once with each kernel, and report both\n");
+    printf("  --stream <file>       write every traced frame to <file> as video, - for stdout. Everything else\n");
+    printf("                        printed goes to stderr then\n");
+    printf("  --stream-format <y4m|rgba>\n");
+    printf("                        YUV4MPEG2 or raw 8 bit rgba frames, defaults to y4m\n");
+    printf("  --stream-policy <block|drop>\n");
+    printf("                        wait for the consumer or drop frames when it falls behind, defaults to block\n");
+    printf("  --stream-queue <n>    frames in flight before the policy kicks in, defaults to %d\n",
+           STREAM_DEFAULT_QUEUE);
+    printf("  --stream-fps <n>      frame rate in the y4m header, defaults to %d\n", STREAM_DEFAULT_FPS);
+    printf("  --tiled <file.pfm>    render the --resolution image with --spp samples per pixel a tile at a time,\n");
+    printf("                        without showing a window, writing finished tiles into <file>. For images\n");
+    printf("                        too large for the GPU, or that would take too long in a single dispatch\n");
+    printf("  --tile-size <n>       largest tile side with --tiled, defaults to %d\n", TILED_DEFAULT_TILE_SIZE);
+    printf("  --tile-budget <ms>    longest a dispatch should take with --tiled, defaults to %.0f\n",
+           TILED_DEFAULT_BUDGET);
+    printf("  --coordinate <port>   split --spp samples into jobs for workers connecting to <port>, and write\n");
+    printf("                        the merged image to --output, as a checkpoint\n");
+    printf("  --spp <n>             samples per pixel the coordinator renders, or of every tile with --tiled\n");
+    printf("  --job-spp <n>         samples per pixel of each job, defaults to %d\n", DISTRIBUTED_JOB_SPP);
+    printf("  --output <file>       where the coordinator writes the merged image\n");
+    printf("  --worker <host:port>  render jobs from a coordinator without showing a window\n");
+    printf("  --merge <output> <checkpoint>...\n");
+    printf("                        merge checkpoints of the same scene into <output>. The inputs must come\n");
+    printf("                        from different frame ranges, like the ones a coordinator writes\n");
+    printf("  --help                show this message\n");
+}
+
+static const char *option_argument(int argc, char *argv[], int *i) {
+    if (*i + 1 >= argc) {
+        printf("missing argument for %s\n", argv[*i]);
+        print_usage(argv[0]);
+        exit(1);
+    }
+
+    return argv[++(*i)];
+}
+
+// The pattern is used as a printf format with the frame number, so it must
+// hold exactly one integer conversion, like %d or %05d, and no other % but %%
+static bool valid_sequence_pattern(const char *pattern) {
+    int n_conversions = 0;
+
+    for (const char *c = pattern; *c; c++) {
+        if (*c != '%')
+            continue;
+
+        if (*++c == '%')
+            continue;
+
+        c += strspn(c, "-+ #0");
+        c += strspn(c, "0123456789");
+
+        if (*c != 'd' && *c != 'i' && *c != 'u')
+            return false;
+
+        n_conversions++;
+    }
+
+    return n_conversions == 1;
+}
+
+void parse_options(int argc, char *argv[]) {
+    memset(&options, 0, sizeof(options_t));
+
+    options.checkpoint_interval = DEFAULT_CHECKPOINT_INTERVAL;
+    options.job_spp             = DISTRIBUTED_JOB_SPP;
+    options.stream_queue        = STREAM_DEFAULT_QUEUE;
+    options.stream_fps          = STREAM_DEFAULT_FPS;
+    options.tile_size           = TILED_DEFAULT_TILE_SIZE;
+    options.tile_budget         = TILED_DEFAULT_BUDGET;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--record") == 0) {
+            options.record_path = option_argument(argc, argv, &i);
+        } else if (strcmp(argv[i], "--play") == 0) {
+            options.play_path = option_argument(argc, argv, &i);
+        } else if (strcmp(argv[i], "--report") == 0) {
+            options.report_path = option_argument(argc, argv, &i);
+        } else if (strcmp(argv[i], "--frame-stats") == 0) {
+            options.stats_path = option_argument(argc, argv, &i);
+        } else if (strcmp(argv[i], "--checkpoint") == 0) {
+            options.checkpoint_path = option_argument(argc, argv, &i);
+        } else if (strcmp(argv[i], "--checkpoint-interval") == 0) {
+            options.checkpoint_interval = atof(option_argument(argc, argv, &i));
+        } else if (strcmp(argv[i], "--resume") == 0) {
+            options.resume_path = option_argument(argc, argv, &i);
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            options.headless = true;
+        } else if (strcmp(argv[i], "--hybrid") == 0) {
+            options.hybrid = true;
+        } else if (strcmp(argv[i], "--auto-exposure") == 0) {
+            options.auto_exposure = true;
+        } else if (strcmp(argv[i], "--cpu-threads") == 0) {
+            options.cpu_threads = atoi(option_argument(argc, argv, &i));
+        } else if (strcmp(argv[i], "--sequence") == 0) {
+            options.sequence_pattern = option_argument(argc, argv, &i);
+        } else if (strcmp(argv[i], "--samples") == 0) {
+            options.samples = strtoul(option_argument(argc, argv, &i), NULL, 10);
+        } else if (strcmp(argv[i], "--resolution") == 0) {
+            const char *resolution = option_argument(argc, argv, &i);
+
+            if (sscanf(resolution, "%ux%u", &options.render_width, &options.render_height) != 2 ||
+                options.render_width == 0 || options.render_height == 0) {
+                printf("invalid resolution %s, expected <width>x<height>\n", resolution);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--accumulation-format") == 0) {
+            const char *format = option_argument(argc, argv, &i);
+
+            if (strcmp(format, "rgba32f") == 0) {
+                options.accumulation_format = ACCUMULATION_RGBA32F;
+            } else if (strcmp(format, "rgba16f") == 0) {
+                options.accumulation_format = ACCUMULATION_RGBA16F;
+            } else if (strcmp(format, "r11g11b10f") == 0) {
+                options.accumulation_format = ACCUMULATION_R11G11B10F;
+            } else {
+                printf("unknown accumulation format %s\n", format);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--normal-format") == 0) {
+            const char *format = option_argument(argc, argv, &i);
+
+            if (strcmp(format, "rgba32f") == 0) {
+                options.normal_format = NORMALS_RGBA32F;
+            } else if (strcmp(format, "oct16") == 0) {
+                options.normal_format = NORMALS_OCT16;
+            } else {
+                printf("unknown normal format %s\n", format);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--compare") == 0) {
+            options.compare_reference = option_argument(argc, argv, &i);
+            options.compare_path      = option_argument(argc, argv, &i);
+        } else if (strcmp(argv[i], "--material-sort") == 0) {
+            options.material_sort = true;
+        } else if (strcmp(argv[i], "--persistent-threads") == 0) {
+            options.persistent_threads = true;
+        } else if (strcmp(argv[i], "--compare-kernels") == 0) {
+            options.compare_kernels = true;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            options.stream_path = option_argument(argc, argv, &i);
+        } else if (strcmp(argv[i], "--stream-format") == 0) {
+            const char *format = option_argument(argc, argv, &i);
+
+            if (strcmp(format, "y4m") == 0) {
+                options.stream_format = STREAM_Y4M;
+            } else if (strcmp(format, "rgba") == 0) {
+                options.stream_format = STREAM_RGBA;
+            } else {
+                printf("unknown stream format %s\n", format);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--stream-policy") == 0) {
+            const char *policy = option_argument(argc, argv, &i);
+
+            if (strcmp(policy, "block") == 0) {
+                options.stream_policy = STREAM_BLOCK;
+            } else if (strcmp(policy, "drop") == 0) {
+                options.stream_policy = STREAM_DROP;
+            } else {
+                printf("unknown stream policy %s\n", policy);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--stream-queue") == 0) {
+            options.stream_queue = atoi(option_argument(argc, argv, &i));
+        } else if (strcmp(argv[i], "--stream-fps") == 0) {
+            options.stream_fps = atoi(option_argument(argc, argv, &i));
+        } else if (strcmp(argv[i], "--tiled") == 0) {
+            options.tiled_path = option_argument(argc, argv, &i);
+        } else if (strcmp(argv[i], "--tile-size") == 0) {
+            options.tile_size = strtoul(option_argument(argc, argv, &i), NULL, 10);
+        } else if (strcmp(argv[i], "--tile-budget") == 0) {
+            options.tile_budget = atof(option_argument(argc, argv, &i));
+        } else if (strcmp(argv[i], "--coordinate") == 0) {
+            options.coordinate_port = atoi(option_argument(argc, argv, &i));
+        } else if (strcmp(argv[i], "--spp") == 0) {
+            options.spp = strtoul(option_argument(argc, argv, &i), NULL, 10);
+        } else if (strcmp(argv[i], "--job-spp") == 0) {
+            options.job_spp = strtoul(option_argument(argc, argv, &i), NULL, 10);
+        } else if (strcmp(argv[i], "--output") == 0) {
+            options.output_path = option_argument(argc, argv, &i);
+        } else if (strcmp(argv[i], "--worker") == 0) {
+            options.worker_address = option_argument(argc, argv, &i);
+        } else if (strcmp(argv[i], "--merge") == 0) {
+            options.merge_output   = option_argument(argc, argv, &i);
+            options.merge_inputs   = (const char **)&argv[i + 1];
+            options.n_merge_inputs = argc - i - 1;
+            break;
+        } else if (strcmp(argv[i], "--help") == 0) {
+            print_usage(argv[0]);
+            exit(0);
+        } else {
+            printf("unknown option %s\n", argv[i]);
+            print_usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    if ((options.headless || options.report_path) && options.play_path == NULL) {
+        printf("--headless and --report need a camera path to play with --play\n");
+        exit(1);
+    }
+
+    if (options.record_path && options.play_path) {
+        printf("--record and --play can't be used together\n");
+        exit(1);
+    }
+
+    if (options.play_path && (options.resume_path || options.checkpoint_path)) {
+        printf("--play can't be used with --resume or --checkpoint\n");
+        exit(1);
+    }
+
+    if (options.compare_kernels && options.play_path == NULL) {
+        printf("--compare-kernels needs a camera path to play with --play\n");
+        exit(1);
+    }
+
+    if (options.material_sort && (options.persistent_threads || options.compare_kernels)) {
+        printf("--material-sort can't be used with --persistent-threads or --compare-kernels\n");
+        exit(1);
+    }
+
+    if (options.checkpoint_interval <= 0) {
+        printf("--checkpoint-interval must be positive\n");
+        exit(1);
+    }
+
+    if (options.resume_path && options.checkpoint_path == NULL)
+        options.checkpoint_path = options.resume_path;
+
+    if (options.cpu_threads < 0) {
+        printf("--cpu-threads can't be negative\n");
+        exit(1);
+    }
+
+    capture_format_t format;
+
+    if (options.sequence_pattern && !capture_format_from_path(options.sequence_pattern, &format)) {
+        printf("--sequence needs a .png, .exr or .pfm extension\n");
+        exit(1);
+    }
+
+    if (options.sequence_pattern && !valid_sequence_pattern(options.sequence_pattern)) {
+        printf("--sequence needs exactly one integer conversion for the frame number, like %%d or %%05d\n");
+        exit(1);
+    }
+
+    if (options.stream_path && (options.coordinate_port || options.merge_output || options.worker_address)) {
+        printf("--stream can't be used with --coordinate, --worker or --merge\n");
+        exit(1);
+    }
+
+    if (options.stream_queue < 1 || options.stream_fps < 1) {
+        printf("--stream-queue and --stream-fps must be positive\n");
+        exit(1);
+    }
+
+    if (options.merge_output && options.n_merge_inputs == 0) {
+        printf("--merge needs at least one checkpoint to merge\n");
+        exit(1);
+    }
+
+    if (options.coordinate_port) {
+        if (options.coordinate_port < 0 || options.coordinate_port > 65535 || options.spp == 0 ||
+            options.job_spp == 0 || options.output_path == NULL) {
+            printf("--coordinate needs a valid port, --spp, --job-spp and --output\n");
+            exit(1);
+        }
+
+        // The coordinator only reads the checkpoint it was started from
+        if (options.checkpoint_path == options.resume_path)
+            options.checkpoint_path = NULL;
+    }
+
+    if (options.tiled_path) {
+        if (options.render_width == 0 || options.spp == 0 || options.tile_size == 0 || options.tile_budget <= 0) {
+            printf("--tiled needs --resolution, --spp, and a positive --tile-size and --tile-budget\n");
+            exit(1);
+        }
+
+        const char *extension = strrchr(options.tiled_path, '.');
+
+        if (extension == NULL || strcmp(extension, ".pfm") != 0) {
+            printf("--tiled writes a .pfm\n");
+            exit(1);
+        }
+
+        if (options.play_path || options.record_path || options.resume_path || options.checkpoint_path ||
+            options.sequence_pattern || options.stream_path || options.hybrid || options.worker_address ||
+            options.coordinate_port || options.merge_output) {
+            printf("--tiled only renders a single image, it can't be used with --play, --record, --resume,\n"
+                   "--checkpoint, --sequence, --stream, --hybrid, --worker, --coordinate or --merge\n");
+            exit(1);
+        }
+
+        options.headless = true;
+    }
+
+    if (options.worker_address) {
+        if (options.coordinate_port || options.play_path || options.record_path || options.resume_path ||
+            options.checkpoint_path) {
+            printf("--worker can't be used with --coordinate, --play, --record, --resume or --checkpoint\n");
+            exit(1);
+        }
+
+        options.headless = true;
+    }
+}
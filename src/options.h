@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef SRC_OPTIONS_H_
+#define SRC_OPTIONS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    const char *record_path;         // Camera path to record to, written at exit
+    const char *play_path;           // Camera path to play back as a benchmark
+    const char *report_path;         // Per frame timings of the playback, as csv
+    const char *stats_path;          // Frame time statistics, as json, written at exit
+    const char *checkpoint_path;     // Accumulation checkpoints are written here periodically
+    const char *resume_path;         // Checkpoint to continue accumulating from
+    float       checkpoint_interval; // Seconds between checkpoints
+    bool        headless;            // Hidden window, no GUI, exits at the end of the playback
+    bool        hybrid;              // Start with hybrid CPU and GPU rendering on
+    bool        auto_exposure;       // Start with automatic exposure on
+    int         cpu_threads;         // Threads tracing the CPU tiles, 0 for one less than the cores
+    const char *sequence_pattern;    // Capture every traced frame, printf pattern taking the frame number
+    uint32_t    samples;             // Samples per pixel traced every frame, 0 for the default
+    uint32_t    render_width;        // Fixed render resolution, 0 to follow the window
+    uint32_t    render_height;
+    uint32_t    accumulation_format; // One of ACCUMULATION_*
+    uint32_t    normal_format;       // One of NORMALS_*
+    const char *compare_reference;   // Compare a checkpoint against this one, and exit
+    const char *compare_path;
+    bool        material_sort;       // Sort the paths of each workgroup by what they hit before shading
+    bool        persistent_threads;  // Start with the persistent threads kernel
+    bool        compare_kernels;     // Play the camera path once with each kernel
+
+    /////////////////
+    // Video streaming
+    const char *stream_path;   // Write every traced frame here, "-" for stdout
+    uint32_t    stream_format; // One of stream_format_t
+    uint32_t    stream_policy; // One of stream_policy_t
+    int         stream_queue;  // Frames being read back or waiting for the consumer
+    int         stream_fps;    // Only goes in the Y4M header
+
+    /////////////////
+    // Tiled rendering
+    const char *tiled_path;  // Render --resolution in tiles of --spp samples into this PFM, and exit
+    uint32_t    tile_size;   // Largest tile side, in pixels
+    float       tile_budget; // Milliseconds a single dispatch should take at most
+
+    /////////////////
+    // Distributed rendering
+    const char  *worker_address;  // Coordinator to take jobs from, as host:port
+    int          coordinate_port; // Hand out jobs on this port instead of rendering
+    uint32_t     spp;             // Samples per pixel the coordinator splits into jobs, or of every tile
+    uint32_t     job_spp;         // Samples per pixel of a single job
+    const char  *output_path;     // Where the coordinator writes the merged image, as a checkpoint
+    const char  *merge_output;    // Merge checkpoints into this one, and exit
+    const char **merge_inputs;
+    int          n_merge_inputs;
+} options_t;
+
+extern options_t options;
+
+void parse_options(int argc, char *argv[]);
+
+#endif // SRC_OPTIONS_H_
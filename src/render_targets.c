@@ -0,0 +1,322 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// The accumulation and normal textures, in the formats picked with
+// --accumulation-format and --normal-format. The accumulation is read and
+// written by every raytracer dispatch, so its size is most of the bandwidth
+// spent per pixel outside of tracing.
+//
+// RGBA32F keeps the sum of the frames and their count, like checkpoints do.
+// The smaller formats keep a running mean instead, whose precision doesn't
+// run out as frames pile up, and the count comes from the frame parameters.
+// Every new frame only moves the mean by a fraction of itself, which quickly
+// falls below the precision of a half float, so the shaders round
+// stochastically to keep the mean unbiased. Anything that reads or writes the
+// accumulation from the CPU goes through accumulation_export and
+// accumulation_import, which convert to and from the checkpoint layout.
+//
+// The render resolution is independent of the window, which only shows the
+// image scaled to fit. It follows the window unless a resolution was asked for
+// with --resolution or in the GUI, and everything sized like the image is
+// reallocated by the render thread when it changes. Offscreen resolutions are
+// only limited by the largest texture the GPU supports, and its memory.
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <glad/glad.h>
+
+#include "camera.h"
+#include "checkpoint.h"
+#include "compute.h"
+#include "display.h"
+#include "gpu_layout.h"
+#include "hybrid.h"
+#include "manager.h"
+#include "options.h"
+#include "render_targets.h"
+
+#define CONVERT_WORKGROUP_SIZE  16
+#define CHECKPOINT_IMAGE_UNIT   6
+#define ACCUMULATION_IMAGE_UNIT 0
+#define NORMAL_IMAGE_UNIT       1
+
+static char       shader_header[128];
+static compute_t *convert_shader;
+static uint32_t   checkpoint_texture; // RGBA32F copy in the checkpoint layout, created on first use
+static int        max_size;           // Largest texture side the GPU supports
+
+static GLenum accumulation_internal_format(uint32_t format) {
+    switch (format) {
+        case ACCUMULATION_RGBA16F: return GL_RGBA16F;
+        case ACCUMULATION_R11G11B10F: return GL_R11F_G11F_B10F;
+    }
+
+    return GL_RGBA32F;
+}
+
+const char *accumulation_format_name(uint32_t format) {
+    switch (format) {
+        case ACCUMULATION_RGBA16F: return "rgba16f";
+        case ACCUMULATION_R11G11B10F: return "r11g11b10f";
+    }
+
+    return "rgba32f";
+}
+
+uint32_t accumulation_bytes_per_pixel(uint32_t format) {
+    switch (format) {
+        case ACCUMULATION_RGBA16F: return 8;
+        case ACCUMULATION_R11G11B10F: return 4;
+    }
+
+    return 16;
+}
+
+static uint32_t make_render_target(GLenum internal_format, uint32_t unit, uint32_t width, uint32_t height) {
+    uint32_t texture;
+
+    glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+    glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTextureStorage2D(texture, 1, internal_format, width, height);
+    glClearTexImage(texture, 0, GL_RGBA, GL_FLOAT, NULL);
+    glBindImageTexture(unit, texture, 0, GL_FALSE, 0, GL_READ_WRITE, internal_format);
+
+    return texture;
+}
+
+static void make_render_targets(uint32_t width, uint32_t height) {
+    GLenum normal_format = options.normal_format == NORMALS_OCT16 ? GL_RG16_SNORM : GL_RGBA32F;
+
+    manager->render_texture = make_render_target(accumulation_internal_format(options.accumulation_format),
+                                                 ACCUMULATION_IMAGE_UNIT, width, height);
+    manager->debug_texture  = make_render_target(normal_format, NORMAL_IMAGE_UNIT, width, height);
+    manager->render_width   = width;
+    manager->render_height  = height;
+}
+
+static void destroy_render_targets() {
+    glDeleteTextures(1, &manager->render_texture);
+    glDeleteTextures(1, &manager->debug_texture);
+
+    if (checkpoint_texture != 0) {
+        glDeleteTextures(1, &checkpoint_texture);
+        checkpoint_texture = 0;
+    }
+}
+
+// Everything that is allocated per pixel: the accumulation, the normals, the
+// display image and the CPU tiles of hybrid rendering
+static double render_targets_size_mb(uint32_t width, uint32_t height) {
+    uint32_t normal_bytes = options.normal_format == NORMALS_OCT16 ? 4 : 16;
+    uint32_t bytes        = accumulation_bytes_per_pixel(options.accumulation_format) + normal_bytes + 4 + 16;
+
+    return (double)width * height * bytes / (1024.0 * 1024.0);
+}
+
+// Before any shader that includes render_targets.glsl is built, and after the camera exists
+void init_render_targets() {
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+
+    uint32_t width  = manager->requested_width ? manager->requested_width : manager->window_width;
+    uint32_t height = manager->requested_height ? manager->requested_height : manager->window_height;
+
+    if (width > (uint32_t)max_size || height > (uint32_t)max_size) {
+        printf("render targets: %ux%u is larger than the %d texels per side the GPU supports\n", width, height,
+               max_size);
+        exit(EXIT_FAILURE);
+    }
+
+    make_render_targets(width, height);
+    update_camera_projection_matrix(manager->camera);
+
+    snprintf(shader_header, sizeof(shader_header), "#define ACCUMULATION_FORMAT %u\n#define NORMAL_FORMAT %u\n",
+             options.accumulation_format, options.normal_format);
+
+    if (options.accumulation_format != ACCUMULATION_RGBA32F)
+        convert_shader = build_compute_shader_with_header("shaders/accumulation_convert.comp", shader_header);
+
+    printf("accumulation: %s, %u bytes per pixel\n", accumulation_format_name(options.accumulation_format),
+           accumulation_bytes_per_pixel(options.accumulation_format));
+    printf("render targets: %ux%u, %.0f MB\n", width, height, render_targets_size_mb(width, height));
+}
+
+// Render thread, with the lock held, or with it stopped. Reallocates
+// everything sized like the image, which starts the accumulation over. Returns
+// false when the GPU can't hold textures that large.
+bool render_targets_resize(uint32_t width, uint32_t height) {
+    if (width == manager->render_width && height == manager->render_height)
+        return true;
+
+    if (width == 0 || height == 0 || width > (uint32_t)max_size || height > (uint32_t)max_size) {
+        printf("render targets: can't render at %ux%u, the GPU supports up to %d texels per side\n", width, height,
+               max_size);
+        return false;
+    }
+
+    destroy_render_targets();
+    make_render_targets(width, height);
+    display_resize();
+    hybrid_resize();
+
+    // The aspect ratio changed. Also resets the accumulation.
+    update_camera_projection_matrix(manager->camera);
+
+    printf("render targets: %ux%u, %.0f MB\n", width, height, render_targets_size_mb(width, height));
+
+    return true;
+}
+
+// Render thread, with the lock held, before anything of the frame is
+// dispatched. Follows the window, or the resolution asked for in the GUI.
+void render_targets_update() {
+    uint32_t width  = manager->requested_width ? manager->requested_width : manager->window_width;
+    uint32_t height = manager->requested_height ? manager->requested_height : manager->window_height;
+
+    // A stream can't change the size of its frames midway
+    if (options.stream_path)
+        return;
+
+    // Minimized
+    if (width == 0 || height == 0)
+        return;
+
+    // Goes back to the current size, instead of failing every frame
+    if (!render_targets_resize(width, height)) {
+        manager->requested_width  = manager->render_width;
+        manager->requested_height = manager->render_height;
+    }
+}
+
+// Defines for the shaders that include render_targets.glsl
+const char *render_targets_shader_header() { return shader_header; }
+
+static void make_checkpoint_texture() {
+    if (checkpoint_texture != 0)
+        return;
+
+    glCreateTextures(GL_TEXTURE_2D, 1, &checkpoint_texture);
+    glTextureStorage2D(checkpoint_texture, 1, GL_RGBA32F, manager->render_width, manager->render_height);
+}
+
+static void convert(bool import) {
+    compute_use(convert_shader);
+    compute_set_int(convert_shader, "import_checkpoint", import);
+    compute_set_float(convert_shader, "frames", manager->accumulated_frames);
+
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    glBindImageTexture(CHECKPOINT_IMAGE_UNIT, checkpoint_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+    glDispatchCompute((manager->render_width + CONVERT_WORKGROUP_SIZE - 1) / CONVERT_WORKGROUP_SIZE,
+                      (manager->render_height + CONVERT_WORKGROUP_SIZE - 1) / CONVERT_WORKGROUP_SIZE, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+}
+
+// Render thread, or with it stopped. The texture to read the accumulation
+// from, as RGBA32F in the checkpoint layout.
+uint32_t accumulation_export() {
+    if (options.accumulation_format == ACCUMULATION_RGBA32F)
+        return manager->render_texture;
+
+    make_checkpoint_texture();
+    convert(false);
+
+    return checkpoint_texture;
+}
+
+// Replaces the accumulation with width * height RGBA32F texels in the
+// checkpoint layout. Also sets the frame count from them.
+void accumulation_import(const float *pixels) {
+    // Every pixel has seen the same number of frames
+    manager->accumulated_frames = pixels[3];
+
+    if (options.accumulation_format == ACCUMULATION_RGBA32F) {
+        glTextureSubImage2D(manager->render_texture, 0, 0, 0, manager->render_width, manager->render_height, GL_RGBA,
+                            GL_FLOAT, pixels);
+        return;
+    }
+
+    make_checkpoint_texture();
+    glTextureSubImage2D(checkpoint_texture, 0, 0, 0, manager->render_width, manager->render_height, GL_RGBA, GL_FLOAT,
+                        pixels);
+    convert(true);
+}
+
+// Offline accuracy check of the reduced formats, --compare. Both checkpoints
+// must come from the same camera path or seeds, so the only difference left
+// between them is the precision of the accumulation.
+int run_compare() {
+    checkpoint_header_t reference_header;
+    checkpoint_header_t header;
+    float              *reference = load_checkpoint(options.compare_reference, &reference_header);
+    float              *pixels    = load_checkpoint(options.compare_path, &header);
+
+    if (reference_header.width != header.width || reference_header.height != header.height ||
+        reference_header.accumulated_spp != header.accumulated_spp) {
+        printf("%s and %s differ in resolution or samples per pixel\n", options.compare_reference,
+               options.compare_path);
+        return 1;
+    }
+
+    uint64_t n_pixels       = (uint64_t)header.width * header.height;
+    uint64_t n_off          = 0; // More than 1% relative error
+    double   squared_error  = 0;
+    double   squared_signal = 0;
+    double   bias           = 0;
+    double   max_error      = 0;
+
+    for (uint64_t i = 0; i < n_pixels; i++) {
+        const float *r = &reference[i * 4];
+        const float *p = &pixels[i * 4];
+        double       pixel_error  = 0;
+        double       pixel_signal = 0;
+
+        for (int c = 0; c < 3; c++) {
+            double expected = r[3] > 0 ? r[c] / r[3] : 0;
+            double actual   = p[3] > 0 ? p[c] / p[3] : 0;
+            double error    = actual - expected;
+
+            squared_error += error * error;
+            squared_signal += expected * expected;
+            bias += error;
+            pixel_error += fabs(error);
+            pixel_signal += fabs(expected);
+
+            if (fabs(error) > max_error)
+                max_error = fabs(error);
+        }
+
+        if (pixel_error > 0.01 * pixel_signal && pixel_error > 1e-6)
+            n_off++;
+    }
+
+    printf("compared %s against %s, %u spp\n", options.compare_path, options.compare_reference, header.accumulated_spp);
+    printf("  relative rmse     %.6f\n", squared_signal > 0 ? sqrt(squared_error / squared_signal) : 0);
+    printf("  mean bias         %+.6e\n", bias / (n_pixels * 3));
+    printf("  max abs error     %.6e\n", max_error);
+    printf("  pixels off by >1%% %.3f%%\n", 100.0 * n_off / n_pixels);
+
+    free(reference);
+    free(pixels);
+
+    return 0;
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef SRC_RENDER_TARGETS_H_
+#define SRC_RENDER_TARGETS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+void        init_render_targets();
+bool        render_targets_resize(uint32_t width, uint32_t height);
+void        render_targets_update();
+const char *render_targets_shader_header();
+const char *accumulation_format_name(uint32_t format);
+uint32_t    accumulation_bytes_per_pixel(uint32_t format);
+
+uint32_t accumulation_export();
+void     accumulation_import(const float *pixels);
+
+int run_compare();
+
+#endif // SRC_RENDER_TARGETS_H_
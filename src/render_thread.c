@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// All GL calls after startup happen here. The main thread polls events,
+// handles input and builds the GUI, while this thread turns the state it left
+// behind into GPU work. Both take the render state lock to touch the manager,
+// the camera or the scene, and the GPU side work is submitted without it, so
+// the main thread can get going on the next frame.
+//
+// The GUI is the one hand-off between the two: the ImGui draw data is only
+// valid until the next frame is built, so the main thread waits for the
+// render thread to draw it first (render_thread_wait_gui).
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <glad/glad.h>
+
+#include <GLFW/glfw3.h>
+
+#include <pcg_variants.h>
+
+#include "animation.h"
+#include "benchmark.h"
+#include "camera.h"
+#include "capture.h"
+#include "checkpoint.h"
+#include "display.h"
+#include "frame_pipeline.h"
+#include "gui.h"
+#include "hybrid.h"
+#include "idle_policy.h"
+#include "manager.h"
+#include "options.h"
+#include "render_targets.h"
+#include "render_thread.h"
+#include "rendering.h"
+#include "scene.h"
+#include "stream.h"
+#include "tiled.h"
+
+static pthread_t       thread;
+static pthread_mutex_t state_lock    = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  state_changed = PTHREAD_COND_INITIALIZER;
+
+static uint64_t frames_submitted; // By the main thread
+static uint64_t frames_started;   // By the render thread
+static uint64_t frames_drawn;     // Frames whose GUI was drawn, and whose draw data can be reused
+static bool     quit;
+
+static compute_t *raytracer;
+
+void lock_render_state() { pthread_mutex_lock(&state_lock); }
+
+void unlock_render_state() { pthread_mutex_unlock(&state_lock); }
+
+// Must hold the lock
+void render_thread_wait_gui() {
+    while (frames_drawn < frames_submitted)
+        pthread_cond_wait(&state_changed, &state_lock);
+}
+
+// Must hold the lock
+void render_thread_submit_frame() {
+    frames_submitted++;
+    pthread_cond_broadcast(&state_changed);
+}
+
+static display_state_t display_state() {
+    display_state_t display = {
+        .tone_mapping_mode = manager->tone_mapping_mode,
+        .exposure          = manager->exposure,
+        .auto_exposure     = manager->auto_exposure,
+        .delta_time        = manager->delta_time,
+        .window_width      = manager->window_width,
+        .window_height     = manager->window_height,
+    };
+
+    return display;
+}
+
+// Only depends on the frame index, so resuming from a checkpoint continues the
+// exact sequence of samples
+static uint32_t frame_rng_seed(uint64_t frame_index) {
+    pcg32_random_t rng;
+
+    pcg32_srandom_r(&rng, manager->rng_seeds[0] + frame_index, manager->rng_seeds[1]);
+
+    return pcg32_random_r(&rng);
+}
+
+// Runs with the lock held
+static display_state_t prepare_frame(gpu_frame_params_t *params) {
+    if (manager->animate_scene) {
+        update_animation(manager->current_time);
+        manager->reset_accumulation = true;
+    }
+
+    if (manager->reset_accumulation) {
+        clear_texture(manager->render_texture);
+        manager->reset_accumulation = false;
+        manager->accumulated_spp    = 0;
+        manager->accumulated_frames = 0;
+        manager->accumulation_epoch++;
+    }
+
+    // Sees the image as of the end of the previous frame
+    checkpoint_update();
+
+    idle_policy_trace_frame(frame_pipeline_slot());
+    benchmark_commit_ray_counts();
+
+    flush_scene_buffers();
+    dispatch_gpu_refit();
+
+    manager->pipeline_wait_time = frame_pipeline_wait_time();
+
+    vec3 black = {0.0f, 0.0f, 0.0f};
+    vec3 white = {1.0f, 1.0f, 1.0f};
+
+    camera_fill_frame_params(manager->camera, params);
+    glm_vec3_copy(manager->ambient_light ? white : black, params->ambient_light);
+
+    params->time                  = manager->current_time;
+    params->rng_seed              = frame_rng_seed(manager->rng_frame_index++);
+    params->n_samples             = manager->n_samples;
+    params->n_bounces             = manager->n_bounces;
+    params->roulette_depth        = manager->roulette_depth;
+    params->plane_count           = n_planes;
+    params->incremental_rendering = manager->incremental_rendering;
+    params->wide_bvh              = manager->wide_bvh && wide_bvh_up_to_date();
+    params->count_rays            = benchmark_counts_rays();
+    params->ray_counter_slot      = benchmark_ray_counter_slot();
+    params->convergence_slot      = frame_pipeline_slot();
+    params->accumulated_frames    = manager->accumulated_frames - 1; // Already counts this one
+    params->image_offset_x        = 0;
+    params->image_offset_y        = 0;
+    params->image_width           = manager->render_width;
+    params->image_height          = manager->render_height;
+
+    tiled_prepare(params);
+    hybrid_prepare(params);
+    capture_update(true);
+    stream_update(true);
+
+    return display_state();
+}
+
+static void display_frame(const display_state_t *display) {
+    glViewport(0, 0, display->window_width, display->window_height);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    display_present(display);
+    gui_draw();
+}
+
+static void *render_loop(void *arg) {
+    glfwMakeContextCurrent(window);
+
+    pthread_mutex_lock(&state_lock);
+
+    while (true) {
+        while (frames_started == frames_submitted && !quit)
+            pthread_cond_wait(&state_changed, &state_lock);
+
+        if (quit)
+            break;
+
+        frames_started++;
+
+        // A new size starts the accumulation over, so it goes before deciding to trace
+        render_targets_update();
+
+        // Once converged, frames only redraw the last image and the GUI
+        bool trace = !idle_policy_converged();
+
+        pthread_mutex_unlock(&state_lock);
+
+        display_state_t display;
+
+        checkpoint_poll();
+        capture_poll();
+        stream_poll();
+
+        if (trace) {
+            // May wait on the GPU, so it happens before taking the lock
+            gpu_frame_params_t *slot = frame_pipeline_begin();
+            gpu_frame_params_t  params;
+            idle_policy_collect(frame_pipeline_slot());
+            benchmark_begin_frame();
+
+            pthread_mutex_lock(&state_lock);
+            display = prepare_frame(&params);
+            pthread_mutex_unlock(&state_lock);
+
+            // The slot is mapped write only, the CPU tracer keeps its own copy
+            *slot = params;
+
+            hybrid_dispatch(raytracer);
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+            display_invalidate();
+            frame_pipeline_end();
+            benchmark_end_frame(hybrid_persistent_threads(), params.count_rays);
+        } else {
+            pthread_mutex_lock(&state_lock);
+            checkpoint_update();
+            capture_update(false);
+            stream_update(false);
+            display = display_state();
+            pthread_mutex_unlock(&state_lock);
+        }
+
+        // Headless runs only resolve the image when something reads it back
+        if (!options.headless || capture_wants_display() || stream_wants_display())
+            display_update(&display);
+
+        capture_readback();
+        stream_readback();
+
+        if (!options.headless)
+            display_frame(&display);
+
+        pthread_mutex_lock(&state_lock);
+        frames_drawn = frames_started;
+        pthread_cond_broadcast(&state_changed);
+        pthread_mutex_unlock(&state_lock);
+
+        if (!options.headless)
+            glfwSwapBuffers(window);
+
+        pthread_mutex_lock(&state_lock);
+    }
+
+    pthread_mutex_unlock(&state_lock);
+
+    glFinish();
+    glfwMakeContextCurrent(NULL);
+
+    return NULL;
+}
+
+// Everything GL has to be set up by now, the context moves over to the render
+// thread until stop_render_thread
+void start_render_thread(compute_t *compute) {
+    raytracer = compute;
+
+    frames_submitted = 0;
+    frames_started   = 0;
+    frames_drawn     = 0;
+    quit             = false;
+
+    glfwMakeContextCurrent(NULL);
+
+    if (pthread_create(&thread, NULL, render_loop, NULL) != 0) {
+        printf("Failed to start the render thread\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Frames that were submitted but not started yet are dropped. The context is
+// current on the calling thread again when this returns.
+void stop_render_thread() {
+    pthread_mutex_lock(&state_lock);
+    quit = true;
+    pthread_cond_broadcast(&state_changed);
+    pthread_mutex_unlock(&state_lock);
+
+    pthread_join(thread, NULL);
+
+    glfwMakeContextCurrent(window);
+}
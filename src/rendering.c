@@ -22,17 +22,105 @@
 
 #include <glad/glad.h>
 
+#include "gpu_buffer.h"
 #include "manager.h"
 #include "rendering.h"
+#include "scene.h"
 
-void set_shader_storage_buffer(uint32_t binding_id, uint32_t size, void *data) {
-    GLuint ssbo;
+void init_scene_buffers() {
+    manager->materials_buffer = make_gpu_buffer("materials", GL_SHADER_STORAGE_BUFFER, SSBO_BINDING_MATERIALS,
+                                                sizeof(gpu_material_t), GPU_BUFFER_DYNAMIC);
+    manager->spheres_buffer   = make_gpu_buffer("spheres", GL_SHADER_STORAGE_BUFFER, SSBO_BINDING_SPHERES,
+                                                sizeof(gpu_sphere_t), GPU_BUFFER_DYNAMIC);
+    manager->triangles_buffer = make_gpu_buffer("triangles", GL_SHADER_STORAGE_BUFFER, SSBO_BINDING_TRIANGLES,
+                                                sizeof(gpu_triangle_t), GPU_BUFFER_DYNAMIC);
+    manager->quads_buffer     = make_gpu_buffer("quads", GL_SHADER_STORAGE_BUFFER, SSBO_BINDING_QUADS,
+                                                sizeof(gpu_quad_t), GPU_BUFFER_DYNAMIC);
+    manager->boxes_buffer     = make_gpu_buffer("boxes", GL_SHADER_STORAGE_BUFFER, SSBO_BINDING_BOXES,
+                                                sizeof(gpu_box_t), GPU_BUFFER_DYNAMIC);
+    manager->planes_buffer    = make_gpu_buffer("planes", GL_SHADER_STORAGE_BUFFER, SSBO_BINDING_PLANES,
+                                                sizeof(gpu_plane_t), GPU_BUFFER_DYNAMIC);
+    manager->blas_nodes_buffer = make_gpu_buffer("blas nodes", GL_SHADER_STORAGE_BUFFER, SSBO_BINDING_BLAS_NODES,
+                                                 sizeof(gpu_bvh_node_t), GPU_BUFFER_DYNAMIC);
+    manager->tlas_nodes_buffer = make_gpu_buffer("tlas nodes", GL_SHADER_STORAGE_BUFFER, SSBO_BINDING_TLAS_NODES,
+                                                 sizeof(gpu_bvh_node_t), GPU_BUFFER_DYNAMIC);
+    manager->instances_buffer  = make_gpu_buffer("instances", GL_SHADER_STORAGE_BUFFER, SSBO_BINDING_INSTANCES,
+                                                 sizeof(gpu_instance_t), GPU_BUFFER_DYNAMIC);
+    manager->blas4_nodes_buffer = make_gpu_buffer("blas4 nodes", GL_SHADER_STORAGE_BUFFER, SSBO_BINDING_BLAS4_NODES,
+                                                  sizeof(gpu_bvh4_node_t), GPU_BUFFER_DYNAMIC);
+    manager->refit_order_buffer = make_gpu_buffer("refit order", GL_SHADER_STORAGE_BUFFER, SSBO_BINDING_REFIT_ORDER,
+                                                  sizeof(int), GPU_BUFFER_DYNAMIC);
 
-    glGenBuffers(1, &ssbo);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, GL_DYNAMIC_DRAW);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding_id, ssbo);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    gpu_buffer_upload(manager->materials_buffer, scene_materials, n_materials);
+    gpu_buffer_upload(manager->spheres_buffer, scene_spheres, n_spheres);
+    gpu_buffer_upload(manager->triangles_buffer, scene_triangles, n_triangles);
+    gpu_buffer_upload(manager->quads_buffer, scene_quads, n_quads);
+    gpu_buffer_upload(manager->boxes_buffer, scene_boxes, n_boxes);
+    gpu_buffer_upload(manager->planes_buffer, scene_planes, n_planes);
+    gpu_buffer_upload(manager->blas_nodes_buffer, scene_blas_nodes, n_blas_nodes);
+    gpu_buffer_upload(manager->blas4_nodes_buffer, scene_blas4_nodes, n_blas4_nodes);
+    gpu_buffer_upload(manager->refit_order_buffer, scene_refit_order, n_blas_nodes);
+
+    flush_scene_buffers();
+
+    printf("scene buffers: %zu bytes of GPU memory\n", gpu_buffer_total_memory());
+}
+
+static gpu_buffer_t *primitives_buffer(int primitive_type) {
+    switch (primitive_type) {
+        case PRIMITIVE_SPHERE: return manager->spheres_buffer;
+        case PRIMITIVE_TRIANGLE: return manager->triangles_buffer;
+        case PRIMITIVE_QUAD: return manager->quads_buffer;
+        case PRIMITIVE_BOX: return manager->boxes_buffer;
+    }
+
+    printf("unknown primitive type %d\n", primitive_type);
+    exit(1);
+}
+
+// Pushes primitives marked with gpu_buffer_mark_dirty, and meshes that were
+// animated, refitted or rebuilt since the last call to the GPU
+void flush_scene_buffers() {
+    for (int i = 0; i < n_meshes; i++) {
+        mesh_t *mesh = &scene_meshes[i];
+
+        if (mesh->primitives_dirty)
+            gpu_buffer_mark_dirty(primitives_buffer(mesh->primitive_type), mesh->first_primitive, mesh->n_primitives);
+
+        if (mesh->nodes_dirty) {
+            gpu_buffer_mark_dirty(manager->blas_nodes_buffer, mesh->first_node, mesh->max_nodes);
+            gpu_buffer_mark_dirty(manager->blas4_nodes_buffer, mesh->first_wide_node, mesh->max_wide_nodes);
+        }
+
+        if (mesh->topology_dirty)
+            gpu_buffer_mark_dirty(manager->refit_order_buffer, mesh->first_node, mesh->max_nodes);
+
+        mesh->primitives_dirty = false;
+        mesh->nodes_dirty      = false;
+        mesh->topology_dirty   = false;
+    }
+
+    gpu_buffer_flush(manager->materials_buffer, scene_materials);
+    gpu_buffer_flush(manager->spheres_buffer, scene_spheres);
+    gpu_buffer_flush(manager->triangles_buffer, scene_triangles);
+    gpu_buffer_flush(manager->quads_buffer, scene_quads);
+    gpu_buffer_flush(manager->boxes_buffer, scene_boxes);
+    gpu_buffer_flush(manager->planes_buffer, scene_planes);
+    gpu_buffer_flush(manager->blas_nodes_buffer, scene_blas_nodes);
+    gpu_buffer_flush(manager->blas4_nodes_buffer, scene_blas4_nodes);
+    gpu_buffer_flush(manager->refit_order_buffer, scene_refit_order);
+
+    // Moving instances around only costs a top level rebuild, the meshes stay as they are
+    if (scene_tlas_dirty) {
+        scene_build_tlas();
+        gpu_buffer_upload(manager->tlas_nodes_buffer, scene_tlas_nodes, n_tlas_nodes);
+        gpu_buffer_upload(manager->instances_buffer, scene_gpu_instances, n_instances);
+        scene_tlas_dirty = false;
+    }
 }
 
 void clear_texture(uint32_t texture_id) { glClearTexImage(texture_id, 0, GL_RGBA, GL_FLOAT, NULL); }
+
+// Safe to call from any thread holding the render state lock, the texture is
+// cleared by the render thread before the next dispatch
+void reset_accumulation() { manager->reset_accumulation = true; }
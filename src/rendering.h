@@ -21,7 +21,9 @@
 
 #include <stdint.h>
 
-void set_shader_storage_buffer(uint32_t binding_id, uint32_t size, void *data);
+void init_scene_buffers();
+void flush_scene_buffers();
 void clear_texture(uint32_t texture_id);
+void reset_accumulation();
 
 #endif // SRC_RENDERING_H_
@@ -16,25 +16,422 @@
  *
  */
 
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
 #include "scene.h"
 
+// Few primitives per leaf keeps the bottom level traversal short, since the
+// primitive tests are about as cheap as the box tests
+#define BLAS_MAX_LEAF_SIZE 4
+
 // clang-format off
 vec3 camera_pos         = { -1.0 ,   2.75 ,  1.75 };
 vec3 camera_orientation = { -6.0 , 270.0  , 45.0  };
 // clang-format on
 
-vec4  positions[n_spheres];
-float radius[n_spheres];
-vec4  albedo[n_spheres];
-vec4  emission[n_spheres];
-float roughness[n_spheres];
-int   material_type[n_spheres];
+gpu_sphere_t   scene_spheres[n_spheres];
+gpu_triangle_t scene_triangles[n_triangles];
+gpu_quad_t     scene_quads[n_quads];
+gpu_box_t      scene_boxes[n_boxes];
+gpu_plane_t    scene_planes[n_planes];
+gpu_material_t scene_materials[max_materials];
+int            n_materials;
+
+mesh_t          scene_meshes[max_meshes];
+int             n_meshes;
+instance_t      scene_instances[max_instances];
+gpu_instance_t  scene_gpu_instances[max_instances];
+int             n_instances;
+gpu_bvh_node_t  scene_blas_nodes[max_blas_nodes];
+int             n_blas_nodes;
+int             scene_refit_order[max_blas_nodes];
+gpu_bvh4_node_t scene_blas4_nodes[max_blas4_nodes];
+int             n_blas4_nodes;
+gpu_bvh_node_t  scene_tlas_nodes[max_tlas_nodes];
+int             n_tlas_nodes;
+bool            scene_tlas_dirty;
+
+// Where the spheres started, so the animation doesn't drift over time
+static gpu_sphere_t rest_spheres[n_spheres];
+
+// Scratch space to feed the BVH builder and refit
+static aabb_t mesh_primitive_bounds[max_primitives];
+
+// Returns the id of the material in `scene_materials`. Primitives with the
+// exact same material share a single entry.
+static int add_material(vec4 albedo, vec4 emission, float roughness, material_type_t type) {
+    gpu_material_t material;
+
+    memset(&material, 0, sizeof(gpu_material_t));
+    glm_vec4_copy(albedo, material.albedo);
+    glm_vec4_copy(emission, material.emission);
+    material.albedo[3]   = 1.0;
+    material.emission[3] = 1.0;
+    material.roughness   = roughness;
+    material.type        = type;
+
+    for (int i = 0; i < n_materials; i++) {
+        if (memcmp(&scene_materials[i], &material, sizeof(gpu_material_t)) == 0)
+            return i;
+    }
+
+    scene_materials[n_materials] = material;
+
+    return n_materials++;
+}
+
+static void set_sphere(gpu_sphere_t *sphere, vec3 center, float radius, int material_id) {
+    memset(sphere, 0, sizeof(gpu_sphere_t));
+    glm_vec3_copy(center, sphere->center);
+    sphere->radius      = radius;
+    sphere->material_id = material_id;
+}
+
+static void set_triangle(gpu_triangle_t *triangle, vec3 v0, vec3 v1, vec3 v2, int material_id) {
+    memset(triangle, 0, sizeof(gpu_triangle_t));
+    glm_vec3_copy(v0, triangle->v0);
+    glm_vec3_sub(v1, v0, triangle->edge1);
+    glm_vec3_sub(v2, v0, triangle->edge2);
+    glm_vec3_crossn(triangle->edge1, triangle->edge2, triangle->normal);
+    triangle->material_id = material_id;
+}
+
+static void set_quad(gpu_quad_t *quad, vec3 corner, vec3 edge_u, vec3 edge_v, int material_id) {
+    memset(quad, 0, sizeof(gpu_quad_t));
+    glm_vec3_copy(corner, quad->corner);
+    glm_vec3_copy(edge_u, quad->edge_u);
+    glm_vec3_copy(edge_v, quad->edge_v);
+    glm_vec3_crossn(edge_u, edge_v, quad->normal);
+    quad->material_id = material_id;
+}
+
+static void set_box(gpu_box_t *box, vec3 box_min, vec3 box_max, int material_id) {
+    memset(box, 0, sizeof(gpu_box_t));
+    glm_vec3_copy(box_min, box->box_min);
+    glm_vec3_copy(box_max, box->box_max);
+    box->material_id = material_id;
+}
+
+// `checker_material_id` is -1 for a plain plane, see gpu_plane_t
+static void set_plane(gpu_plane_t *plane, vec3 normal, float offset, vec3 checker_u, vec3 checker_v, int material_id,
+                      int checker_material_id) {
+    memset(plane, 0, sizeof(gpu_plane_t));
+    glm_vec3_normalize_to(normal, plane->normal);
+    glm_vec3_copy(checker_u, plane->checker_u);
+    glm_vec3_copy(checker_v, plane->checker_v);
+    plane->offset              = offset;
+    plane->material_id         = material_id;
+    plane->checker_material_id = checker_material_id;
+}
+
+static void primitive_bounds(int primitive_type, int primitive_id, aabb_t *bounds) {
+    aabb_empty(bounds);
+
+    if (primitive_type == PRIMITIVE_SPHERE) {
+        gpu_sphere_t *sphere = &scene_spheres[primitive_id];
+        vec3          radius = {sphere->radius, sphere->radius, sphere->radius};
+
+        glm_vec3_sub(sphere->center, radius, bounds->min);
+        glm_vec3_add(sphere->center, radius, bounds->max);
+    } else if (primitive_type == PRIMITIVE_TRIANGLE) {
+        gpu_triangle_t *triangle = &scene_triangles[primitive_id];
+        vec3            v1, v2;
+
+        glm_vec3_add(triangle->v0, triangle->edge1, v1);
+        glm_vec3_add(triangle->v0, triangle->edge2, v2);
+
+        aabb_grow(bounds, triangle->v0);
+        aabb_grow(bounds, v1);
+        aabb_grow(bounds, v2);
+    } else if (primitive_type == PRIMITIVE_QUAD) {
+        gpu_quad_t *quad = &scene_quads[primitive_id];
+        vec3        corner;
+
+        aabb_grow(bounds, quad->corner);
+        glm_vec3_add(quad->corner, quad->edge_u, corner);
+        aabb_grow(bounds, corner);
+        glm_vec3_add(corner, quad->edge_v, corner);
+        aabb_grow(bounds, corner);
+        glm_vec3_sub(corner, quad->edge_u, corner);
+        aabb_grow(bounds, corner);
+    } else if (primitive_type == PRIMITIVE_BOX) {
+        aabb_grow(bounds, scene_boxes[primitive_id].box_min);
+        aabb_grow(bounds, scene_boxes[primitive_id].box_max);
+    } else {
+        printf("unknown primitive type %d\n", primitive_type);
+        exit(1);
+    }
+}
+
+static void permute(void *base, size_t element_size, const uint32_t *order, int count) {
+    char *elements = base;
+    char *original = malloc(count * element_size);
+
+    memcpy(original, elements, count * element_size);
+
+    for (int i = 0; i < count; i++) {
+        memcpy(elements + i * element_size, original + order[i] * element_size, element_size);
+    }
+
+    free(original);
+}
+
+// Sorts the primitives of the mesh in leaf order, so that the leaves can
+// reference contiguous ranges without an extra indirection on the GPU
+static void reorder_primitives(mesh_t *mesh) {
+    const uint32_t *order = mesh->bvh->indices;
+
+    if (mesh->primitive_type == PRIMITIVE_SPHERE) {
+        permute(&scene_spheres[mesh->first_primitive], sizeof(gpu_sphere_t), order, mesh->n_primitives);
+        permute(&rest_spheres[mesh->first_primitive], sizeof(gpu_sphere_t), order, mesh->n_primitives);
+    } else if (mesh->primitive_type == PRIMITIVE_TRIANGLE) {
+        permute(&scene_triangles[mesh->first_primitive], sizeof(gpu_triangle_t), order, mesh->n_primitives);
+    } else if (mesh->primitive_type == PRIMITIVE_QUAD) {
+        permute(&scene_quads[mesh->first_primitive], sizeof(gpu_quad_t), order, mesh->n_primitives);
+    } else {
+        permute(&scene_boxes[mesh->first_primitive], sizeof(gpu_box_t), order, mesh->n_primitives);
+    }
+}
+
+static void compute_primitive_bounds(mesh_t *mesh) {
+    for (int i = 0; i < mesh->n_primitives; i++) {
+        primitive_bounds(mesh->primitive_type, mesh->first_primitive + i, &mesh_primitive_bounds[i]);
+    }
+}
+
+// Node and primitive indices of the BVH are local to the mesh, make them global
+static void copy_mesh_nodes(mesh_t *mesh, bool topology_changed) {
+    for (uint32_t i = 0; i < mesh->bvh->n_nodes; i++) {
+        gpu_bvh_node_t node = mesh->bvh->nodes[i];
+        node.left_first += node.count > 0 ? mesh->first_primitive : mesh->first_node;
+
+        scene_blas_nodes[mesh->first_node + i] = node;
+    }
+
+    if (topology_changed) {
+        for (uint32_t i = 0; i < mesh->bvh->n_nodes; i++) {
+            scene_refit_order[mesh->first_node + i] = mesh->first_node + mesh->bvh->level_order[i];
+        }
+
+        mesh->topology_dirty = true;
+    }
+
+    mesh->n_wide_nodes = bvh_collapse4(mesh->bvh, &scene_blas4_nodes[mesh->first_wide_node], mesh->first_wide_node,
+                                       mesh->first_primitive);
+
+    glm_vec3_copy(mesh->bvh->nodes[0].aabb_min, mesh->bounds.min);
+    glm_vec3_copy(mesh->bvh->nodes[0].aabb_max, mesh->bounds.max);
+
+    mesh->nodes_dirty      = true;
+    mesh->wide_nodes_stale = false;
+}
+
+static void build_mesh_bvh(mesh_t *mesh) {
+    compute_primitive_bounds(mesh);
+
+    mesh->bvh      = build_bvh(mesh_primitive_bounds, mesh->n_primitives, BLAS_MAX_LEAF_SIZE);
+    mesh->sah_cost = mesh->bvh->build_cost;
+
+    reorder_primitives(mesh);
+    copy_mesh_nodes(mesh, true);
+
+    mesh->primitives_dirty = true;
+}
+
+int scene_add_mesh(int primitive_type, int first_primitive, int n_primitives) {
+    assert(n_meshes < max_meshes);
+    assert(n_primitives > 0);
+
+    mesh_t *mesh          = &scene_meshes[n_meshes];
+    mesh->primitive_type  = primitive_type;
+    mesh->first_primitive = first_primitive;
+    mesh->n_primitives    = n_primitives;
+
+    // Rebuilds can end up with a different node count, so reserve the worst case
+    mesh->first_node = n_blas_nodes;
+    mesh->max_nodes  = 2 * n_primitives - 1;
+    n_blas_nodes += mesh->max_nodes;
+    assert(n_blas_nodes <= max_blas_nodes);
+
+    mesh->first_wide_node = n_blas4_nodes;
+    mesh->max_wide_nodes  = n_primitives;
+    n_blas4_nodes += mesh->max_wide_nodes;
+    assert(n_blas4_nodes <= max_blas4_nodes);
+
+    build_mesh_bvh(mesh);
+
+    return n_meshes++;
+}
+
+// Updates the node bounds after the primitives of the mesh moved. The tree
+// itself is kept, so this is linear on the node count, but the quality of the
+// tree degrades as the primitives drift away from where it was built.
+float scene_refit_mesh(int mesh_id) {
+    mesh_t *mesh = &scene_meshes[mesh_id];
+
+    compute_primitive_bounds(mesh);
+    mesh->sah_cost = bvh_refit(mesh->bvh, mesh_primitive_bounds);
+    copy_mesh_nodes(mesh, false);
+
+    return mesh->sah_cost;
+}
 
-vec4 triangle_v0[n_triangles];
-vec4 triangle_v1[n_triangles];
-vec4 triangle_v2[n_triangles];
-vec4 triangle_albedo[n_triangles];
-vec4 triangle_emission[n_triangles];
+void scene_rebuild_mesh(int mesh_id) {
+    mesh_t *mesh = &scene_meshes[mesh_id];
+
+    destroy_bvh(mesh->bvh);
+    build_mesh_bvh(mesh);
+}
+
+// Only the bounds of the whole mesh, for the top level BVH. Cheap enough to do
+// every frame even when the nodes themselves are refitted on the GPU.
+void scene_update_mesh_bounds(int mesh_id) {
+    mesh_t *mesh = &scene_meshes[mesh_id];
+    aabb_t  bounds;
+
+    aabb_empty(&mesh->bounds);
+
+    for (int i = 0; i < mesh->n_primitives; i++) {
+        primitive_bounds(mesh->primitive_type, mesh->first_primitive + i, &bounds);
+        aabb_merge(&mesh->bounds, &bounds);
+    }
+
+    scene_tlas_dirty = true;
+}
+
+// Bounces the spheres around their resting positions
+void scene_animate(float time) {
+    for (int i = 0; i < n_meshes; i++) {
+        mesh_t *mesh = &scene_meshes[i];
+
+        if (mesh->primitive_type != PRIMITIVE_SPHERE)
+            continue;
+
+        for (int j = mesh->first_primitive; j < mesh->first_primitive + mesh->n_primitives; j++) {
+            gpu_sphere_t *rest   = &rest_spheres[j];
+            gpu_sphere_t *sphere = &scene_spheres[j];
+            float         phase  = rest->center[0] * 0.7f + rest->center[2] * 1.3f;
+
+            sphere->center[0] = rest->center[0] + sinf(time * 0.5f + phase) * 1.5f;
+            sphere->center[1] = rest->center[1] + fabsf(sinf(time * 2.0f + phase)) * 1.0f;
+        }
+
+        mesh->primitives_dirty = true;
+        scene_update_mesh_bounds(i);
+    }
+}
+
+int scene_add_instance(int mesh_id, mat4 transform, int material_override) {
+    assert(n_instances < max_instances);
+    assert(mesh_id >= 0 && mesh_id < n_meshes);
+
+    instance_t *instance        = &scene_instances[n_instances];
+    instance->mesh_id           = mesh_id;
+    instance->material_override = material_override;
+    glm_mat4_copy(transform, instance->transform);
+
+    scene_tlas_dirty = true;
+
+    return n_instances++;
+}
+
+void scene_set_instance_transform(int instance_id, mat4 transform) {
+    assert(instance_id >= 0 && instance_id < n_instances);
+
+    glm_mat4_copy(transform, scene_instances[instance_id].transform);
+    scene_tlas_dirty = true;
+}
+
+// The top level BVH is cheap to rebuild from scratch, since it only has one
+// leaf per instance. The bottom level BVHs are never touched here.
+void scene_build_tlas() {
+    assert(n_instances > 0);
+
+    aabb_t *bounds = malloc(sizeof(aabb_t) * n_instances);
+
+    for (int i = 0; i < n_instances; i++) {
+        instance_t     *instance     = &scene_instances[i];
+        mesh_t         *mesh         = &scene_meshes[instance->mesh_id];
+        gpu_instance_t *gpu_instance = &scene_gpu_instances[i];
+
+        aabb_transform(&mesh->bounds, instance->transform, &bounds[i]);
+
+        memset(gpu_instance, 0, sizeof(gpu_instance_t));
+        glm_mat4_inv(instance->transform, gpu_instance->world_to_object);
+        gpu_instance->root_node         = mesh->first_node;
+        gpu_instance->root_wide_node    = mesh->first_wide_node;
+        gpu_instance->primitive_type    = mesh->primitive_type;
+        gpu_instance->material_override = instance->material_override;
+    }
+
+    bvh_t *tlas = build_bvh(bounds, n_instances, 1);
+    free(bounds);
+
+    assert(tlas->n_nodes <= max_tlas_nodes);
+
+    // Leaves point straight at the instance instead of going through the index array
+    for (uint32_t i = 0; i < tlas->n_nodes; i++) {
+        gpu_bvh_node_t node = tlas->nodes[i];
+        if (node.count > 0)
+            node.left_first = tlas->indices[node.left_first];
+
+        scene_tlas_nodes[i] = node;
+    }
+
+    n_tlas_nodes = tlas->n_nodes;
+    destroy_bvh(tlas);
+}
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+// FNV-1a of everything that ends up in the image, used to tell whether a
+// checkpoint was rendered from this scene
+uint64_t scene_hash() {
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    hash = hash_bytes(hash, &n_materials, sizeof(n_materials));
+    hash = hash_bytes(hash, scene_materials, sizeof(gpu_material_t) * n_materials);
+    hash = hash_bytes(hash, scene_spheres, sizeof(scene_spheres));
+    hash = hash_bytes(hash, scene_triangles, sizeof(scene_triangles));
+    hash = hash_bytes(hash, scene_quads, sizeof(scene_quads));
+    hash = hash_bytes(hash, scene_boxes, sizeof(scene_boxes));
+    hash = hash_bytes(hash, scene_planes, sizeof(scene_planes));
+    hash = hash_bytes(hash, &n_instances, sizeof(n_instances));
+
+    for (int i = 0; i < n_instances; i++) {
+        hash = hash_bytes(hash, &scene_instances[i].mesh_id, sizeof(int));
+        hash = hash_bytes(hash, &scene_instances[i].material_override, sizeof(int));
+        hash = hash_bytes(hash, scene_instances[i].transform, sizeof(mat4));
+    }
+
+    return hash;
+}
+
+static void reset_scene() {
+    for (int i = 0; i < n_meshes; i++) {
+        destroy_bvh(scene_meshes[i].bvh);
+    }
+
+    n_materials      = 0;
+    n_meshes         = 0;
+    n_instances      = 0;
+    n_blas_nodes     = 0;
+    n_blas4_nodes    = 0;
+    n_tlas_nodes     = 0;
+    scene_tlas_dirty = true;
+}
 
 void init_scene() {
     // clang-format off
@@ -67,76 +464,89 @@ void init_scene() {
 
     // clang-format on
 
-    for (int i = 0; i < n_spheres; i++) {
-        for (int j = 0; j < 3; j++) {
-            positions[i][j] = data[i].position[j];
-            albedo[i][j]    = data[i].albedo[j];
-            emission[i][j]  = data[i].emission[j];
-        }
+    reset_scene();
 
-        positions[i][3] = 1.0;
-        albedo[i][3]    = 1.0;
-        emission[i][3]  = 1.0;
+    for (int i = 0; i < n_spheres; i++) {
+        int material_id = add_material(data[i].albedo, data[i].emission, data[i].roughness, data[i].material_type);
+        set_sphere(&scene_spheres[i], data[i].position, data[i].radius, material_id);
+    }
 
-        radius[i]        = data[i].radius;
-        roughness[i]     = data[i].roughness;
-        material_type[i] = data[i].material_type;
+    // The octahedron is kept around the origin and placed by its instance
+    for (int i = 0; i < n_triangles; i++) {
+        int material_id = add_material(triangles[i].albedo, triangles[i].emission, 0.0, DIFFUSE);
+        set_triangle(&scene_triangles[i], triangles[i].v0, triangles[i].v1, triangles[i].v2, material_id);
     }
 
-    const float triangle_x_offset = 2.0;
-    const float triangle_y_offset = 4.3;
-    const float triangle_z_offset = -10.0;
+    // A mirror standing to the right of the spheres
+    int mirror_material = add_material((vec4){0.9, 0.9, 0.9}, (vec4){0.0, 0.0, 0.0}, 0.02, METAL);
+    set_quad(&scene_quads[0], (vec3){6.0, 0.0, -12.0}, (vec3){3.0, 0.0, 0.0}, (vec3){0.0, 3.0, 0.0}, mirror_material);
 
-    for (int i = 0; i < n_triangles; i++) {
-        for (int j = 0; j < 3; j++) {
-            triangle_v0[i][j]       = triangles[i].v0[j];
-            triangle_v1[i][j]       = triangles[i].v1[j];
-            triangle_v2[i][j]       = triangles[i].v2[j];
-            triangle_albedo[i][j]   = triangles[i].albedo[j];
-            triangle_emission[i][j] = triangles[i].emission[j];
-        }
+    // A pedestal to the left, also centered on the origin and placed by its instance
+    int pedestal_material = add_material((vec4){0.6, 0.6, 0.6}, (vec4){0.0, 0.0, 0.0}, 0.0, DIFFUSE);
+    set_box(&scene_boxes[0], (vec3){-1.0, 0.0, -1.0}, (vec3){1.0, 1.5, 1.0}, pedestal_material);
 
-        triangle_v0[i][0] += triangle_x_offset;
-        triangle_v1[i][0] += triangle_x_offset;
-        triangle_v2[i][0] += triangle_x_offset;
+    // The ground, a checkerboard of unit squares on y = 0
+    int light_material = add_material((vec4){0.8, 0.8, 0.8}, (vec4){0.0, 0.0, 0.0}, 0.0, DIFFUSE);
+    int dark_material  = add_material((vec4){0.2, 0.2, 0.2}, (vec4){0.0, 0.0, 0.0}, 0.0, DIFFUSE);
+    set_plane(&scene_planes[0], (vec3){0.0, 1.0, 0.0}, 0.0, (vec3){1.0, 0.0, 0.0}, (vec3){0.0, 0.0, 1.0},
+              light_material, dark_material);
 
-        triangle_v0[i][1] += triangle_y_offset;
-        triangle_v1[i][1] += triangle_y_offset;
-        triangle_v2[i][1] += triangle_y_offset;
+    memcpy(rest_spheres, scene_spheres, sizeof(scene_spheres));
 
-        triangle_v0[i][2] += triangle_z_offset;
-        triangle_v1[i][2] += triangle_z_offset;
-        triangle_v2[i][2] += triangle_z_offset;
+    int spheres_mesh    = scene_add_mesh(PRIMITIVE_SPHERE, 0, n_spheres);
+    int octahedron_mesh = scene_add_mesh(PRIMITIVE_TRIANGLE, 0, n_triangles);
+    int mirror_mesh     = scene_add_mesh(PRIMITIVE_QUAD, 0, n_quads);
+    int pedestal_mesh   = scene_add_mesh(PRIMITIVE_BOX, 0, n_boxes);
 
-        triangle_v0[i][3]       = 1.0;
-        triangle_v1[i][3]       = 1.0;
-        triangle_v2[i][3]       = 1.0;
-        triangle_albedo[i][3]   = 1.0;
-        triangle_emission[i][3] = 1.0;
-    }
+    mat4 transform;
+    vec3 octahedron_position = {2.0, 4.3, -10.0};
+    vec3 pedestal_position   = {-7.0, 0.0, -10.0};
+
+    glm_mat4_identity(transform);
+    scene_add_instance(spheres_mesh, transform, -1);
+    scene_add_instance(mirror_mesh, transform, -1);
+
+    glm_translate_make(transform, octahedron_position);
+    scene_add_instance(octahedron_mesh, transform, -1);
+
+    glm_translate_make(transform, pedestal_position);
+    glm_rotate_y(transform, glm_rad(30.0), transform);
+    scene_add_instance(pedestal_mesh, transform, -1);
 }
 
 #ifdef _RANDOM_SCENE
 void init_scene() {
+    reset_scene();
+
     for (int i = 0; i < n_spheres; i++) {
+        vec4 albedo   = {0.0, 0.0, 0.0, 1.0};
+        vec4 emission = {0.0, 0.0, 0.0, 1.0};
+        vec3 center;
+
         for (int j = 0; j < 3; j++) {
-            albedo[i][j] = fabs(ldexp(pcg32_random(), -32));
+            albedo[j] = fabs(ldexp(pcg32_random(), -32));
         }
 
-        positions[i][0] = ldexp(pcg32_random(), -32) * 15.0;
-        positions[i][1] = ldexp(pcg32_random(), -32) - 1.0;
-        positions[i][2] = ldexp(pcg32_random(), -32) * 10.0 - 15.0;
-        printf("%f %f %f\n", positions[i][0], positions[i][1], positions[i][2]);
+        center[0] = ldexp(pcg32_random(), -32) * 15.0;
+        center[1] = ldexp(pcg32_random(), -32) - 1.0;
+        center[2] = ldexp(pcg32_random(), -32) * 10.0 - 15.0;
+        printf("%f %f %f\n", center[0], center[1], center[2]);
 
-        positions[i][3] = 1.0;
-        albedo[i][3]    = 1.0;
+        float radius        = fabs(ldexp(pcg32_random(), -32)) + 1.0;
+        float roughness     = fabs(ldexp(pcg32_random(), -32)) + 1.0;
+        int   material_type = pcg32_boundedrand(5);
+        if (material_type == 4)
+            material_type++;
 
-        radius[i]        = fabs(ldexp(pcg32_random(), -32)) + 1.0;
-        roughness[i]     = fabs(ldexp(pcg32_random(), -32)) + 1.0;
-        material_type[i] = pcg32_boundedrand(5);
-        if (material_type[i] == 4)
-            material_type[i]++;
+        int material_id = add_material(albedo, emission, roughness, material_type);
+        set_sphere(&scene_spheres[i], center, radius, material_id);
     }
+
+    memcpy(rest_spheres, scene_spheres, sizeof(scene_spheres));
+
+    mat4 transform;
+    glm_mat4_identity(transform);
+    scene_add_instance(scene_add_mesh(PRIMITIVE_SPHERE, 0, n_spheres), transform, -1);
 }
 #endif // _RANDOM_SCENE
 
@@ -19,15 +19,19 @@
 #ifndef SRC_SCENE_H_
 #define SRC_SCENE_H_
 
+#include <stdbool.h>
 #include <stdlib.h>
 
 #include <cglm/cglm.h>
 
+#include "bvh.h"
+#include "gpu_layout.h"
+
 typedef enum {
-    DIFFUSE    = 1,
-    METAL      = 2,
-    DIELECTRIC = 3,
-    LIGHT      = 5,
+    DIFFUSE    = MATERIAL_DIFFUSE,
+    METAL      = MATERIAL_METAL,
+    DIELECTRIC = MATERIAL_DIELECTRIC,
+    LIGHT      = MATERIAL_LIGHT,
 } material_type_t;
 
 typedef struct {
@@ -47,8 +51,51 @@ typedef struct {
     vec4 emission;
 } triangle_t;
 
+// A range of primitives of a single type sharing a bottom level BVH. The
+// primitives are stored in object space and reordered to match the BVH leaves.
+typedef struct {
+    int    primitive_type;
+    int    first_primitive;
+    int    n_primitives;
+    int    first_node;      // Root of the BVH in `scene_blas_nodes`
+    int    max_nodes;       // Nodes reserved for the BVH, starting at `first_node`
+    int    first_wide_node; // Root of the 4-wide BVH in `scene_blas4_nodes`
+    int    max_wide_nodes;
+    int    n_wide_nodes;
+    bvh_t *bvh;
+    aabb_t bounds;   // Object space
+    float  sah_cost; // Of the last build or refit, see bvh_sah_cost
+
+    // Ranges that changed since the last upload, cleared by flush_scene_buffers
+    bool primitives_dirty;
+    bool nodes_dirty;
+    bool topology_dirty;
+
+    // The 4-wide nodes are collapsed on the CPU, so they fall behind when the
+    // binary nodes are refitted on the GPU
+    bool wide_nodes_stale;
+} mesh_t;
+
+typedef struct {
+    int  mesh_id;
+    int  material_override;
+    mat4 transform; // Object to world
+} instance_t;
+
 void init_scene();
 
+int   scene_add_mesh(int primitive_type, int first_primitive, int n_primitives);
+float scene_refit_mesh(int mesh_id);
+void  scene_rebuild_mesh(int mesh_id);
+void  scene_update_mesh_bounds(int mesh_id);
+void  scene_animate(float time);
+
+int  scene_add_instance(int mesh_id, mat4 transform, int material_override);
+void scene_set_instance_transform(int instance_id, mat4 transform);
+void scene_build_tlas();
+
+uint64_t scene_hash();
+
 extern vec3 camera_pos;
 extern vec3 camera_orientation;
 
@@ -58,24 +105,47 @@ extern vec3 camera_orientation;
 
 #ifdef _OVEN_SCENE
 
-#define n_spheres   10
-#define n_triangles 8
-
-extern vec4  positions[n_spheres];
-extern float radius[n_spheres];
-extern vec4  albedo[n_spheres];
-extern vec4  emission[n_spheres];
-extern float roughness[n_spheres];
-extern int   material_type[n_spheres];
-
-extern vec4 triangle_v0[n_triangles];
-extern vec4 triangle_v1[n_triangles];
-extern vec4 triangle_v2[n_triangles];
-extern vec4 triangle_albedo[n_triangles];
-extern vec4 triangle_emission[n_triangles];
+#define n_spheres     10
+#define n_triangles   8
+#define n_quads       1
+#define n_boxes       1
+#define n_planes      1
+#define max_materials (n_spheres + n_triangles + n_quads + n_boxes + 2 * n_planes)
+
+extern gpu_sphere_t   scene_spheres[n_spheres];
+extern gpu_triangle_t scene_triangles[n_triangles];
+extern gpu_quad_t     scene_quads[n_quads];
+extern gpu_box_t      scene_boxes[n_boxes];
+extern gpu_plane_t    scene_planes[n_planes];
+extern gpu_material_t scene_materials[max_materials];
+extern int            n_materials;
 
 #endif // _OVEN_SCENE
 
+#define max_meshes      16
+#define max_instances   256
+#define max_primitives  (n_spheres + n_triangles + n_quads + n_boxes)
+#define max_blas_nodes  (2 * max_primitives)
+#define max_blas4_nodes max_primitives
+#define max_tlas_nodes  (2 * max_instances)
+
+extern mesh_t          scene_meshes[max_meshes];
+extern int             n_meshes;
+extern instance_t      scene_instances[max_instances];
+extern gpu_instance_t  scene_gpu_instances[max_instances];
+extern int             n_instances;
+extern gpu_bvh_node_t  scene_blas_nodes[max_blas_nodes];
+extern int             n_blas_nodes;
+extern int             scene_refit_order[max_blas_nodes]; // Bottom level nodes of each mesh, level by level
+extern gpu_bvh4_node_t scene_blas4_nodes[max_blas4_nodes];
+extern int             n_blas4_nodes;
+extern gpu_bvh_node_t  scene_tlas_nodes[max_tlas_nodes];
+extern int             n_tlas_nodes;
+
+// Set whenever an instance is added or moved. Whoever owns the GPU copy of the
+// top level BVH rebuilds it with `scene_build_tlas` and clears the flag.
+extern bool scene_tlas_dirty;
+
 #ifdef _CORNELL_BOX_SCENE
 
 vec3 camera_pos = {47, 51, -80};
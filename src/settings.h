@@ -19,9 +19,10 @@
 #ifndef SRC_SETTINGS_H_
 #define SRC_SETTINGS_H_
 
-extern const int   WINDOW_WIDTH;
-extern const int   WINDOW_HEIGHT;
-extern const float aspect_ratio;
+// Initial size of the window, and of the render targets unless --resolution
+// says otherwise
+extern const int WINDOW_WIDTH;
+extern const int WINDOW_HEIGHT;
 
 extern const float near_plane;
 extern const float far_plane;
@@ -0,0 +1,339 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// Video output for turntables and fly-throughs. The display image of every
+// traced frame is read back into one of a bounded ring of persistently mapped
+// pixel pack buffers. A writer thread converts the frames the GPU is done
+// with, in order, and writes them to a file or to stdout, for any encoder to
+// consume. When the ring is full the render thread either waits or drops the
+// frame, see stream_policy_t.
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glad/glad.h>
+
+#include "display.h"
+#include "gpu_buffer.h"
+#include "manager.h"
+#include "options.h"
+#include "stream.h"
+
+typedef enum {
+    SLOT_FREE,
+    SLOT_READBACK, // Waiting on the GPU, owned by the render thread
+    SLOT_WRITING,  // Queued for or being written by the writer thread
+} slot_state_t;
+
+typedef struct {
+    gpu_buffer_t *buffer;
+    GLsync        fence;
+    slot_state_t  state;
+} stream_slot_t;
+
+static FILE *output;
+
+// Used round robin, so frames come out in the order they were traced. The
+// render thread fills next_slot and hands slots over from readback_slot on,
+// the writer writes from write_slot on.
+static stream_slot_t *slots;
+static int            n_slots;
+static int            next_slot;
+static int            readback_slot;
+static int            write_slot;
+static int            n_readback;
+static int            n_writing;
+
+static pthread_t       writer;
+static pthread_mutex_t stream_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  writer_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  slot_freed  = PTHREAD_COND_INITIALIZER;
+static bool            quit;
+static bool            failed; // The consumer went away, every frame after is dropped
+static uint32_t        n_written;
+static uint32_t        n_dropped;
+
+static bool pending;
+
+// The render resolution when the stream started, it can't change afterwards
+static uint32_t width;
+static uint32_t height;
+
+static size_t frame_size() { return (size_t)width * height * 4; }
+
+// Called right after the options are parsed, before anything is printed.
+// Streaming to stdout moves everything else the program prints to stderr.
+void open_stream() {
+    if (strcmp(options.stream_path, "-") == 0) {
+        int fd = dup(STDOUT_FILENO);
+
+        fflush(stdout);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+        output = fdopen(fd, "wb");
+    } else {
+        output = fopen(options.stream_path, "wb");
+    }
+
+    if (output == NULL) {
+        printf("stream: failed to open %s\n", options.stream_path);
+        exit(EXIT_FAILURE);
+    }
+
+    // A consumer that exits early shows up as a write error instead
+    signal(SIGPIPE, SIG_IGN);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Writer thread. Pixels come in OpenGL order, bottom row first.
+
+static uint8_t *frame_buffer;
+
+// BT.709, limited range
+static void write_y4m(const uint8_t *pixels) {
+    const size_t plane = (size_t)width * height;
+
+    for (uint32_t y = 0; y < height; y++) {
+        const uint8_t *src = &pixels[(size_t)(height - 1 - y) * width * 4];
+
+        for (uint32_t x = 0; x < width; x++) {
+            float  r = src[x * 4 + 0];
+            float  g = src[x * 4 + 1];
+            float  b = src[x * 4 + 2];
+            size_t i = (size_t)y * width + x;
+
+            frame_buffer[i]             = 16.5f + (0.2126f * r + 0.7152f * g + 0.0722f * b) * (219.0f / 255.0f);
+            frame_buffer[plane + i]     = 128.5f + (-0.1146f * r - 0.3854f * g + 0.5f * b) * (224.0f / 255.0f);
+            frame_buffer[2 * plane + i] = 128.5f + (0.5f * r - 0.4542f * g - 0.0458f * b) * (224.0f / 255.0f);
+        }
+    }
+
+    fwrite("FRAME\n", 6, 1, output);
+    fwrite(frame_buffer, plane * 3, 1, output);
+}
+
+static void write_rgba(const uint8_t *pixels) {
+    const size_t row_size = (size_t)width * 4;
+
+    for (uint32_t y = 0; y < height; y++)
+        memcpy(&frame_buffer[y * row_size], &pixels[(height - 1 - y) * row_size], row_size);
+
+    fwrite(frame_buffer, frame_size(), 1, output);
+}
+
+static void *write_loop(void *arg) {
+    pthread_mutex_lock(&stream_lock);
+
+    while (true) {
+        while (n_writing == 0 && !quit)
+            pthread_cond_wait(&writer_wake, &stream_lock);
+
+        if (n_writing == 0)
+            break;
+
+        stream_slot_t *slot  = &slots[write_slot];
+        bool           write = !failed;
+
+        pthread_mutex_unlock(&stream_lock);
+
+        if (write) {
+            if (options.stream_format == STREAM_Y4M)
+                write_y4m(slot->buffer->mapped);
+            else
+                write_rgba(slot->buffer->mapped);
+
+            if (fflush(output) != 0 || ferror(output)) {
+                printf("stream: failed to write to %s, dropping the rest of the frames\n", options.stream_path);
+                write = false;
+            }
+        }
+
+        pthread_mutex_lock(&stream_lock);
+
+        failed      = failed || !write;
+        slot->state = SLOT_FREE;
+        write_slot  = (write_slot + 1) % n_slots;
+        n_writing--;
+        n_written += write;
+        pthread_cond_broadcast(&slot_freed);
+    }
+
+    pthread_mutex_unlock(&stream_lock);
+
+    return NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Render thread
+
+// After the render resolution is settled, resuming from a checkpoint included
+void init_stream() {
+    width  = manager->render_width;
+    height = manager->render_height;
+
+    if (options.stream_format == STREAM_Y4M)
+        fprintf(output, "YUV4MPEG2 W%u H%u F%d:1 Ip A1:1 C444\n", width, height, options.stream_fps);
+
+    n_slots = options.stream_queue;
+    slots   = calloc(n_slots, sizeof(stream_slot_t));
+
+    frame_buffer = malloc(frame_size());
+
+    for (int i = 0; i < n_slots; i++) {
+        slots[i].buffer = make_gpu_buffer("stream", GL_PIXEL_PACK_BUFFER, GPU_BUFFER_NO_BINDING, frame_size(),
+                                          GPU_BUFFER_PERSISTENT_READBACK);
+        slots[i].state  = SLOT_FREE;
+    }
+
+    if (pthread_create(&writer, NULL, write_loop, NULL) != 0) {
+        printf("Failed to start the stream writer thread\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Hands the oldest readbacks the GPU is done with to the writer, in order.
+// When waiting, waits for the oldest one.
+static void collect_readbacks(bool wait) {
+    while (n_readback > 0) {
+        stream_slot_t *slot   = &slots[readback_slot];
+        GLenum         status =
+            glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? GL_TIMEOUT_IGNORED : 0);
+
+        if (status == GL_TIMEOUT_EXPIRED)
+            return;
+
+        if (status == GL_WAIT_FAILED) {
+            printf("stream: glClientWaitSync failed\n");
+            exit(EXIT_FAILURE);
+        }
+
+        glDeleteSync(slot->fence);
+        slot->fence = NULL;
+
+        pthread_mutex_lock(&stream_lock);
+        slot->state = SLOT_WRITING;
+        n_writing++;
+        pthread_cond_signal(&writer_wake);
+        pthread_mutex_unlock(&stream_lock);
+
+        n_readback--;
+        readback_slot = (readback_slot + 1) % n_slots;
+        wait          = false;
+    }
+}
+
+void stream_poll() {
+    if (output)
+        collect_readbacks(false);
+}
+
+// Render thread, with the lock held, once per frame
+void stream_update(bool traced) {
+    if (output == NULL)
+        return;
+
+    pthread_mutex_lock(&stream_lock);
+    manager->n_streamed_frames = n_written;
+    manager->n_dropped_frames  = n_dropped;
+    pending                    = traced && !failed;
+    pthread_mutex_unlock(&stream_lock);
+}
+
+// The ring is used in order, so the next slot is the only one that can be free
+static bool acquire_slot() {
+    while (true) {
+        pthread_mutex_lock(&stream_lock);
+
+        bool free    = slots[next_slot].state == SLOT_FREE;
+        bool writing = n_writing > 0;
+
+        if (!free && writing && options.stream_policy == STREAM_BLOCK)
+            pthread_cond_wait(&slot_freed, &stream_lock);
+
+        if (!free && options.stream_policy == STREAM_DROP)
+            n_dropped++;
+
+        pthread_mutex_unlock(&stream_lock);
+
+        if (free)
+            return true;
+
+        if (options.stream_policy == STREAM_DROP)
+            return false;
+
+        // Everything is still on the GPU
+        if (!writing)
+            collect_readbacks(true);
+    }
+}
+
+// The display image has to be up to date
+bool stream_wants_display() { return pending; }
+
+// Render thread, after the frame was traced and displayed
+void stream_readback() {
+    if (!pending)
+        return;
+
+    pending = false;
+
+    if (!acquire_slot())
+        return;
+
+    stream_slot_t *slot = &slots[next_slot];
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer->id);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, display_framebuffer());
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    pthread_mutex_lock(&stream_lock);
+    slot->state = SLOT_READBACK;
+    pthread_mutex_unlock(&stream_lock);
+
+    n_readback++;
+    next_slot = (next_slot + 1) % n_slots;
+}
+
+// At exit, with the render thread stopped. Writes everything in flight.
+void stream_finish() {
+    if (output == NULL)
+        return;
+
+    while (n_readback > 0)
+        collect_readbacks(true);
+
+    pthread_mutex_lock(&stream_lock);
+    quit = true;
+    pthread_cond_signal(&writer_wake);
+    pthread_mutex_unlock(&stream_lock);
+
+    pthread_join(writer, NULL);
+    fclose(output);
+
+    printf("stream: %u frames written, %u dropped\n", n_written, n_dropped);
+}
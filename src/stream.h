@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef SRC_STREAM_H_
+#define SRC_STREAM_H_
+
+#include <stdbool.h>
+
+#define STREAM_DEFAULT_QUEUE 4
+#define STREAM_DEFAULT_FPS   60
+
+typedef enum {
+    STREAM_Y4M,  // YUV4MPEG2, 4:4:4, which most encoders read from a pipe
+    STREAM_RGBA, // Raw 8 bit RGBA, top row first, no header
+} stream_format_t;
+
+typedef enum {
+    STREAM_BLOCK, // Wait for the consumer, every traced frame is written
+    STREAM_DROP,  // Skip frames while the queue is full
+} stream_policy_t;
+
+void open_stream();
+void init_stream();
+void stream_poll();
+void stream_update(bool traced);
+bool stream_wants_display();
+void stream_readback();
+void stream_finish();
+
+#endif // SRC_STREAM_H_
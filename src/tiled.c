@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2023  Renan S. Silva, aka h3nnn4n
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the “Software”), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// Renders images larger than the GPU could hold, or trace in one go, a tile at
+// a time (--tiled). The render targets are sized like a tile, and the frame
+// parameters say where it sits in the whole image, so every pixel gets the
+// rays it would have had in a single render. The main loop goes around once
+// per tile, like it does once per job for workers.
+//
+// Every tile takes --spp samples, in passes sized from what a sample cost on
+// the previous tile so that no dispatch runs for longer than --tile-budget,
+// far from the driver watchdog. Finished tiles are written straight to their
+// place in the output file, so only a single tile is ever kept in memory.
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include <glad/glad.h>
+
+#include <GLFW/glfw3.h>
+
+#include "hybrid.h"
+#include "manager.h"
+#include "options.h"
+#include "render_targets.h"
+#include "rendering.h"
+#include "tiled.h"
+
+static FILE  *output;
+static off_t  data_start; // Right after the PFM header
+static float *tile_pixels;
+static float *row;
+
+static uint32_t tiles_x;
+static uint32_t tiles_y;
+static uint32_t n_tiles;
+
+// The tile being rendered, bottom left first, in OpenGL order like PFM rows
+static uint32_t tile;
+static uint32_t tile_x;
+static uint32_t tile_y;
+static uint32_t tile_width;
+static uint32_t tile_height;
+static uint32_t tile_spp; // A multiple of the samples per pass, so at least --spp
+static double   tile_start_time;
+
+static double sample_cost; // GPU seconds per sample per pixel, as of the last tile
+static double start_time;
+
+static void start_tile() {
+    tile_x      = (tile % tiles_x) * options.tile_size;
+    tile_y      = (tile / tiles_x) * options.tile_size;
+    tile_width  = options.tile_size;
+    tile_height = options.tile_size;
+
+    // The last row and column are cut at the edge of the image
+    if (tile_x + tile_width > options.render_width)
+        tile_width = options.render_width - tile_x;
+    if (tile_y + tile_height > options.render_height)
+        tile_height = options.render_height - tile_y;
+
+    // Picked up by the render thread with the next frame
+    manager->requested_width  = tile_width;
+    manager->requested_height = tile_height;
+
+    // Nothing to go by on the first tile, so it takes a sample at a time
+    double max_samples = 1;
+
+    if (sample_cost > 0)
+        max_samples = options.tile_budget * 1e-3 / (sample_cost * tile_width * tile_height);
+
+    if (max_samples > options.spp)
+        max_samples = options.spp;
+    if (max_samples < 1)
+        max_samples = 1;
+
+    // Equal passes, so every frame weighs the same in the accumulation
+    uint32_t n_passes = (options.spp + (uint32_t)max_samples - 1) / (uint32_t)max_samples;
+
+    manager->n_samples = (options.spp + n_passes - 1) / n_passes;
+    tile_spp           = n_passes * manager->n_samples;
+    tile_start_time    = glfwGetTime();
+
+    reset_accumulation();
+}
+
+// With the GL context, before the render thread starts. Writes the header and
+// starts on the first tile.
+void init_tiled() {
+    output = fopen(options.tiled_path, "wb");
+
+    if (output == NULL) {
+        printf("tiled: failed to open %s for writing\n", options.tiled_path);
+        exit(EXIT_FAILURE);
+    }
+
+    // A negative scale means little endian
+    fprintf(output, "PF\n%u %u\n-1.0\n", options.render_width, options.render_height);
+    data_start = ftello(output);
+
+    tiles_x = (options.render_width + options.tile_size - 1) / options.tile_size;
+    tiles_y = (options.render_height + options.tile_size - 1) / options.tile_size;
+    n_tiles = tiles_x * tiles_y;
+
+    tile_pixels = malloc((size_t)options.tile_size * options.tile_size * 4 * sizeof(float));
+    row         = malloc((size_t)options.tile_size * 3 * sizeof(float));
+
+    // Every tile accumulates exactly its samples, whatever the GUI defaults are
+    manager->incremental_rendering = true;
+    manager->animate_scene         = false;
+    manager->hybrid_rendering      = false;
+    manager->freeze_movement       = true;
+    manager->target_spp            = 0;
+    manager->noise_threshold       = 0;
+
+    printf("tiled: %ux%u in %u tiles of up to %ux%u, %u spp\n", options.render_width, options.render_height,
+           n_tiles, options.tile_size, options.tile_size, options.spp);
+
+    tile       = 0;
+    start_time = glfwGetTime();
+    start_tile();
+}
+
+// Render thread, with the lock held
+void tiled_prepare(gpu_frame_params_t *params) {
+    if (options.tiled_path == NULL)
+        return;
+
+    params->image_offset_x = tile_x;
+    params->image_offset_y = tile_y;
+    params->image_width    = options.render_width;
+    params->image_height   = options.render_height;
+}
+
+// Must hold the render state lock. The size check makes sure the samples were
+// taken with the render targets of this tile.
+bool tiled_tile_done() {
+    return !manager->reset_accumulation && manager->render_width == tile_width &&
+           manager->render_height == tile_height && manager->accumulated_spp >= tile_spp;
+}
+
+static bool write_tile() {
+    for (uint32_t y = 0; y < tile_height; y++) {
+        const float *src = &tile_pixels[(size_t)y * tile_width * 4];
+
+        for (uint32_t x = 0; x < tile_width; x++) {
+            float frames = src[x * 4 + 3];
+
+            for (int c = 0; c < 3; c++)
+                row[x * 3 + c] = frames > 0 ? src[x * 4 + c] / frames : 0.0f;
+        }
+
+        off_t offset = data_start + ((off_t)(tile_y + y) * options.render_width + tile_x) * 3 * sizeof(float);
+
+        if (fseeko(output, offset, SEEK_SET) != 0 || fwrite(row, tile_width * 3 * sizeof(float), 1, output) != 1)
+            return false;
+    }
+
+    return true;
+}
+
+// With the render thread stopped. Writes the tile out and starts on the next
+// one, if there is one.
+bool tiled_finish_tile() {
+    size_t size = (size_t)tile_width * tile_height * 4 * sizeof(float);
+
+    // A single readback per tile, stalling here is fine
+    glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+    glGetTextureImage(accumulation_export(), 0, GL_RGBA, GL_FLOAT, size, tile_pixels);
+
+    if (!write_tile()) {
+        printf("tiled: failed to write %s\n", options.tiled_path);
+        exit(EXIT_FAILURE);
+    }
+
+    // Smoothed over the frames of the tile, which all took the same number of samples
+    if (manager->gpu_tile_time > 0)
+        sample_cost = manager->gpu_tile_time / (HYBRID_TILE_SIZE * HYBRID_TILE_SIZE) / manager->n_samples;
+
+    printf("tiled: tile %u/%u at %u,%u, %ux%u, %u spp in passes of %u, %.1f s\n", tile + 1, n_tiles, tile_x, tile_y,
+           tile_width, tile_height, manager->accumulated_spp, manager->n_samples, glfwGetTime() - tile_start_time);
+
+    if (++tile < n_tiles) {
+        start_tile();
+        return true;
+    }
+
+    if (fclose(output) != 0) {
+        printf("tiled: failed to write %s\n", options.tiled_path);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("tiled: %s written in %.1f s\n", options.tiled_path, glfwGetTime() - start_time);
+
+    free(tile_pixels);
+    free(row);
+
+    return false;
+}